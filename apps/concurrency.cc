@@ -0,0 +1,69 @@
+#include "apps/benchmark.h"
+#include "apps/pipelines.h"
+#include "runtime/pipeline.h"
+#include "builder/pipeline.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace slinky;
+
+int main(int argc, const char** argv) {
+  pipeline p = make_stencil_pipeline();
+
+  const int max_threads = std::max<int>(1, std::thread::hardware_concurrency());
+  // The number of evaluations each thread runs per benchmark iteration, to amortize the cost of starting threads.
+  const int evaluations_per_thread = 100;
+
+  const int sizes[] = {16, 64, 256};
+
+  std::cout << std::endl;
+  for (int size : sizes) {
+    std::cout << "### " << size << "x" << size << std::endl;
+
+    buffer<short, 2> in_buf({size + 2, size + 2});
+    in_buf.translate(-1, -1);
+    in_buf.allocate();
+    for_each_index(in_buf, [&](auto i) { in_buf(i) = rand() % 64; });
+
+    std::cout << "| threads | evaluations/s | scaling |" << std::endl;
+    std::cout << "|---------|---------------|---------|" << std::endl;
+    double single_thread_rate = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      // Each thread gets its own output buffer and context, but all of them share the pipeline and input buffer.
+      std::vector<std::unique_ptr<buffer<short, 2>>> out_bufs;
+      for (int t = 0; t < threads; ++t) {
+        out_bufs.push_back(std::make_unique<buffer<short, 2>>(std::initializer_list<index_t>{size, size}));
+        out_bufs.back()->allocate();
+      }
+
+      double t = benchmark([&]() {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i) {
+          workers.emplace_back([&, i]() {
+            eval_context ctx;
+            const raw_buffer* inputs[] = {&in_buf};
+            const raw_buffer* outputs[] = {out_bufs[i].get()};
+            for (int j = 0; j < evaluations_per_thread; ++j) {
+              p.evaluate(inputs, outputs, ctx);
+            }
+          });
+        }
+        for (std::thread& i : workers) {
+          i.join();
+        }
+      });
+
+      double rate = threads * evaluations_per_thread / t;
+      if (threads == 1) single_thread_rate = rate;
+      std::cout << "| " << threads << " | " << rate << " | " << rate / single_thread_rate << " |" << std::endl;
+    }
+    std::cout << std::endl;
+  }
+
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "apps/benchmark.h"
+#include "apps/pipelines.h"
 #include "runtime/pipeline.h"
 #include "builder/pipeline.h"
 
@@ -11,59 +12,9 @@
 
 using namespace slinky;
 
-// Unfortunately, here in 2024 on modern OSes, the standard `memcpy` is over 10x slower than this on AMD CPUs. Over a
-// certain size, `memcpy` uses a `rep movsb` sequence, which is apparently really bad on AMD Zen:
-// https://bugs.launchpad.net/ubuntu/+source/glibc/+bug/2030515
-// We can work around this by memcpying 2048 bytes or less at a time.
-void memcpy_workaround(char* dst, const char* src, std::size_t size) {
-  constexpr std::size_t chunk_size = 2048;
-  for (std::size_t i = 0; i < size; i += chunk_size) {
-    std::size_t size_i = std::min(size - i, chunk_size);
-    memcpy(dst, src, size_i);
-    dst += chunk_size;
-    src += chunk_size;
-  }
-}
-
-// Copy from input to output.
-// TODO: We should be able to just do this with raw_buffer and not make it a template.
-template <typename T>
-index_t copy(const buffer<const T>& in, const buffer<T>& out) {
-  const T* src = &in(out.dim(0).min(), out.dim(1).min());
-  T* dst = &out(out.dim(0).min(), out.dim(1).min());
-  std::size_t size_bytes = out.dim(0).extent() * out.elem_size;
-  for (index_t y = out.dim(1).begin(); y < out.dim(1).end(); ++y) {
-    memcpy_workaround((char*)dst, (const char*)src, size_bytes);
-    dst += out.dim(1).stride();
-    src += in.dim(1).stride();
-  }
-  return 0;
-}
-
-pipeline make_pipeline(bool explicit_y) {
-  // Make the pipeline
-  node_context ctx;
-
-  auto in = buffer_expr::make(ctx, "in", sizeof(char), 2);
-  auto out = buffer_expr::make(ctx, "out", sizeof(char), 2);
-
-  var x(ctx, "x");
-  var y(ctx, "y");
-
-  func copy = func::make<const char, char>(::copy<char>, {in, {point(x), point(y)}}, {out, {x, y}});
-
-  if (explicit_y) {
-    copy.loops({y});
-  }
-
-  pipeline p = build_pipeline(ctx, {in}, {out}, build_options{.no_checks = true});
-
-  return p;
-}
-
 int main(int argc, const char** argv) {
-  pipeline loop = make_pipeline(true);
-  pipeline no_loop = make_pipeline(false);
+  pipeline loop = make_copy_pipeline(true);
+  pipeline no_loop = make_copy_pipeline(false);
 
   const int total_sizes[] = {32, 128, 512, 2048, 8192};
   const int copy_sizes[] = {1, 2, 4, 8, 16, 32};
@@ -109,5 +60,42 @@ int main(int argc, const char** argv) {
     std::cout << std::endl;
   }
 
+  // The time to evaluate a pipeline with many small loop iterations, allocations, and crops. The instrumentation of the
+  // evaluator costs nothing unless it is built with --config=eval_stats: compare the "no stats" column of such a build
+  // with a default build to measure the cost of compiling it in, and the "stats" column to measure the cost of using it.
+  pipeline stencil = make_stencil_pipeline();
+  std::cout << "### Evaluator overhead, eval_stats " << (eval_stats_enabled ? "enabled" : "disabled") << std::endl;
+#ifdef SLINKY_EVAL_STATS
+  std::cout << "| size | no stats (us) | stats (us) | ratio |" << std::endl;
+  std::cout << "|------|---------------|------------|-------|" << std::endl;
+#else
+  std::cout << "| size | no stats (us) |" << std::endl;
+  std::cout << "|------|---------------|" << std::endl;
+#endif
+  for (int size : {16, 64, 256}) {
+    buffer<short, 2> in_buf({size + 2, size + 2});
+    in_buf.translate(-1, -1);
+    in_buf.allocate();
+    for_each_index(in_buf, [&](auto i) { in_buf(i) = rand() % 64; });
+    buffer<short, 2> out_buf({size, size});
+    out_buf.allocate();
+
+    const raw_buffer* inputs[] = {&in_buf};
+    const raw_buffer* outputs[] = {&out_buf};
+
+    eval_context ctx;
+    double no_stats_t = benchmark([&]() { stencil.evaluate(inputs, outputs, ctx); });
+    std::cout << "| " << size << " | " << no_stats_t * 1e6 << " |";
+
+#ifdef SLINKY_EVAL_STATS
+    eval_stats stats;
+    ctx.stats = &stats;
+    double stats_t = benchmark([&]() { stencil.evaluate(inputs, outputs, ctx); });
+    std::cout << " " << stats_t * 1e6 << " | " << stats_t / no_stats_t << " |";
+#endif
+    std::cout << std::endl;
+  }
+  std::cout << std::endl;
+
   return 0;
 }
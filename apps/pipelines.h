@@ -0,0 +1,104 @@
+#ifndef SLINKY_APPS_PIPELINES_H
+#define SLINKY_APPS_PIPELINES_H
+
+#include "builder/pipeline.h"
+#include "runtime/pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace slinky {
+
+// Unfortunately, here in 2024 on modern OSes, the standard `memcpy` is over 10x slower than this on AMD CPUs. Over a
+// certain size, `memcpy` uses a `rep movsb` sequence, which is apparently really bad on AMD Zen:
+// https://bugs.launchpad.net/ubuntu/+source/glibc/+bug/2030515
+// We can work around this by memcpying 2048 bytes or less at a time.
+inline void memcpy_workaround(char* dst, const char* src, std::size_t size) {
+  constexpr std::size_t chunk_size = 2048;
+  for (std::size_t i = 0; i < size; i += chunk_size) {
+    std::size_t size_i = std::min(size - i, chunk_size);
+    memcpy(dst, src, size_i);
+    dst += chunk_size;
+    src += chunk_size;
+  }
+}
+
+// Copy from input to output.
+// TODO: We should be able to just do this with raw_buffer and not make it a template.
+template <typename T>
+index_t copy_2d(const buffer<const T>& in, const buffer<T>& out) {
+  const T* src = &in(out.dim(0).min(), out.dim(1).min());
+  T* dst = &out(out.dim(0).min(), out.dim(1).min());
+  std::size_t size_bytes = out.dim(0).extent() * out.elem_size;
+  for (index_t y = out.dim(1).begin(); y < out.dim(1).end(); ++y) {
+    memcpy_workaround((char*)dst, (const char*)src, size_bytes);
+    dst += out.dim(1).stride();
+    src += in.dim(1).stride();
+  }
+  return 0;
+}
+
+template <typename T>
+index_t add_1(const buffer<const T>& in, const buffer<T>& out) {
+  for_each_index(out, [&](auto i) { out(i) = in(i) + 1; });
+  return 0;
+}
+
+template <typename T>
+index_t sum3x3(const buffer<const T>& in, const buffer<T>& out) {
+  for (index_t y = out.dim(1).begin(); y < out.dim(1).end(); ++y) {
+    for (index_t x = out.dim(0).begin(); x < out.dim(0).end(); ++x) {
+      T sum = 0;
+      for (index_t dy = -1; dy <= 1; ++dy) {
+        for (index_t dx = -1; dx <= 1; ++dx) {
+          sum += in(x + dx, y + dy);
+        }
+      }
+      out(x, y) = sum;
+    }
+  }
+  return 0;
+}
+
+// A pipeline that copies a 2D buffer of chars, optionally with an explicit loop over y.
+inline pipeline make_copy_pipeline(bool explicit_y) {
+  node_context ctx;
+
+  auto in = buffer_expr::make(ctx, "in", sizeof(char), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(char), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func copy = func::make<const char, char>(copy_2d<char>, {in, {point(x), point(y)}}, {out, {x, y}});
+
+  if (explicit_y) {
+    copy.loops({y});
+  }
+
+  return build_pipeline(ctx, {in}, {out}, build_options{.no_checks = true});
+}
+
+// A small pipeline with a folded intermediate buffer, so evaluation exercises allocations, crops, and loops.
+inline pipeline make_stencil_pipeline() {
+  node_context ctx;
+
+  auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func stencil =
+      func::make<const short, short>(sum3x3<short>, {intm, {bounds(-1, 1) + x, bounds(-1, 1) + y}}, {out, {x, y}});
+
+  stencil.loops({{y, 1}});
+
+  return build_pipeline(ctx, {in}, {out}, build_options{.no_checks = true});
+}
+
+}  // namespace slinky
+
+#endif  // SLINKY_APPS_PIPELINES_H
@@ -0,0 +1,58 @@
+#include "apps/benchmark.h"
+#include "apps/pipelines.h"
+#include "runtime/evaluate.h"
+#include "runtime/pipeline.h"
+#include "runtime/replay.h"
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+
+using namespace slinky;
+
+// Benchmarks a recording of an evaluation of one of the pipelines in apps/pipelines.h, e.g. as captured by
+// `capture_to_files`. The pipeline itself is not recorded, so it must be named on the command line.
+int main(int argc, const char** argv) {
+  const std::map<std::string, std::function<pipeline()>> pipelines = {
+      {"copy", []() { return make_copy_pipeline(false); }},
+      {"copy_explicit_y", []() { return make_copy_pipeline(true); }},
+      {"stencil", []() { return make_stencil_pipeline(); }},
+  };
+
+  if (argc != 3 || !pipelines.count(argv[1])) {
+    std::cerr << "Usage: " << argv[0] << " <pipeline> <recording>" << std::endl;
+    std::cerr << "Pipelines:";
+    for (const auto& i : pipelines) {
+      std::cerr << " " << i.first;
+    }
+    std::cerr << std::endl;
+    return 1;
+  }
+
+  pipeline p = pipelines.at(argv[1])();
+
+  std::ifstream file(argv[2], std::ios::binary);
+  evaluate_recording rec;
+  if (!rec.load(file)) {
+    std::cerr << "Failed to load recording " << argv[2] << std::endl;
+    return 1;
+  }
+  if (rec.args.size() != p.args().size() || rec.inputs.size() != p.inputs().size() ||
+      rec.outputs.size() != p.outputs().size()) {
+    std::cerr << "Recording " << argv[2] << " does not match the signature of pipeline " << argv[1] << std::endl;
+    return 1;
+  }
+
+  eval_context ctx;
+  index_t result = 0;
+  double t = benchmark([&]() { result = rec.evaluate(p, ctx); });
+  if (result != 0) {
+    std::cerr << "Evaluation failed: " << result << std::endl;
+    return 1;
+  }
+  std::cout << argv[1] << ": " << t * 1e3 << " ms" << std::endl;
+  return 0;
+}
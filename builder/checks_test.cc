@@ -5,6 +5,7 @@
 #include "runtime/buffer.h"
 #include "runtime/expr.h"
 #include "builder/pipeline.h"
+#include "builder/substitute.h"
 #include "runtime/pipeline.h"
 
 using namespace slinky;
@@ -16,6 +17,22 @@ index_t multiply_2(const buffer<const T>& in, const buffer<T>& out) {
   return 0;
 }
 
+// Returns true if `s` contains a check of `condition`.
+bool has_check(const stmt& s, const expr& condition) {
+  class find_check : public recursive_node_visitor {
+  public:
+    const expr& condition;
+    bool found = false;
+
+    find_check(const expr& condition) : condition(condition) {}
+
+    void visit(const check* op) override { found = found || match(op->condition, condition); }
+  };
+  find_check v(condition);
+  s.accept(&v);
+  return v.found;
+}
+
 // A trivial pipeline with one stage.
 TEST(pipeline, checks) {
   // Make the pipeline
@@ -30,6 +47,11 @@ TEST(pipeline, checks) {
 
   pipeline p = build_pipeline(ctx, {in}, {out});
 
+  // The input must contain the bounds of the output.
+  expr in_var = variable::make(in->sym());
+  expr out_var = variable::make(out->sym());
+  ASSERT_TRUE(has_check(p.body(), buffer_min(in_var, 0) <= buffer_min(out_var, 0)));
+
   // Run the pipeline
   const int N = 10;
 
@@ -67,3 +89,56 @@ TEST(pipeline, checks) {
   // Input is too small.
   ASSERT_EQ(checks_failed, 2);
 }
+
+TEST(pipeline, constraints) {
+  node_context ctx;
+
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 1);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 1);
+  in->dim(0).stride = static_cast<index_t>(sizeof(int));
+  in->constrain(in->dim(0).min() == 0);
+  out->constrain(out->dim(0).min() == 0);
+  out->constrain(out->dim(0).extent() % 4 == 0);
+
+  var x(ctx, "x");
+
+  func mul = func::make<const int, int>(multiply_2<int>, {in, {point(x)}}, {out, {x}});
+
+  pipeline p = build_pipeline(ctx, {in}, {out});
+
+  // The constraints are checked, and they imply that the input contains the min of the output.
+  expr in_var = variable::make(in->sym());
+  expr out_var = variable::make(out->sym());
+  ASSERT_TRUE(has_check(p.body(), buffer_min(in_var, 0) == 0));
+  ASSERT_FALSE(has_check(p.body(), buffer_min(in_var, 0) <= buffer_min(out_var, 0)));
+
+  int checks_failed = 0;
+
+  eval_context eval_ctx;
+  eval_ctx.check_failed = [&](const expr& c) { checks_failed++; };
+
+  buffer<int, 1> in_buf({12});
+  in_buf.allocate();
+  buffer<int, 1> out_buf({8});
+  out_buf.allocate();
+
+  const raw_buffer* inputs[] = {&in_buf};
+  const raw_buffer* outputs[] = {&out_buf};
+  ASSERT_EQ(p.evaluate(inputs, outputs, eval_ctx), 0);
+  ASSERT_EQ(checks_failed, 0);
+
+  // The extent of the output is not a multiple of 4.
+  buffer<int, 1> bad_out_buf({6});
+  bad_out_buf.allocate();
+  const raw_buffer* bad_outputs[] = {&bad_out_buf};
+  ASSERT_NE(p.evaluate(inputs, bad_outputs, eval_ctx), 0);
+  ASSERT_EQ(checks_failed, 1);
+
+  // The input is not dense.
+  buffer<int, 1> strided_in_buf({12});
+  strided_in_buf.dim(0).set_stride(2 * sizeof(int));
+  strided_in_buf.allocate();
+  const raw_buffer* strided_inputs[] = {&strided_in_buf};
+  ASSERT_NE(p.evaluate(strided_inputs, outputs, eval_ctx), 0);
+  ASSERT_EQ(checks_failed, 2);
+}
@@ -0,0 +1,874 @@
+#include "builder/codegen.h"
+
+#include <cassert>
+#include <cctype>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "runtime/expr.h"
+#include "runtime/pipeline.h"
+#include "runtime/print.h"
+
+namespace slinky {
+
+namespace {
+
+// The runtime support needed by generated code. This mirrors the implementation of the corresponding nodes in
+// evaluate.cc.
+const char* preamble = R"(#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "runtime/buffer.h"
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+#include "runtime/util.h"
+
+namespace {
+
+using slinky::dim;
+using slinky::eval_context;
+using slinky::index_t;
+using slinky::raw_buffer;
+
+constexpr index_t min_index = std::numeric_limits<index_t>::min();
+constexpr index_t max_index = std::numeric_limits<index_t>::max();
+
+// Not every pipeline uses all of these helpers.
+[[noreturn, maybe_unused]] void cannot_evaluate(const char* what) {
+  std::cerr << "Cannot evaluate " << what << std::endl;
+  std::abort();
+}
+
+// The nodes of the pipeline don't exist in the generated code, so the handlers get an undefined condition, or a null
+// call_stmt, unlike in `evaluate`.
+[[maybe_unused]] index_t check_failed(eval_context& ctx, const char* condition) {
+  if (ctx.check_failed) {
+    ctx.check_failed(slinky::expr());
+  } else {
+    std::cerr << "Check failed: " << condition << std::endl;
+    std::abort();
+  }
+  return 1;
+}
+
+[[maybe_unused]] index_t call(eval_context& ctx, const slinky::call_stmt::callable& target, const char* name) {
+  index_t result = target(ctx);
+  if (result) {
+    if (ctx.call_failed) {
+      ctx.call_failed(nullptr);
+    } else {
+      std::cerr << "call_stmt failed: " << name << "->" << result << std::endl;
+      std::abort();
+    }
+  }
+  return result;
+}
+
+[[maybe_unused]] std::size_t buffer_storage_size(std::size_t rank) { return sizeof(raw_buffer) + sizeof(dim) * rank; }
+
+[[maybe_unused]] raw_buffer* clone_metadata(const raw_buffer* buf, void* storage) {
+  raw_buffer* result = reinterpret_cast<raw_buffer*>(storage);
+  result->allocation = nullptr;
+  result->base = buf->base;
+  result->elem_size = buf->elem_size;
+  result->rank = buf->rank;
+  result->dims = reinterpret_cast<dim*>(result + 1);
+  memcpy(result->dims, buf->dims, sizeof(dim) * buf->rank);
+  return result;
+}
+
+// A buffer with storage for `Rank` dims.
+template <std::size_t Rank>
+struct local_buffer {
+  raw_buffer buf;
+  dim dims[Rank > 0 ? Rank : 1];
+
+  local_buffer(index_t elem_size, void* base = nullptr) {
+    buf.allocation = nullptr;
+    buf.base = base;
+    buf.elem_size = elem_size;
+    buf.rank = Rank;
+    buf.dims = dims;
+  }
+};
+
+// Allocates a buffer on the heap, and frees it when destroyed.
+class heap_allocation {
+  eval_context& ctx_;
+  slinky::symbol_id sym_;
+  raw_buffer* buf_;
+
+public:
+  heap_allocation(eval_context& ctx, slinky::symbol_id sym, raw_buffer* buf) : ctx_(ctx), sym_(sym), buf_(buf) {
+    if (ctx_.allocate) {
+      assert(ctx_.free);
+      ctx_.allocate(sym_, buf_);
+    } else {
+      buf_->allocate();
+    }
+  }
+  ~heap_allocation() {
+    if (ctx_.free) {
+      assert(ctx_.allocate);
+      ctx_.free(sym_, buf_);
+    } else {
+      buf_->free();
+    }
+  }
+};
+
+// These helpers need stack memory that is only live during `body`, so they can't be inlined into a loop.
+template <typename Body>
+index_t with_stack_allocation(raw_buffer* buf, const Body& body) {
+  buf->base = alloca(buf->size_bytes());
+  return body();
+}
+
+template <typename Body>
+index_t with_clone(const raw_buffer* src, const Body& body) {
+  return body(clone_metadata(src, alloca(buffer_storage_size(src->rank))));
+}
+
+template <typename Body>
+index_t with_slice_buffer(raw_buffer* buf, std::size_t n, const index_t* at, const bool* at_defined, const Body& body) {
+  dim* dims = reinterpret_cast<dim*>(alloca(sizeof(dim) * buf->rank));
+  std::size_t rank = 0;
+  index_t offset = 0;
+  for (std::size_t d = 0; d < buf->rank; ++d) {
+    if (d < n && at_defined[d]) {
+      offset += buf->dims[d].flat_offset_bytes(at[d]);
+    } else {
+      dims[rank++] = buf->dims[d];
+    }
+  }
+  void* old_base = buf->base;
+  buf->base = slinky::offset_bytes(buf->base, offset);
+  std::swap(buf->rank, rank);
+  std::swap(buf->dims, dims);
+  index_t result = body();
+  buf->base = old_base;
+  buf->rank = rank;
+  buf->dims = dims;
+  return result;
+}
+
+template <typename Body>
+index_t with_slice_dim(raw_buffer* buf, int d, index_t at, const Body& body) {
+  dim* old_dims = buf->dims;
+  buf->dims = reinterpret_cast<dim*>(alloca(sizeof(dim) * (buf->rank - 1)));
+  void* old_base = buf->base;
+  buf->base = slinky::offset_bytes(buf->base, old_dims[d].flat_offset_bytes(at));
+  for (int i = 0; i < d; ++i) {
+    buf->dims[i] = old_dims[i];
+  }
+  for (int i = d + 1; i < static_cast<int>(buf->rank); ++i) {
+    buf->dims[i - 1] = old_dims[i];
+  }
+  buf->rank -= 1;
+  index_t result = body();
+  buf->base = old_base;
+  buf->rank += 1;
+  buf->dims = old_dims;
+  return result;
+}
+
+// Crops a dimension of a buffer in place, and restores it when destroyed.
+class crop_dim_scope {
+  raw_buffer* buf_;
+  dim& dim_;
+  void* old_base_;
+  index_t old_min_;
+  index_t old_max_;
+
+public:
+  crop_dim_scope(raw_buffer* buf, int d, index_t min, index_t max)
+      : buf_(buf), dim_(buf->dims[d]), old_base_(buf->base), old_min_(dim_.min()), old_max_(dim_.max()) {
+    min = std::max(old_min_, min);
+    max = std::min(old_max_, max);
+    if (max >= min) {
+      buf_->base = slinky::offset_bytes(buf_->base, dim_.flat_offset_bytes(min));
+    }
+    dim_.set_bounds(min, max);
+  }
+  ~crop_dim_scope() {
+    buf_->base = old_base_;
+    dim_.set_bounds(old_min_, old_max_);
+  }
+};
+
+class truncate_rank_scope {
+  raw_buffer* buf_;
+  std::size_t old_rank_;
+
+public:
+  truncate_rank_scope(raw_buffer* buf, std::size_t rank) : buf_(buf), old_rank_(buf->rank) { buf_->rank = rank; }
+  ~truncate_rank_scope() { buf_->rank = old_rank_; }
+};
+
+template <typename Body>
+index_t parallel_for(eval_context& ctx, index_t min, index_t max, index_t step, const Body& body) {
+  assert(ctx.enqueue_many);
+  assert(ctx.wait_for);
+  struct shared_state {
+    std::atomic<index_t> i, done;
+    index_t min, max, step;
+    std::atomic<index_t> result;
+
+    shared_state(index_t min, index_t max, index_t step)
+        : i(min), done(min), min(min), max(max), step(step), result(0) {}
+  };
+  auto state = std::make_shared<shared_state>(min, max, step);
+  // Workers only call `body` while there are iterations left, so it is safe for them to outlive this scope.
+  auto worker = [state, ctx, &body]() mutable {
+    while (state->result == 0) {
+      index_t i = state->i.fetch_add(state->step);
+      if (!(state->min <= i && i <= state->max)) break;
+
+      index_t result = body(ctx, i);
+      if (result != 0) {
+        state->result = result;
+      }
+      state->done += state->step;
+    }
+  };
+  ctx.enqueue_many(worker);
+  worker();
+  ctx.wait_for([&]() { return state->result != 0 || !(min <= state->done && state->done <= max); });
+  return state->result;
+}
+
+}  // namespace
+)";
+
+std::string sanitize(const std::string& name) {
+  std::string result;
+  for (char c : name) {
+    result += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  return result;
+}
+
+// Finds the symbols that are buffers, and names the callables of the call_stmts.
+class analyzer : public recursive_visitor<analyzer> {
+  std::set<std::string> used_names;
+
+public:
+  using recursive_visitor::visit;
+
+  const node_context& ctx;
+  symbol_map<bool> buffers;
+  std::map<const call_stmt*, std::string> callable_names;
+  std::map<std::string, call_stmt::callable> callables;
+
+  analyzer(const node_context& ctx) : ctx(ctx) {}
+
+  void visit(const call_stmt* op) {
+    for (symbol_id i : op->inputs) {
+      buffers[i] = true;
+    }
+    for (symbol_id i : op->outputs) {
+      buffers[i] = true;
+    }
+    if (callable_names.count(op)) return;
+
+    std::string name;
+    for (symbol_id i : op->outputs) {
+      if (!name.empty()) name += "_";
+      name += sanitize(ctx.name(i));
+    }
+    if (name.empty()) name = "call";
+    std::string unique = name;
+    for (int i = 2; used_names.count(unique); ++i) {
+      unique = name + "_" + std::to_string(i);
+    }
+    used_names.insert(unique);
+    callable_names[op] = unique;
+    callables[unique] = op->target;
+  }
+  void visit(const copy_stmt* op) {
+    buffers[op->src] = true;
+    buffers[op->dst] = true;
+    recursive_visitor::visit(op);
+  }
+  void visit(const allocate* op) {
+    buffers[op->sym] = true;
+    recursive_visitor::visit(op);
+  }
+  void visit(const make_buffer* op) {
+    buffers[op->sym] = true;
+    recursive_visitor::visit(op);
+  }
+  void visit(const clone_buffer* op) {
+    buffers[op->sym] = true;
+    buffers[op->src] = true;
+    recursive_visitor::visit(op);
+  }
+};
+
+class emitter : public node_visitor {
+public:
+  std::ostream& os;
+  const node_context& ctx;
+  const analyzer& info;
+  int depth = 1;
+  int next_temp = 0;
+
+  emitter(std::ostream& os, const node_context& ctx, const analyzer& info) : os(os), ctx(ctx), info(info) {}
+
+  std::string indent() const { return std::string(depth * 2, ' '); }
+
+  std::string name(symbol_id sym) const { return sanitize(ctx.name(sym)) + "_" + std::to_string(sym); }
+  std::string temp() { return "t" + std::to_string(next_temp++); }
+  bool is_buffer(symbol_id sym) const { return info.buffers.contains(sym); }
+
+  void emit(const expr& e) {
+    if (e.defined()) {
+      e.accept(this);
+    } else {
+      os << "0";
+    }
+  }
+  void emit(const expr& e, const char* def) {
+    if (e.defined()) {
+      e.accept(this);
+    } else {
+      os << def;
+    }
+  }
+  void emit(const stmt& s) {
+    if (s.defined()) s.accept(this);
+  }
+
+  // Emits an expression that is a pointer to a buffer.
+  void emit_buffer(const expr& e) {
+    const symbol_id* sym = as_variable(e);
+    if (sym && is_buffer(*sym)) {
+      os << name(*sym);
+    } else {
+      os << "reinterpret_cast<raw_buffer*>(";
+      emit(e);
+      os << ")";
+    }
+  }
+
+  // Emits `body` in a lambda returning index_t, which is called by a helper function. The helper's result is
+  // propagated if it is non-zero.
+  void emit_lambda_body(const stmt& body) {
+    ++depth;
+    emit(body);
+    os << indent() << "return 0;\n";
+    --depth;
+    os << indent() << "})) {\n";
+    os << indent() << "  return result;\n";
+    os << indent() << "}\n";
+  }
+
+  void visit_symbol(symbol_id sym) {
+    if (is_buffer(sym)) {
+      os << "reinterpret_cast<index_t>(" << name(sym) << ")";
+    } else {
+      os << name(sym);
+    }
+  }
+
+  void visit(const variable* op) override { visit_symbol(op->sym); }
+  void visit(const wildcard* op) override { visit_symbol(op->sym); }
+  void visit(const constant* op) override {
+    if (op->value == std::numeric_limits<index_t>::min()) {
+      // The literal for this is the negation of a value that doesn't fit in index_t.
+      os << "min_index";
+    } else if (op->value < std::numeric_limits<int>::min() || op->value > std::numeric_limits<int>::max()) {
+      os << "static_cast<index_t>(" << op->value << "LL)";
+    } else if (op->value < 0) {
+      os << "(" << op->value << ")";
+    } else {
+      os << op->value;
+    }
+  }
+  void visit(const let* op) override {
+    os << "[&](index_t " << name(op->sym) << ") -> index_t { return ";
+    emit(op->body);
+    os << "; }(";
+    emit(op->value);
+    os << ")";
+  }
+
+  template <typename T>
+  void visit_infix(const T* op, const char* fn) {
+    os << "(";
+    emit(op->a);
+    os << " " << fn << " ";
+    emit(op->b);
+    os << ")";
+  }
+  template <typename T>
+  void visit_call(const T* op, const char* fn) {
+    os << fn << "(";
+    emit(op->a);
+    os << ", ";
+    emit(op->b);
+    os << ")";
+  }
+  template <typename T>
+  void visit_bool(const T* op, const char* fn) {
+    os << "index_t";
+    visit_infix(op, fn);
+  }
+
+  void visit(const add* op) override { visit_infix(op, "+"); }
+  void visit(const sub* op) override { visit_infix(op, "-"); }
+  void visit(const mul* op) override { visit_infix(op, "*"); }
+  void visit(const div* op) override { visit_call(op, "slinky::euclidean_div<index_t>"); }
+  void visit(const mod* op) override { visit_call(op, "slinky::euclidean_mod<index_t>"); }
+  void visit(const class min* op) override { visit_call(op, "std::min<index_t>"); }
+  void visit(const class max* op) override { visit_call(op, "std::max<index_t>"); }
+  void visit(const equal* op) override { visit_bool(op, "=="); }
+  void visit(const not_equal* op) override { visit_bool(op, "!="); }
+  void visit(const less* op) override { visit_bool(op, "<"); }
+  void visit(const less_equal* op) override { visit_bool(op, "<="); }
+  void visit(const logical_and* op) override { visit_bool(op, "&&"); }
+  void visit(const logical_or* op) override { visit_bool(op, "||"); }
+  void visit(const logical_not* op) override {
+    os << "index_t(!";
+    emit(op->a);
+    os << ")";
+  }
+  void visit(const select_expr* op) override {
+    os << "(";
+    emit(op->condition);
+    os << " ? ";
+    emit(op->true_value);
+    os << " : ";
+    emit(op->false_value);
+    os << ")";
+  }
+
+  void visit(const call* op) override {
+    switch (op->intrinsic) {
+    case intrinsic::positive_infinity:
+    case intrinsic::negative_infinity:
+    case intrinsic::indeterminate: os << "(cannot_evaluate(\"" << op->intrinsic << "\"), 0)"; return;
+    case intrinsic::abs:
+      assert(op->args.size() == 1);
+      os << "std::abs(";
+      emit(op->args[0]);
+      os << ")";
+      return;
+    default: break;
+    }
+
+    assert(op->args.size() >= 1);
+    switch (op->intrinsic) {
+    case intrinsic::buffer_rank:
+      os << "index_t(";
+      emit_buffer(op->args[0]);
+      os << "->rank)";
+      return;
+    case intrinsic::buffer_elem_size:
+      os << "index_t(";
+      emit_buffer(op->args[0]);
+      os << "->elem_size)";
+      return;
+    case intrinsic::buffer_base:
+      os << "reinterpret_cast<index_t>(";
+      emit_buffer(op->args[0]);
+      os << "->base)";
+      return;
+    case intrinsic::buffer_size_bytes:
+      os << "index_t(";
+      emit_buffer(op->args[0]);
+      os << "->size_bytes())";
+      return;
+    case intrinsic::buffer_at:
+      os << "reinterpret_cast<index_t>(";
+      for (std::size_t d = 1; d < op->args.size(); ++d) {
+        if (op->args[d].defined()) os << "slinky::offset_bytes(";
+      }
+      emit_buffer(op->args[0]);
+      os << "->base";
+      for (std::size_t d = 1; d < op->args.size(); ++d) {
+        if (!op->args[d].defined()) continue;
+        os << ", ";
+        emit_buffer(op->args[0]);
+        os << "->dims[" << d - 1 << "].flat_offset_bytes(";
+        emit(op->args[d]);
+        os << "))";
+      }
+      os << ")";
+      return;
+    default: break;
+    }
+
+    assert(op->args.size() == 2);
+    emit_buffer(op->args[0]);
+    os << "->dim(";
+    emit(op->args[1]);
+    os << ")";
+    switch (op->intrinsic) {
+    case intrinsic::buffer_min: os << ".min()"; return;
+    case intrinsic::buffer_max: os << ".max()"; return;
+    case intrinsic::buffer_extent: os << ".extent()"; return;
+    case intrinsic::buffer_stride: os << ".stride()"; return;
+    case intrinsic::buffer_fold_factor: os << ".fold_factor()"; return;
+    default: std::abort();
+    }
+  }
+
+  // Callables can read the value of any symbol from the context, so we keep the context up to date with the variables
+  // of the generated code, like `evaluate` does.
+  void emit_set_ctx_in_scope(symbol_id sym) {
+    os << indent() << "auto " << temp() << " = slinky::set_value_in_scope(ctx, " << sym << ", " << name(sym) << ");\n";
+  }
+
+  void visit(const let_stmt* op) override {
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "const index_t " << name(op->sym) << " = ";
+    emit(op->value);
+    os << ";\n";
+    emit_set_ctx_in_scope(op->sym);
+    emit(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const block* op) override {
+    for (const stmt& i : op->stmts) {
+      emit(i);
+    }
+  }
+
+  void visit(const loop* op) override {
+    std::string min = temp();
+    std::string max = temp();
+    std::string step = temp();
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "const index_t " << min << " = ";
+    emit(op->bounds.min);
+    os << ";\n";
+    os << indent() << "const index_t " << max << " = ";
+    emit(op->bounds.max);
+    os << ";\n";
+    os << indent() << "const index_t " << step << " = ";
+    emit(op->step, "1");
+    os << ";\n";
+    std::string i = name(op->sym);
+    if (op->mode == loop_mode::parallel) {
+      // Each worker has its own copy of the context, which doesn't need to be restored.
+      os << indent() << "if (index_t result = parallel_for(ctx, " << min << ", " << max << ", " << step
+         << ", [&](eval_context& ctx, index_t " << i << ") -> index_t {\n";
+      os << indent() << "  ctx[" << op->sym << "] = " << i << ";\n";
+      emit_lambda_body(op->body);
+    } else {
+      assert(op->mode == loop_mode::serial);
+      os << indent() << "auto " << temp() << " = slinky::set_value_in_scope(ctx, " << op->sym << ", " << min << ");\n";
+      os << indent() << "for (index_t " << i << " = " << min << "; " << min << " <= " << i << " && " << i
+         << " <= " << max << "; " << i << " += " << step << ") {\n";
+      ++depth;
+      os << indent() << "ctx[" << op->sym << "] = " << i << ";\n";
+      emit(op->body);
+      --depth;
+      os << indent() << "}\n";
+    }
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const if_then_else* op) override {
+    os << indent() << "if (";
+    emit(op->condition);
+    os << ") {\n";
+    ++depth;
+    emit(op->true_body);
+    --depth;
+    if (op->false_body.defined()) {
+      os << indent() << "} else {\n";
+      ++depth;
+      emit(op->false_body);
+      --depth;
+    }
+    os << indent() << "}\n";
+  }
+
+  void visit(const call_stmt* op) override {
+    for (symbol_id i : op->inputs) {
+      os << indent() << "ctx[" << i << "] = reinterpret_cast<index_t>(" << name(i) << ");\n";
+    }
+    for (symbol_id i : op->outputs) {
+      os << indent() << "ctx[" << i << "] = reinterpret_cast<index_t>(" << name(i) << ");\n";
+    }
+    const std::string& callable = info.callable_names.at(op);
+    os << indent() << "if (index_t result = call(ctx, call_" << callable << ", \"" << callable << "\")) {\n";
+    os << indent() << "  return result;\n";
+    os << indent() << "}\n";
+  }
+
+  void visit(const copy_stmt* op) override {
+    assert(op->src_x.size() > 0 || op->dst_x.empty());
+    std::string src = temp();
+    std::string dst = temp();
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "const raw_buffer* " << src << " = " << name(op->src) << ";\n";
+    os << indent() << "const raw_buffer* " << dst << " = " << name(op->dst) << ";\n";
+    std::string padding;
+    if (!op->padding.empty()) {
+      padding = temp();
+      os << indent() << "static const unsigned char " << padding << "[] = {";
+      for (std::size_t i = 0; i < op->padding.size(); ++i) {
+        if (i > 0) os << ", ";
+        os << static_cast<int>(static_cast<unsigned char>(op->padding[i]));
+      }
+      os << "};\n";
+    }
+    if (op->dst_x.empty()) {
+      os << indent() << "memcpy(" << dst << "->base, " << src << "->base, " << dst << "->elem_size);\n";
+    } else {
+      for (int d = static_cast<int>(op->dst_x.size()) - 1; d >= 0; --d) {
+        std::string x = name(op->dst_x[d]);
+        os << indent() << "for (index_t " << x << " = " << dst << "->dims[" << d << "].begin(); " << x << " < " << dst
+           << "->dims[" << d << "].end(); ++" << x << ") {\n";
+        ++depth;
+      }
+      std::string dst_at = temp();
+      std::string src_at = temp();
+      os << indent() << "char* " << dst_at << " = reinterpret_cast<char*>(" << dst << "->base)";
+      for (std::size_t d = 0; d < op->dst_x.size(); ++d) {
+        os << " + (" << name(op->dst_x[d]) << " - " << dst << "->dims[" << d << "].min()) * " << dst << "->dims[" << d
+           << "].stride()";
+      }
+      os << ";\n";
+      os << indent() << "const void* " << src_at << " = " << src << "->base;\n";
+      for (std::size_t d = 0; d < op->src_x.size(); ++d) {
+        std::string x = temp();
+        os << indent() << "const index_t " << x << " = ";
+        emit(op->src_x[d]);
+        os << ";\n";
+        os << indent() << src_at << " = " << src_at << " && " << src << "->dims[" << d << "].contains(" << x
+           << ") ? slinky::offset_bytes(" << src_at << ", " << src << "->dims[" << d << "].flat_offset_bytes(" << x
+           << ")) : nullptr;\n";
+      }
+      os << indent() << "if (" << src_at << ") {\n";
+      os << indent() << "  memcpy(" << dst_at << ", " << src_at << ", " << dst << "->elem_size);\n";
+      if (!padding.empty()) {
+        os << indent() << "} else {\n";
+        os << indent() << "  memcpy(" << dst_at << ", " << padding << ", " << dst << "->elem_size);\n";
+      }
+      os << indent() << "}\n";
+      for (std::size_t d = 0; d < op->dst_x.size(); ++d) {
+        --depth;
+        os << indent() << "}\n";
+      }
+    }
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  template <typename T>
+  void emit_dims(const std::string& buf, const T* op) {
+    for (std::size_t d = 0; d < op->dims.size(); ++d) {
+      const dim_expr& dim = op->dims[d];
+      os << indent() << buf << ".dims[" << d << "].set_bounds(";
+      emit(dim.bounds.min);
+      os << ", ";
+      emit(dim.bounds.max);
+      os << ");\n";
+      os << indent() << buf << ".dims[" << d << "].set_stride(";
+      emit(dim.stride);
+      os << ");\n";
+      os << indent() << buf << ".dims[" << d << "].set_fold_factor(";
+      emit(dim.fold_factor, "dim::unfolded");
+      os << ");\n";
+    }
+  }
+
+  void visit(const allocate* op) override {
+    std::string storage = temp();
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "local_buffer<" << op->dims.size() << "> " << storage << "(" << op->elem_size << ");\n";
+    emit_dims(storage, op);
+    os << indent() << "raw_buffer* " << name(op->sym) << " = &" << storage << ".buf;\n";
+    if (op->storage == memory_type::stack) {
+      os << indent() << "if (index_t result = with_stack_allocation(" << name(op->sym) << ", [&]() -> index_t {\n";
+      emit_lambda_body(op->body);
+    } else {
+      assert(op->storage == memory_type::heap);
+      os << indent() << "heap_allocation " << temp() << "(ctx, " << op->sym << ", " << name(op->sym) << ");\n";
+      emit(op->body);
+    }
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const make_buffer* op) override {
+    std::string storage = temp();
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "local_buffer<" << op->dims.size() << "> " << storage << "(";
+    emit(op->elem_size);
+    os << ", reinterpret_cast<void*>(";
+    emit(op->base);
+    os << "));\n";
+    emit_dims(storage, op);
+    os << indent() << "raw_buffer* " << name(op->sym) << " = &" << storage << ".buf;\n";
+    emit(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const clone_buffer* op) override {
+    os << indent() << "if (index_t result = with_clone(" << name(op->src) << ", [&](raw_buffer* " << name(op->sym)
+       << ") -> index_t {\n";
+    emit_lambda_body(op->body);
+  }
+
+  void emit_crop_dim(symbol_id sym, std::size_t d, const interval_expr& bounds) {
+    os << indent() << "crop_dim_scope " << temp() << "(" << name(sym) << ", " << d << ", ";
+    emit(bounds.min, "min_index");
+    os << ", ";
+    emit(bounds.max, "max_index");
+    os << ");\n";
+  }
+
+  void visit(const crop_buffer* op) override {
+    os << indent() << "{\n";
+    ++depth;
+    for (std::size_t d = 0; d < op->bounds.size(); ++d) {
+      emit_crop_dim(op->sym, d, op->bounds[d]);
+    }
+    emit(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const crop_dim* op) override {
+    os << indent() << "{\n";
+    ++depth;
+    emit_crop_dim(op->sym, op->dim, op->bounds);
+    emit(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const slice_buffer* op) override {
+    if (op->at.empty()) {
+      emit(op->body);
+      return;
+    }
+    std::string at = temp();
+    std::string at_defined = temp();
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "const index_t " << at << "[] = {";
+    for (std::size_t d = 0; d < op->at.size(); ++d) {
+      if (d > 0) os << ", ";
+      emit(op->at[d]);
+    }
+    os << "};\n";
+    os << indent() << "const bool " << at_defined << "[] = {";
+    for (std::size_t d = 0; d < op->at.size(); ++d) {
+      if (d > 0) os << ", ";
+      os << (op->at[d].defined() ? "true" : "false");
+    }
+    os << "};\n";
+    os << indent() << "if (index_t result = with_slice_buffer(" << name(op->sym) << ", " << op->at.size() << ", " << at
+       << ", " << at_defined << ", [&]() -> index_t {\n";
+    emit_lambda_body(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const slice_dim* op) override {
+    os << indent() << "if (index_t result = with_slice_dim(" << name(op->sym) << ", " << op->dim << ", ";
+    emit(op->at);
+    os << ", [&]() -> index_t {\n";
+    emit_lambda_body(op->body);
+  }
+
+  void visit(const truncate_rank* op) override {
+    os << indent() << "{\n";
+    ++depth;
+    os << indent() << "truncate_rank_scope " << temp() << "(" << name(op->sym) << ", " << op->rank << ");\n";
+    emit(op->body);
+    --depth;
+    os << indent() << "}\n";
+  }
+
+  void visit(const check* op) override {
+    std::stringstream condition;
+    print(condition, op->condition, &ctx);
+    os << indent() << "if (!(";
+    emit(op->condition);
+    os << ")) {\n";
+    os << indent() << "  return check_failed(ctx, " << std::quoted(condition.str()) << ");\n";
+    os << indent() << "}\n";
+  }
+};
+
+}  // namespace
+
+std::string emit_cpp(const pipeline& p, const node_context& ctx, const std::string& name) {
+  analyzer info(ctx);
+  for (const var& i : p.inputs()) {
+    info.buffers[i] = true;
+  }
+  for (const var& i : p.outputs()) {
+    info.buffers[i] = true;
+  }
+  info.visit(p.body());
+
+  std::stringstream os;
+  os << "// Generated by slinky::emit_cpp. Do not edit.\n\n";
+  os << preamble << "\n";
+  os << "slinky::index_t " << name << "(const std::map<std::string, slinky::call_stmt::callable>& callables,\n";
+  os << "    slinky::span<const slinky::index_t> args, slinky::span<const slinky::raw_buffer*> inputs,\n";
+  os << "    slinky::span<const slinky::raw_buffer*> outputs, slinky::eval_context& ctx) {\n";
+  os << "  assert(args.size() == " << p.args().size() << ");\n";
+  os << "  assert(inputs.size() == " << p.inputs().size() << ");\n";
+  os << "  assert(outputs.size() == " << p.outputs().size() << ");\n";
+
+  for (const auto& i : info.callables) {
+    os << "  const slinky::call_stmt::callable& call_" << i.first << " = callables.at(\"" << i.first << "\");\n";
+  }
+
+  emitter e(os, ctx, info);
+  for (std::size_t i = 0; i < p.args().size(); ++i) {
+    os << "  const index_t " << e.name(p.args()[i].sym()) << " = args[" << i << "];\n";
+    e.emit_set_ctx_in_scope(p.args()[i].sym());
+  }
+  // Like pipeline::evaluate, crops and slices modify copies of the buffer metadata, not the caller's buffers.
+  for (std::size_t i = 0; i < p.inputs().size(); ++i) {
+    os << "  raw_buffer* " << e.name(p.inputs()[i].sym()) << " = clone_metadata(inputs[" << i
+       << "], alloca(buffer_storage_size(inputs[" << i << "]->rank)));\n";
+  }
+  for (std::size_t i = 0; i < p.outputs().size(); ++i) {
+    os << "  raw_buffer* " << e.name(p.outputs()[i].sym()) << " = clone_metadata(outputs[" << i
+       << "], alloca(buffer_storage_size(outputs[" << i << "]->rank)));\n";
+  }
+  e.emit(p.body());
+  os << "  return 0;\n";
+  os << "}\n";
+  return os.str();
+}
+
+std::map<std::string, call_stmt::callable> find_callables(const pipeline& p, const node_context& ctx) {
+  analyzer info(ctx);
+  info.visit(p.body());
+  return std::move(info.callables);
+}
+
+}  // namespace slinky
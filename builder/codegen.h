@@ -0,0 +1,32 @@
+#ifndef SLINKY_BUILDER_CODEGEN_H
+#define SLINKY_BUILDER_CODEGEN_H
+
+#include <map>
+#include <string>
+
+#include "runtime/expr.h"
+#include "runtime/pipeline.h"
+
+namespace slinky {
+
+// Generates a C++ source file implementing the pipeline `p`, so it can be compiled ahead of time instead of being
+// interpreted by `evaluate`. The generated file depends only on the runtime headers, and defines a function:
+//
+//   slinky::index_t <name>(const std::map<std::string, slinky::call_stmt::callable>& callables,
+//       slinky::span<const slinky::index_t> args, slinky::span<const slinky::raw_buffer*> inputs,
+//       slinky::span<const slinky::raw_buffer*> outputs, slinky::eval_context& ctx);
+//
+// with the same behavior as `p.evaluate(args, inputs, outputs, ctx)`. The callables of the `call_stmt`s in the pipeline
+// can't be generated, they are looked up by name in `callables`. Use `find_callables` to get them from `p`.
+//
+// One difference from `evaluate`: the nodes of the pipeline don't exist in the generated code, so
+// `eval_context::check_failed` is called with an undefined expr, and `eval_context::call_failed` is called with null.
+std::string emit_cpp(const pipeline& p, const node_context& ctx, const std::string& name);
+
+// Finds the callables of the `call_stmt`s in `p`, named as they are in code generated by `emit_cpp`. The name of a
+// callable is derived from the names of the buffers it produces.
+std::map<std::string, call_stmt::callable> find_callables(const pipeline& p, const node_context& ctx);
+
+}  // namespace slinky
+
+#endif  // SLINKY_BUILDER_CODEGEN_H
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <string>
+
+#include "builder/codegen.h"
+#include "builder/codegen_test_pipelines.h"
+#include "runtime/evaluate.h"
+#include "runtime/pipeline.h"
+#include "runtime/thread_pool.h"
+
+using namespace slinky;
+
+// These are defined by the code generated by codegen_test_generator.
+#define DECLARE_GENERATED(name)                                                                                        \
+  index_t name(const std::map<std::string, call_stmt::callable>& callables, span<const index_t> args,                 \
+      span<const raw_buffer*> inputs, span<const raw_buffer*> outputs, eval_context& ctx);
+
+DECLARE_GENERATED(elementwise)
+DECLARE_GENERATED(stencil_serial)
+DECLARE_GENERATED(stencil_parallel)
+DECLARE_GENERATED(padded_transpose)
+DECLARE_GENERATED(scalar_elementwise)
+
+#undef DECLARE_GENERATED
+
+namespace {
+
+thread_pool threads;
+
+class test_context : public eval_context {
+public:
+  index_t heap_count = 0;
+
+  test_context() {
+    allocate = [this](symbol_id, raw_buffer* b) {
+      b->allocate();
+      ++heap_count;
+    };
+    free = [](symbol_id, raw_buffer* b) { b->free(); };
+
+    enqueue_many = [&](const thread_pool::task& t) { threads.enqueue(threads.thread_count(), t); };
+    enqueue_one = [&](thread_pool::task t) { threads.enqueue(std::move(t)); };
+    wait_for = [&](std::function<bool()> condition) { return threads.wait_for(std::move(condition)); };
+  }
+};
+
+template <typename T, std::size_t N>
+void init_random(buffer<T, N>& x) {
+  x.allocate();
+  for_each_index(x, [&](auto i) { x(i) = (rand() % 20) - 10; });
+}
+
+// Runs `p` with both the interpreter and the generated code `generated`, and checks that the results are the same.
+template <typename T, typename Generated>
+void test_generated(const pipeline& p, const node_context& ctx, Generated generated, span<const index_t> args,
+    const buffer<T, 2>& in_buf, buffer<T, 2>& expected, buffer<T, 2>& actual) {
+  const raw_buffer* inputs[] = {&in_buf};
+
+  const raw_buffer* expected_outputs[] = {&expected};
+  test_context eval_ctx;
+  ASSERT_EQ(p.evaluate(args, inputs, expected_outputs, eval_ctx), 0);
+
+  const raw_buffer* actual_outputs[] = {&actual};
+  test_context generated_ctx;
+  ASSERT_EQ(generated(find_callables(p, ctx), args, pipeline::buffers(inputs), pipeline::buffers(actual_outputs),
+                generated_ctx),
+      0);
+  ASSERT_EQ(eval_ctx.heap_count, generated_ctx.heap_count);
+
+  for_each_index(expected, [&](auto i) { ASSERT_EQ(expected(i), actual(i)); });
+}
+
+}  // namespace
+
+TEST(codegen, elementwise) {
+  node_context ctx;
+  pipeline p = codegen_test::elementwise(ctx);
+
+  const int W = 10;
+  const int H = 7;
+  buffer<int, 2> in_buf({W, H});
+  init_random(in_buf);
+  buffer<int, 2> expected({W, H});
+  buffer<int, 2> actual({W, H});
+  expected.allocate();
+  actual.allocate();
+
+  test_generated(p, ctx, elementwise, {}, in_buf, expected, actual);
+}
+
+TEST(codegen, stencil) {
+  for (loop_mode mode : {loop_mode::serial, loop_mode::parallel}) {
+    node_context ctx;
+    pipeline p = codegen_test::stencil(ctx, mode);
+
+    const int W = 20;
+    const int H = 11;
+    buffer<short, 2> in_buf({W + 2, H + 2});
+    in_buf.translate(-1, -1);
+    init_random(in_buf);
+    buffer<short, 2> expected({W, H});
+    buffer<short, 2> actual({W, H});
+    expected.allocate();
+    actual.allocate();
+
+    test_generated(
+        p, ctx, mode == loop_mode::serial ? stencil_serial : stencil_parallel, {}, in_buf, expected, actual);
+  }
+}
+
+TEST(codegen, padded_transpose) {
+  node_context ctx;
+  pipeline p = codegen_test::padded_transpose(ctx);
+
+  const int W = 8;
+  const int H = 5;
+  buffer<int, 2> in_buf({H, W});
+  init_random(in_buf);
+  for (index_t offset : {0, 3, -2}) {
+    buffer<int, 2> expected({W, H});
+    buffer<int, 2> actual({W, H});
+    expected.allocate();
+    actual.allocate();
+
+    const index_t args[] = {offset};
+    test_generated(p, ctx, padded_transpose, args, in_buf, expected, actual);
+  }
+}
+
+TEST(codegen, scalar_elementwise) {
+  node_context ctx;
+  pipeline p = codegen_test::scalar_elementwise(ctx);
+
+  const int W = 6;
+  const int H = 9;
+  buffer<int, 2> in_buf({W, H});
+  init_random(in_buf);
+  for (index_t scale : {1, 3, -2}) {
+    buffer<int, 2> expected({W, H});
+    buffer<int, 2> actual({W, H});
+    expected.allocate();
+    actual.allocate();
+
+    const index_t args[] = {scale};
+    test_generated(p, ctx, scalar_elementwise, args, in_buf, expected, actual);
+    for_each_index(expected, [&](auto i) { ASSERT_EQ(expected(i), in_buf(i) * scale + i[1]); });
+  }
+}
+
+TEST(codegen, min_index) {
+  node_context ctx;
+  var n(ctx, "n");
+  var in(ctx, "in");
+  var out(ctx, "out");
+  pipeline p({n}, {in}, {out}, check::make(std::numeric_limits<index_t>::min() < n));
+
+  // The literal for the smallest index_t would be unsigned, the generated code should use `min_index` instead.
+  std::string code = emit_cpp(p, ctx, "f");
+  ASSERT_EQ(code.find("9223372036854775808LL"), std::string::npos);
+  ASSERT_NE(code.find("min_index < n"), std::string::npos);
+}
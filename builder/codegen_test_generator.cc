@@ -0,0 +1,37 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "builder/codegen.h"
+#include "builder/codegen_test_pipelines.h"
+
+using namespace slinky;
+
+// Generates the code for the pipelines in codegen_test_pipelines.h, for use by codegen_test.
+int main(int argc, const char** argv) {
+  if (argc != 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " <elementwise.cc> <stencil_serial.cc> <stencil_parallel.cc> <padded_transpose.cc>"
+                 " <scalar_elementwise.cc>"
+              << std::endl;
+    return 1;
+  }
+
+  auto generate = [](const char* filename, const std::string& name, auto make_pipeline) {
+    node_context ctx;
+    pipeline p = make_pipeline(ctx);
+    std::ofstream file(filename);
+    file << emit_cpp(p, ctx, name);
+    return file.good();
+  };
+
+  bool ok = true;
+  ok = ok && generate(argv[1], "elementwise", codegen_test::elementwise);
+  ok = ok && generate(argv[2], "stencil_serial",
+                 [](node_context& ctx) { return codegen_test::stencil(ctx, loop_mode::serial); });
+  ok = ok && generate(argv[3], "stencil_parallel",
+                 [](node_context& ctx) { return codegen_test::stencil(ctx, loop_mode::parallel); });
+  ok = ok && generate(argv[4], "padded_transpose", codegen_test::padded_transpose);
+  ok = ok && generate(argv[5], "scalar_elementwise", codegen_test::scalar_elementwise);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#ifndef SLINKY_BUILDER_CODEGEN_TEST_PIPELINES_H
+#define SLINKY_BUILDER_CODEGEN_TEST_PIPELINES_H
+
+#include <cassert>
+#include <vector>
+
+#include "builder/pipeline.h"
+#include "runtime/expr.h"
+#include "runtime/pipeline.h"
+
+// These pipelines are built both by codegen_test_generator, to generate code for them, and codegen_test, to run the
+// generated code and compare it to evaluating the pipeline. Both must build them the same way.
+
+namespace slinky {
+namespace codegen_test {
+
+template <typename T>
+index_t add_1(const buffer<const T>& in, const buffer<T>& out) {
+  assert(in.rank == out.rank);
+  for_each_index(out, [&](auto i) { out(i) = in(i) + 1; });
+  return 0;
+}
+
+template <typename T>
+index_t multiply_2(const buffer<const T>& in, const buffer<T>& out) {
+  assert(in.rank == out.rank);
+  for_each_index(out, [&](auto i) { out(i) = in(i) * 2; });
+  return 0;
+}
+
+template <typename T>
+index_t sum3x3(const buffer<const T>& in, const buffer<T>& out) {
+  assert(in.rank == 2);
+  assert(out.rank == 2);
+  for (index_t y = out.dim(1).begin(); y < out.dim(1).end(); ++y) {
+    for (index_t x = out.dim(0).begin(); x < out.dim(0).end(); ++x) {
+      T sum = 0;
+      for (index_t dy = -1; dy <= 1; ++dy) {
+        for (index_t dx = -1; dx <= 1; ++dx) {
+          sum += in(x + dx, y + dy);
+        }
+      }
+      out(x, y) = sum;
+    }
+  }
+  return 0;
+}
+
+// Two elementwise stages, computed in strips of 2 rows.
+inline pipeline elementwise(node_context& ctx) {
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(int), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func mul = func::make<const int, int>(multiply_2<int>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func add = func::make<const int, int>(add_1<int>, {intm, {point(x), point(y)}}, {out, {x, y}});
+  add.loops({{y, 2}});
+
+  return build_pipeline(ctx, {in}, {out});
+}
+
+// A 3x3 stencil of an elementwise stage, with a sliding window over rows. If `mode` is parallel, the intermediate is
+// stored per-iteration on the stack instead.
+inline pipeline stencil(node_context& ctx, loop_mode mode) {
+  auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func stencil =
+      func::make<const short, short>(sum3x3<short>, {intm, {bounds(-1, 1) + x, bounds(-1, 1) + y}}, {out, {x, y}});
+  stencil.loops({{y, 2, mode}});
+  if (mode == loop_mode::parallel) {
+    intm->store_at({&stencil, y});
+    intm->store_in(memory_type::stack);
+  }
+
+  return build_pipeline(ctx, {in}, {out});
+}
+
+// A transposing copy with padding, with the padded region given by scalar arguments.
+inline pipeline padded_transpose(node_context& ctx) {
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+  var dx(ctx, "dx");
+
+  std::vector<char> padding(sizeof(int), 0);
+  func copy = func::make_copy({in, {point(y), point(x + dx)}}, {out, {x, y}}, padding);
+
+  return build_pipeline(ctx, {dx}, {in}, {out}, build_options{.no_checks = true});
+}
+
+// An elementwise stage that reads a scalar argument and a loop variable from the context.
+inline pipeline scalar_elementwise(node_context& ctx) {
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+  var scale(ctx, "scale");
+
+  func f = func::make_elementwise<int>(variable::make(in->sym()) * scale + y, {in}, {out, {x, y}});
+  // With a split of 1, the loop variable `y` is the row being computed.
+  f.loops({{y, 1, loop_mode::parallel}});
+
+  return build_pipeline(ctx, {scale}, {in}, {out});
+}
+
+}  // namespace codegen_test
+}  // namespace slinky
+
+#endif  // SLINKY_BUILDER_CODEGEN_TEST_PIPELINES_H
@@ -0,0 +1,370 @@
+#include "builder/cost.h"
+
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "builder/simplify.h"
+#include "builder/substitute.h"
+#include "runtime/depends_on.h"
+#include "runtime/print.h"
+
+namespace slinky {
+
+namespace {
+
+// What we know about a dimension of a buffer in the scope of a stmt. We track an upper bound of the extent separately
+// from the bounds, because the extent of a crop is often much simpler than the extent of the cropped bounds, e.g. the
+// extent of [x, x + 1] intersected with [a, b] is at most 2, but we can't easily prove this from the bounds.
+struct dim_info {
+  interval_expr bounds;
+  expr extent;
+};
+
+// What we know about a buffer in the scope of a stmt.
+struct buffer_info {
+  expr elem_size;
+  std::vector<dim_info> dims;
+};
+
+stmt_cost zero_cost() { return {0, 0, 0, 0}; }
+
+template <typename Fn>
+stmt_cost map_cost(const stmt_cost& c, Fn fn) {
+  return {fn(c.calls), fn(c.bytes_read), fn(c.bytes_written), fn(c.bytes_allocated)};
+}
+
+template <typename Fn>
+stmt_cost map_cost(const stmt_cost& a, const stmt_cost& b, Fn fn) {
+  return {fn(a.calls, b.calls), fn(a.bytes_read, b.bytes_read), fn(a.bytes_written, b.bytes_written),
+      fn(a.bytes_allocated, b.bytes_allocated)};
+}
+
+// Store `value` as the `occurrence`th value of `op` in `m`.
+template <typename T>
+T& set_occurrence(std::map<const base_stmt_node*, std::vector<T>>& m, const base_stmt_node* op, std::size_t occurrence,
+    T value) {
+  std::vector<T>& values = m[op];
+  if (values.size() <= occurrence) values.resize(occurrence + 1);
+  return values[occurrence] = std::move(value);
+}
+
+class cost_estimator : public recursive_node_visitor {
+  cost_estimate::cost_map& costs;
+  cost_estimate::loop_map& loops;
+  symbol_map<buffer_info> buffers;
+
+  // The number of times we've seen each node so far, and the occurrence of the node being visited.
+  std::map<const base_stmt_node*, std::size_t> seen;
+  std::size_t occurrence = 0;
+
+  // The nodes we've recorded costs for, in order, so we can substitute lets into the costs of the nodes in their body.
+  std::vector<std::pair<const base_stmt_node*, std::size_t>> recorded;
+
+public:
+  stmt_cost result;
+
+  cost_estimator(cost_estimate::cost_map& costs, cost_estimate::loop_map& loops) : costs(costs), loops(loops) {}
+
+  // Intersect `dim` with the crop `bounds`.
+  static void crop(dim_info& dim, const interval_expr& bounds) {
+    dim.bounds &= bounds;
+    if (bounds.min.defined() && bounds.max.defined()) {
+      dim.extent = simplify(min(dim.extent, bounds.extent()));
+    } else {
+      dim.extent = simplify(dim.bounds.extent());
+    }
+  }
+
+  stmt_cost estimate(const stmt& s) {
+    if (!s.defined()) return zero_cost();
+    std::size_t outer_occurrence = occurrence;
+    occurrence = seen[s.get()]++;
+    s.accept(this);
+    occurrence = outer_occurrence;
+    return result;
+  }
+
+  void set_result(const base_stmt_node* op, const stmt_cost& cost) {
+    result = map_cost(cost, [](const expr& e) { return simplify(e); });
+    set_occurrence(costs, op, occurrence, result);
+    recorded.emplace_back(op, occurrence);
+  }
+
+  // Get the info for `sym`, which should have at least `rank` dimensions. If we don't know anything about this buffer
+  // yet, assume it has the bounds of the buffer itself.
+  buffer_info& get_buffer(symbol_id sym, std::size_t rank) {
+    std::optional<buffer_info>& info = buffers[sym];
+    expr buf = variable::make(sym);
+    if (!info) {
+      info = buffer_info{buffer_elem_size(buf), {}};
+    }
+    while (info->dims.size() < rank) {
+      int d = info->dims.size();
+      info->dims.push_back({{buffer_min(buf, d), buffer_max(buf, d)}, buffer_extent(buf, d)});
+    }
+    return *info;
+  }
+
+  expr size_bytes(symbol_id sym) {
+    const std::optional<buffer_info>& info = buffers[sym];
+    if (!info) {
+      return buffer_size_bytes(variable::make(sym));
+    }
+    expr result = info->elem_size;
+    for (const dim_info& d : info->dims) {
+      result *= max(0, d.extent);
+    }
+    return result;
+  }
+
+  // Estimate the cost of `body`, where the buffer `sym` is described by `info`.
+  stmt_cost estimate_in_scope(symbol_id sym, std::optional<buffer_info> info, const stmt& body) {
+    std::optional<buffer_info> old_info = buffers[sym];
+    buffers[sym] = std::move(info);
+    stmt_cost cost = estimate(body);
+    buffers[sym] = std::move(old_info);
+    return cost;
+  }
+
+  void visit_buffer_decl(const base_stmt_node* op, symbol_id sym, std::optional<buffer_info> info, const stmt& body) {
+    set_result(op, estimate_in_scope(sym, std::move(info), body));
+  }
+
+  void visit(const let_stmt* op) override {
+    std::size_t begin = recorded.size();
+    stmt_cost body = estimate(op->body);
+    auto substitute_let = [&](const expr& e) { return simplify(substitute(e, op->sym, op->value)); };
+    result = map_cost(body, substitute_let);
+    // Make the costs of the stmts in the body expressions of the variables outside this let too.
+    for (std::size_t i = begin; i < recorded.size(); ++i) {
+      const base_stmt_node* n = recorded[i].first;
+      const std::size_t k = recorded[i].second;
+      stmt_cost& c = costs[n][k];
+      c = map_cost(c, substitute_let);
+      if (n->type == node_type::loop) {
+        cost_estimate::loop_cost& l = loops[n][k];
+        l.per_iteration = map_cost(l.per_iteration, substitute_let);
+        l.trip_count = substitute_let(l.trip_count);
+      }
+    }
+  }
+
+  void visit(const block* op) override {
+    stmt_cost cost = zero_cost();
+    for (const stmt& i : op->stmts) {
+      cost = map_cost(cost, estimate(i), [](const expr& a, const expr& b) { return a + b; });
+    }
+    result = map_cost(cost, [](const expr& e) { return simplify(e); });
+  }
+
+  void visit(const loop* op) override {
+    stmt_cost body = estimate(op->body);
+
+    bounds_map bounds;
+    bounds[op->sym] = op->bounds;
+    cost_estimate::loop_cost cost;
+    cost.per_iteration = map_cost(body, [&](const expr& e) { return simplify(bounds_of(e, bounds).max); });
+    expr step = op->step.defined() ? op->step : 1;
+    cost.trip_count = simplify(max(0, (op->bounds.max - op->bounds.min + step) / step));
+    set_occurrence(loops, op, occurrence, cost);
+
+    set_result(op, map_cost(cost.per_iteration, [&](const expr& e) { return e * cost.trip_count; }));
+  }
+
+  void visit(const if_then_else* op) override {
+    stmt_cost t = estimate(op->true_body);
+    stmt_cost f = estimate(op->false_body);
+    result = map_cost(t, f, [&](const expr& t, const expr& f) { return simplify(select(op->condition, t, f)); });
+  }
+
+  void visit(const call_stmt* op) override {
+    expr bytes_read = 0;
+    for (symbol_id i : op->inputs) {
+      bytes_read += size_bytes(i);
+    }
+    expr bytes_written = 0;
+    for (symbol_id i : op->outputs) {
+      bytes_written += size_bytes(i);
+    }
+    set_result(op, {1, bytes_read, bytes_written, 0});
+  }
+
+  void visit(const copy_stmt* op) override {
+    // The source is not cropped to the region that is copied, so assume we read as much as we write.
+    set_result(op, {1, size_bytes(op->dst), size_bytes(op->dst), 0});
+  }
+
+  void visit(const allocate* op) override {
+    buffer_info info{static_cast<index_t>(op->elem_size), {}};
+    expr size = static_cast<index_t>(op->elem_size);
+    for (const dim_expr& d : op->dims) {
+      expr extent = d.fold_factor.defined() ? min(d.extent(), d.fold_factor) : d.extent();
+      info.dims.push_back({d.bounds, extent});
+      size *= max(0, extent);
+    }
+    stmt_cost cost = estimate_in_scope(op->sym, std::move(info), op->body);
+    cost.bytes_allocated += size;
+    set_result(op, cost);
+  }
+
+  void visit(const make_buffer* op) override {
+    buffer_info info{op->elem_size, {}};
+    for (const dim_expr& d : op->dims) {
+      info.dims.push_back({d.bounds, d.fold_factor.defined() ? min(d.extent(), d.fold_factor) : d.extent()});
+    }
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const clone_buffer* op) override { visit_buffer_decl(op, op->sym, buffers[op->src], op->body); }
+
+  void visit(const crop_buffer* op) override {
+    buffer_info info = get_buffer(op->sym, op->bounds.size());
+    for (std::size_t d = 0; d < op->bounds.size(); ++d) {
+      crop(info.dims[d], op->bounds[d]);
+    }
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const crop_dim* op) override {
+    buffer_info info = get_buffer(op->sym, op->dim + 1);
+    crop(info.dims[op->dim], op->bounds);
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const slice_buffer* op) override {
+    std::optional<buffer_info> info = buffers[op->sym];
+    if (info) {
+      for (int d = static_cast<int>(std::min(op->at.size(), info->dims.size())) - 1; d >= 0; --d) {
+        if (op->at[d].defined()) {
+          info->dims.erase(info->dims.begin() + d);
+        }
+      }
+    }
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const slice_dim* op) override {
+    std::optional<buffer_info> info = buffers[op->sym];
+    if (info && op->dim < static_cast<int>(info->dims.size())) {
+      info->dims.erase(info->dims.begin() + op->dim);
+    }
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const truncate_rank* op) override {
+    std::optional<buffer_info> info = buffers[op->sym];
+    if (info && op->rank < static_cast<int>(info->dims.size())) {
+      info->dims.resize(op->rank);
+    }
+    visit_buffer_decl(op, op->sym, std::move(info), op->body);
+  }
+
+  void visit(const check* op) override { result = zero_cost(); }
+};
+
+class find_infinity : public recursive_node_visitor {
+public:
+  bool found = false;
+
+  void visit(const call* op) override {
+    if (op->intrinsic == intrinsic::positive_infinity || op->intrinsic == intrinsic::negative_infinity ||
+        op->intrinsic == intrinsic::indeterminate) {
+      found = true;
+    }
+    recursive_node_visitor::visit(op);
+  }
+};
+
+// Returns true if `e` can be evaluated in `values`.
+bool can_evaluate(const expr& e, const eval_context& values) {
+  find_infinity v;
+  e.accept(&v);
+  if (v.found) return false;
+  for (symbol_id i : find_dependencies(e)) {
+    if (!values.contains(i)) return false;
+  }
+  return true;
+}
+
+// Print `e` evaluated in `values` if possible, or symbolically otherwise.
+void print_estimate(std::ostream& os, const expr& e, const node_context* ctx, eval_context* values) {
+  if (values && can_evaluate(e, *values)) {
+    os << evaluate(e, *values);
+  } else {
+    print(os, e, ctx);
+  }
+}
+
+void print_cost(std::ostream& os, const stmt_cost& c, const node_context* ctx, eval_context* values) {
+  os << "calls=";
+  print_estimate(os, c.calls, ctx, values);
+  os << ", bytes read=";
+  print_estimate(os, c.bytes_read, ctx, values);
+  os << ", bytes written=";
+  print_estimate(os, c.bytes_written, ctx, values);
+  os << ", bytes allocated=";
+  print_estimate(os, c.bytes_allocated, ctx, values);
+}
+
+}  // namespace
+
+cost_estimate::cost_estimate(const stmt& s) {
+  cost_estimator estimator(costs_, loops_);
+  total_ = estimator.estimate(s);
+}
+
+namespace {
+
+template <typename T>
+const T* find_occurrence(const std::map<const base_stmt_node*, std::vector<T>>& m, const base_stmt_node* op,
+    std::size_t occurrence) {
+  auto i = m.find(op);
+  return i != m.end() && occurrence < i->second.size() ? &i->second[occurrence] : nullptr;
+}
+
+}  // namespace
+
+const stmt_cost* cost_estimate::cost(const stmt& s, std::size_t occurrence) const {
+  return find_occurrence(costs_, s.get(), occurrence);
+}
+
+const cost_estimate::loop_cost* cost_estimate::loop(const stmt& s, std::size_t occurrence) const {
+  return find_occurrence(loops_, s.get(), occurrence);
+}
+
+void cost_estimate::print(std::ostream& os, const stmt& s, const node_context* ctx, eval_context* values) const {
+  if (!costs_.count(s.get())) {
+    os << "// total: ";
+    print_cost(os, total_, ctx, values);
+    os << std::endl;
+  }
+
+  // The printer visits the stmts in the same order as the estimator, so we can find the occurrence of each node.
+  std::map<const base_stmt_node*, std::size_t> seen;
+  slinky::print(os, s, ctx, [&](const base_stmt_node* op) -> std::string {
+    const std::size_t occurrence = seen[op]++;
+    std::stringstream comment;
+    if (const loop_cost* l = find_occurrence(loops_, op, occurrence)) {
+      comment << "trip count=";
+      print_estimate(comment, l->trip_count, ctx, values);
+      comment << "\nper iteration: ";
+      print_cost(comment, l->per_iteration, ctx, values);
+      comment << "\n";
+    }
+    if (op->type == node_type::loop || op->type == node_type::allocate || op->type == node_type::call_stmt ||
+        op->type == node_type::copy_stmt) {
+      // `s` may contain stmts that we didn't estimate, don't annotate those.
+      if (const stmt_cost* c = find_occurrence(costs_, op, occurrence)) {
+        comment << "total: ";
+        print_cost(comment, *c, ctx, values);
+      }
+    }
+    return comment.str();
+  });
+}
+
+}  // namespace slinky
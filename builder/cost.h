@@ -0,0 +1,72 @@
+#ifndef SLINKY_BUILDER_COST_H
+#define SLINKY_BUILDER_COST_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+
+namespace slinky {
+
+// An estimate of the cost of executing a stmt.
+struct stmt_cost {
+  // The number of `call_stmt`s and `copy_stmt`s executed.
+  expr calls;
+  // The total size in bytes of the input and output buffers passed to those calls, as cropped in the scope of each
+  // call. Outputs are always cropped to the region the call produces, but inputs are only cropped when the pipeline
+  // needs their bounds, so `bytes_read` is an upper bound of the memory traffic.
+  expr bytes_read;
+  expr bytes_written;
+  // The total size in bytes of the `allocate`s executed.
+  expr bytes_allocated;
+
+  expr bytes_touched() const { return bytes_read + bytes_written; }
+};
+
+// Estimates the cost of running a lowered pipeline `s`, without running it. The estimates are expressions of the
+// variables and buffers that are free in `s` (the pipeline arguments, inputs and outputs), which can be evaluated for
+// particular shapes.
+//
+// The cost of a loop is its trip count multiplied by an upper bound of the cost of one iteration of its body. The
+// buffers of calls are assumed to have the bounds given by the enclosing allocations and crops. Buffers that are not
+// allocated in `s` are assumed to have the rank of the highest dimension cropped, or to be accessed entirely if they
+// are not cropped. Folded buffers are assumed to be accessed within one fold.
+class cost_estimate {
+public:
+  struct loop_cost {
+    // An upper bound of the cost of one iteration of the loop. `bytes_touched()` is the working set of the loop.
+    stmt_cost per_iteration;
+    expr trip_count;
+  };
+
+  // The same node can appear more than once in a stmt (e.g. the body of a loop and of its peeled first iteration), and
+  // each occurrence can have a different cost. These are indexed by the occurrence of the node, in the order the stmt
+  // is printed.
+  using cost_map = std::map<const base_stmt_node*, std::vector<stmt_cost>>;
+  using loop_map = std::map<const base_stmt_node*, std::vector<loop_cost>>;
+
+private:
+  stmt_cost total_;
+  cost_map costs_;
+  loop_map loops_;
+
+public:
+  cost_estimate(const stmt& s);
+
+  const stmt_cost& total() const { return total_; }
+
+  // The cost of the `occurrence`th occurrence of a stmt within `s`, if it is a loop, allocation, or call.
+  const stmt_cost* cost(const stmt& s, std::size_t occurrence = 0) const;
+  const loop_cost* loop(const stmt& s, std::size_t occurrence = 0) const;
+
+  // Print `s`, with comments showing the cost estimates of each loop, allocation and call. If `values` is not null, the
+  // estimates are evaluated in this context to print concrete numbers.
+  void print(std::ostream& os, const stmt& s, const node_context* ctx = nullptr, eval_context* values = nullptr) const;
+};
+
+}  // namespace slinky
+
+#endif  // SLINKY_BUILDER_COST_H
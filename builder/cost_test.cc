@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+#include "builder/cost.h"
+#include "builder/pipeline.h"
+#include "runtime/evaluate.h"
+#include "runtime/pipeline.h"
+
+using namespace slinky;
+
+namespace {
+
+// The cost estimate doesn't run the pipeline, so these don't need to do anything.
+index_t elementwise(const buffer<const int>& in, const buffer<int>& out) { return 0; }
+index_t stencil(const buffer<const short>& in, const buffer<short>& out) { return 0; }
+
+}  // namespace
+
+TEST(cost, elementwise) {
+  node_context ctx;
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(int), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func a = func::make<const int, int>(elementwise, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func b = func::make<const int, int>(elementwise, {intm, {point(x), point(y)}}, {out, {x, y}});
+  b.loops({{y, 2}});
+
+  pipeline p = build_pipeline(ctx, {in}, {out}, build_options{.no_checks = true});
+
+  cost_estimate cost(p.body());
+
+  const index_t W = 20;
+  const index_t H = 10;
+  buffer<int, 2> in_buf({W, H});
+  buffer<int, 2> out_buf({W, H});
+  eval_context values;
+  values[in->sym()] = reinterpret_cast<index_t>(&in_buf);
+  values[out->sym()] = reinterpret_cast<index_t>(&out_buf);
+
+  // Each stage runs once per strip of 2 rows, writing W x 2 ints.
+  ASSERT_EQ(evaluate(cost.total().calls, values), 2 * H / 2);
+  ASSERT_EQ(evaluate(cost.total().bytes_written, values), 2 * H / 2 * W * 2 * static_cast<index_t>(sizeof(int)));
+  ASSERT_EQ(evaluate(cost.total().bytes_allocated, values), 0);
+
+  std::stringstream annotated;
+  cost.print(annotated, p.body(), &ctx, &values);
+  const std::string& str = annotated.str();
+  ASSERT_NE(str.find("// trip count=5\n"), std::string::npos);
+  ASSERT_NE(str.find("// per iteration: calls=2,"), std::string::npos);
+}
+
+TEST(cost, stencil) {
+  node_context ctx;
+  auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func a = func::make<const short, short>(stencil, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func b = func::make<const short, short>(stencil, {intm, {bounds(-1, 1) + x, bounds(-1, 1) + y}}, {out, {x, y}});
+  b.loops({{y, 1}});
+
+  pipeline p = build_pipeline(ctx, {in}, {out}, build_options{.no_checks = true});
+
+  cost_estimate cost(p.body());
+
+  const index_t W = 20;
+  const index_t H = 10;
+  buffer<short, 2> in_buf({W + 2, H + 2});
+  buffer<short, 2> out_buf({W, H});
+  eval_context values;
+  values[in->sym()] = reinterpret_cast<index_t>(&in_buf);
+  values[out->sym()] = reinterpret_cast<index_t>(&out_buf);
+
+  // The sliding window is warmed up by one call before the loop.
+  ASSERT_EQ(evaluate(cost.total().calls, values), 1 + 2 * H);
+  // The intermediate is folded, so we only allocate 3 rows of it.
+  ASSERT_EQ(evaluate(cost.total().bytes_allocated, values), (W + 2) * 3 * static_cast<index_t>(sizeof(short)));
+  // Each row of the intermediate and the output is written once.
+  ASSERT_EQ(evaluate(cost.total().bytes_written, values),
+      ((H + 2) * (W + 2) + H * W) * static_cast<index_t>(sizeof(short)));
+
+  // Without concrete buffers, the estimates are symbolic.
+  std::stringstream annotated;
+  cost.print(annotated, p.body(), &ctx);
+  ASSERT_NE(annotated.str().find("// trip count="), std::string::npos);
+  ASSERT_NE(annotated.str().find("buffer_extent(out, 0)"), std::string::npos);
+}
+
+TEST(cost, print_not_estimated) {
+  node_context ctx;
+  var in(ctx, "in");
+  var out(ctx, "out");
+  stmt estimated = call_stmt::make(nullptr, {in.sym()}, {out.sym()});
+  stmt other = call_stmt::make(nullptr, {out.sym()}, {in.sym()});
+
+  cost_estimate cost(estimated);
+
+  // Only the total is printed, the stmt that was not estimated is not annotated.
+  std::stringstream annotated;
+  cost.print(annotated, other, &ctx);
+  const std::string& str = annotated.str();
+  ASSERT_EQ(str.find("// total: "), 0);
+  ASSERT_EQ(str.find("total: "), str.rfind("total: "));
+}
+
+TEST(cost, shared_nodes) {
+  node_context ctx;
+  var x(ctx, "x");
+  var y(ctx, "y");
+  var out(ctx, "out");
+
+  // The same inner loop is the body of a peeled first iteration and of the loop over the remaining iterations.
+  stmt inner = loop::make(y.sym(), loop_mode::serial, bounds(0, x), 1, call_stmt::make(nullptr, {}, {out.sym()}));
+  stmt s = block::make({let_stmt::make(x.sym(), 0, inner), loop::make(x.sym(), loop_mode::serial, bounds(1, 9), 1, inner)});
+
+  cost_estimate cost(s);
+
+  // Each occurrence of the inner loop has its own estimate.
+  eval_context values;
+  values[x] = 5;
+  ASSERT_EQ(evaluate(cost.loop(inner, 0)->trip_count), 1);
+  ASSERT_EQ(evaluate(cost.loop(inner, 1)->trip_count, values), 6);
+  ASSERT_EQ(cost.loop(inner, 2), nullptr);
+  // The loop runs 9 iterations of at most 10 calls.
+  ASSERT_EQ(evaluate(cost.total().calls), 1 + 9 * 10);
+
+  std::stringstream annotated;
+  cost.print(annotated, s, &ctx);
+  const std::string& str = annotated.str();
+  ASSERT_NE(str.find("// trip count=1\n"), std::string::npos);
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <map>
@@ -248,18 +249,25 @@ public:
   void visit(const check*) override { std::abort(); }
 };
 
-template <typename T, std::size_t Rank>
-void test_expr_pipeline(node_context& ctx, const expr& e) {
-  elementwise_pipeline_builder<T, Rank> builder(ctx);
-  e.accept(&builder);
+class count_calls : public recursive_node_visitor {
+public:
+  int count = 0;
 
-  pipeline p = build_pipeline(ctx, builder.inputs, {builder.result});
+  void visit(const call_stmt*) override { count++; }
+};
 
+template <typename T, std::size_t Rank>
+std::vector<index_t> default_extents() {
   std::vector<index_t> extents;
   for (std::size_t i = 0; i < Rank; ++i) {
     extents.push_back(i * 3 + 5);
   }
+  return extents;
+}
 
+// Evaluate `p` with random inputs, and check the result is equal to `e`.
+template <typename T, std::size_t Rank>
+void check_expr_pipeline(const pipeline& p, const expr& e, const std::vector<index_t>& extents) {
   std::vector<const raw_buffer*> inputs;
   std::vector<buffer<T, Rank>> input_bufs(p.inputs().size());
 
@@ -294,6 +302,41 @@ void test_expr_pipeline(node_context& ctx, const expr& e) {
   for_each_index(output_buf, [&](auto i) { ASSERT_EQ(output_buf(i), eval.result(i)); });
 }
 
+template <typename T, std::size_t Rank>
+void test_expr_pipeline(node_context& ctx, const expr& e, const build_options& options = build_options()) {
+  elementwise_pipeline_builder<T, Rank> builder(ctx);
+  e.accept(&builder);
+
+  pipeline p = build_pipeline(ctx, builder.inputs, {builder.result}, options);
+
+  if (options.fuse_elementwise) {
+    // The whole expression should be fused into one call.
+    count_calls calls;
+    p.body().accept(&calls);
+    ASSERT_EQ(calls.count, 1);
+  }
+
+  check_expr_pipeline<T, Rank>(p, e, default_extents<T, Rank>());
+}
+
+// Test a pipeline of one func computing `e` with `func::make_elementwise`.
+template <typename T, std::size_t Rank>
+void test_expr_func(node_context& ctx, const expr& e, const std::vector<index_t>& extents = default_extents<T, Rank>()) {
+  // We only need the builder to make the input buffers.
+  elementwise_pipeline_builder<T, Rank> builder(ctx);
+  e.accept(&builder);
+
+  auto out = buffer_expr::make(ctx, "out", sizeof(T), Rank);
+  std::vector<var> dims;
+  for (std::size_t d = 0; d < Rank; ++d) {
+    dims.emplace_back(ctx, "d" + std::to_string(d));
+  }
+  func f = func::make_elementwise<T>(e, builder.inputs, {out, dims});
+  pipeline p = build_pipeline(ctx, builder.inputs, {out});
+
+  check_expr_pipeline<T, Rank>(p, e, extents);
+}
+
 namespace {
 
 node_context ctx;
@@ -323,3 +366,28 @@ TEST(elementwise, add_max_mul) { test_expr_pipeline<int, 1>(ctx, max(a + b, d) *
 TEST(elementwise, exp2) { test_expr_pipeline<int, 1>(ctx, a + x + pow(x, 2)); }
 TEST(elementwise, exp3) { test_expr_pipeline<int, 1>(ctx, a + x + pow(x, 2) + pow(x, 3)); }
 TEST(elementwise, exp4) { test_expr_pipeline<int, 1>(ctx, a + x + pow(x, 2) + pow(x, 3) + pow(x, 4)); }
+
+build_options fused(index_t tile_bytes) {
+  build_options options;
+  options.fuse_elementwise = true;
+  options.fused_tile_bytes = tile_bytes;
+  return options;
+}
+
+TEST(elementwise, fused) {
+  for (index_t tile_bytes : {1, 64, 32 * 1024}) {
+    test_expr_pipeline<int, 1>(ctx, x * y + z, fused(tile_bytes));
+    test_expr_pipeline<int, 1>(ctx, max(a + b, d) * c, fused(tile_bytes));
+    test_expr_pipeline<int, 1>(ctx, a + x + pow(x, 2) + pow(x, 3), fused(tile_bytes));
+    test_expr_pipeline<int, 2>(ctx, max(a + b, d) * c, fused(tile_bytes));
+    test_expr_pipeline<short, 3>(ctx, a + x + pow(x, 2), fused(tile_bytes));
+  }
+}
+
+TEST(elementwise, program) {
+  test_expr_func<int, 1>(ctx, x + y);
+  test_expr_func<int, 1>(ctx, max(a + b, d) * c, {1000});
+  test_expr_func<int, 2>(ctx, a + x + pow(x, 2) + pow(x, 3), {300, 3});
+  test_expr_func<short, 2>(ctx, select(x < y, min(x, z), y - z), {7, 3});
+  test_expr_func<std::int8_t, 3>(ctx, (x == y) || ((y <= z) && (x != z)));
+}
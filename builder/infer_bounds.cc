@@ -20,17 +20,17 @@ namespace slinky {
 namespace {
 
 // Get a reference to `n`th vector element of v, resizing the vector if necessary.
-template <typename T>
-T& vector_at(std::vector<T>& v, std::size_t n) {
+template <typename Vector>
+auto& vector_at(Vector& v, std::size_t n) {
   if (n >= v.size()) {
     v.resize(n + 1);
   }
   return v[n];
 }
-template <typename T>
-T& vector_at(std::optional<std::vector<T>>& v, std::size_t n) {
+template <typename Vector>
+auto& vector_at(std::optional<Vector>& v, std::size_t n) {
   if (!v) {
-    v = std::vector<T>(n + 1);
+    v = Vector(n + 1);
   }
   return vector_at(*v, n);
 }
@@ -90,18 +90,16 @@ public:
 };
 
 // Keep substituting substitutions until nothing happens.
-std::vector<dim_expr> recursive_substitute(
-    std::vector<dim_expr> dims, span<const std::pair<expr, expr>> substitutions) {
+small_vector<dim_expr, 4> recursive_substitute(
+    small_vector<dim_expr, 4> dims, span<const std::pair<expr, expr>> substitutions) {
   while (true) {
     bool changed = false;
     for (dim_expr& dim : dims) {
-      dim_expr new_dim = dim;
-      for (const std::pair<expr, expr>& j : substitutions) {
-        new_dim.bounds.min = substitute(new_dim.bounds.min, j.first, j.second);
-        new_dim.bounds.max = substitute(new_dim.bounds.max, j.first, j.second);
-        new_dim.stride = substitute(new_dim.stride, j.first, j.second);
-        new_dim.fold_factor = substitute(new_dim.fold_factor, j.first, j.second);
-      }
+      dim_expr new_dim = {
+          {substitute(dim.bounds.min, substitutions), substitute(dim.bounds.max, substitutions)},
+          substitute(dim.stride, substitutions),
+          substitute(dim.fold_factor, substitutions),
+      };
       if (!new_dim.same_as(dim)) {
         changed = true;
         dim = new_dim;
@@ -147,7 +145,7 @@ public:
       substitutions.emplace_back(buffer_extent(alloc_var, d), extent);
       stride *= min(extent, buffer_fold_factor(alloc_var, d));
     }
-    std::vector<dim_expr> dims = recursive_substitute(op->dims, substitutions);
+    small_vector<dim_expr, 4> dims = recursive_substitute(op->dims, substitutions);
 
     // Check that the actual bounds we generated are bigger than the inferred bounds (in case the
     // user set the bounds to something too small).
@@ -166,15 +164,14 @@ public:
     for (std::optional<box_expr>& i : infer) {
       if (!i) continue;
       for (interval_expr& j : *i) {
-        for (const auto& k : substitutions) {
-          j.min = substitute(j.min, k.first, k.second);
-          j.max = substitute(j.max, k.first, k.second);
-        }
+        j.min = substitute(j.min, substitutions);
+        j.max = substitute(j.max, substitutions);
       }
     }
 
     stmt s = allocate::make(op->sym, op->storage, op->elem_size, std::move(dims), body);
-    set_result(block::make(block::make(checks), s));
+    checks.push_back(s);
+    set_result(block::make(std::move(checks)));
   }
 
   void visit(const call_stmt* op) override {
@@ -275,6 +272,9 @@ public:
     expr step;
   };
   std::vector<loop_info> loops;
+  // True if we peeled a loop in the stmt we just mutated. Peeling duplicates the loop body, so we only peel one loop of
+  // a nest, to avoid growing the body exponentially with the depth of the nest.
+  bool peeled = false;
 
   // We need an unknown to make equations of.
   var x;
@@ -307,7 +307,7 @@ public:
         replacements.emplace_back(buffer_fold_factor(alloc_var, d), positive_infinity());
       }
     }
-    std::vector<dim_expr> dims = recursive_substitute(op->dims, replacements);
+    small_vector<dim_expr, 4> dims = recursive_substitute(op->dims, replacements);
     // Replace infinite fold factors with undefined.
     for (dim_expr& d : dims) {
       if (is_positive_infinity(d.fold_factor)) d.fold_factor = expr();
@@ -464,7 +464,11 @@ public:
     var orig_min(ctx, ctx.name(op->sym) + ".min_orig");
 
     loops.push_back({op->sym, orig_min, bounds(orig_min, op->bounds.max), op->step});
+    bool outer_peeled = peeled;
+    peeled = false;
     stmt body = mutate(op->body);
+    const bool inner_peeled = peeled;
+    peeled = outer_peeled || inner_peeled;
     expr loop_min = loops.back().bounds.min;
     loops.pop_back();
 
@@ -472,11 +476,40 @@ public:
       loop_min = op->bounds.min;
     }
 
-    if (!is_variable(loop_min, orig_min.sym()) || depends_on(body, orig_min.sym())) {
-      // We rewrote or used the loop min.
+    if (inner_peeled && (!is_variable(loop_min, orig_min.sym()) || depends_on(body, orig_min.sym()))) {
+      // We already peeled a loop in the body (which runs more often than this loop), don't duplicate it again.
       stmt result = loop::make(op->sym, op->mode, {loop_min, op->bounds.max}, op->step, std::move(body));
       set_result(let_stmt::make(orig_min.sym(), op->bounds.min, result));
       return;
+    } else if (!is_variable(loop_min, orig_min.sym())) {
+      // We moved the loop min back to warm up the sliding window. Peel the warm up iterations into a prologue loop, so
+      // the steady state loop only runs the iterations of the original loop.
+      stmt result;
+      if (prove_true(simplify((orig_min - loop_min) % op->step == 0))) {
+        // Use the original loop min directly in the prologue bounds, so the simplifier can see which crops are empty.
+        interval_expr prologue_bounds = {loop_min, min(orig_min - 1, op->bounds.max)};
+        prologue_bounds.min = substitute(prologue_bounds.min, orig_min.sym(), op->bounds.min);
+        prologue_bounds.max = substitute(prologue_bounds.max, orig_min.sym(), op->bounds.min);
+        stmt prologue = loop::make(op->sym, op->mode, prologue_bounds, op->step, body);
+        stmt steady = loop::make(op->sym, op->mode, {orig_min, op->bounds.max}, op->step, std::move(body));
+        result = block::make({std::move(prologue), std::move(steady)});
+        peeled = true;
+      } else {
+        // The warm up iterations are not aligned to the original loop iterations, we can't peel them.
+        result = loop::make(op->sym, op->mode, {loop_min, op->bounds.max}, op->step, std::move(body));
+      }
+      set_result(let_stmt::make(orig_min.sym(), op->bounds.min, result));
+      return;
+    } else if (depends_on(body, orig_min.sym())) {
+      // The body selects between warming up and sliding the window on the first iteration. Peel the first iteration
+      // into a prologue, so the steady state loop doesn't need to select.
+      expr steady_min = orig_min + op->step;
+      stmt prologue = if_then_else::make(orig_min <= op->bounds.max, let_stmt::make(op->sym, orig_min, body));
+      stmt steady = loop::make(op->sym, op->mode, {steady_min, op->bounds.max}, op->step, std::move(body));
+      stmt result = block::make({std::move(prologue), std::move(steady)});
+      set_result(let_stmt::make(orig_min.sym(), op->bounds.min, result));
+      peeled = true;
+      return;
     }
 
     if (body.same_as(op->body)) {
@@ -488,26 +521,40 @@ public:
 
   void visit(const block* op) override {
     // Visit blocks in reverse order. TODO: Is this really sufficient?
-    stmt b = mutate(op->b);
-    stmt a = mutate(op->a);
-    if (a.same_as(op->a) && b.same_as(op->b)) {
+    std::vector<stmt> stmts(op->stmts.size());
+    bool changed = false;
+    for (int i = static_cast<int>(op->stmts.size()) - 1; i >= 0; --i) {
+      stmts[i] = mutate(op->stmts[i]);
+      changed = changed || !stmts[i].same_as(op->stmts[i]);
+    }
+    if (!changed) {
       set_result(op);
     } else {
-      set_result(block::make(a, b));
+      set_result(block::make(std::move(stmts)));
     }
   }
 };
 
-stmt infer_bounds(const stmt& s, const std::vector<symbol_id>& inputs) {
+stmt infer_bounds(const stmt& s, const std::vector<symbol_id>& inputs, bool add_checks) {
   // Tell the bounds inferrer that we are inferring the bounds of the inputs too.
   bounds_inferrer infer;
   for (symbol_id i : inputs) {
     infer.infer[i] = box_expr();
   }
   stmt result = infer.mutate(s);
+  if (!add_checks) return result;
 
-  // Now we should know the bounds required of the inputs. Add checks that the inputs are sufficient.
+  // Now we should know the bounds required of the inputs. Add checks that the inputs are sufficient. These go after
+  // the checks at the beginning of the pipeline, which check that the buffers are valid and satisfy the constraints
+  // the user set, so the simplifier can use those to prove these checks.
   std::vector<stmt> checks;
+  const block* b = result.as<block>();
+  std::size_t leading_checks = 0;
+  if (b) {
+    while (leading_checks < b->stmts.size() && b->stmts[leading_checks].as<check>()) {
+      checks.push_back(b->stmts[leading_checks++]);
+    }
+  }
   for (symbol_id i : inputs) {
     expr buf_var = variable::make(i);
     const box_expr& bounds = *infer.infer[i];
@@ -517,15 +564,20 @@ stmt infer_bounds(const stmt& s, const std::vector<symbol_id>& inputs) {
       checks.push_back(check::make(bounds[d].extent() <= buffer_fold_factor(buf_var, d)));
     }
   }
-  return block::make(block::make(checks), result);
+  if (leading_checks > 0) {
+    checks.insert(checks.end(), b->stmts.begin() + leading_checks, b->stmts.end());
+  } else {
+    checks.push_back(result);
+  }
+  return block::make(std::move(checks));
 }
 
 }  // namespace
 
-stmt infer_bounds(const stmt& s, node_context& ctx, const std::vector<symbol_id>& inputs) {
+stmt infer_bounds(const stmt& s, node_context& ctx, const std::vector<symbol_id>& inputs, bool add_checks) {
   stmt result = s;
 
-  result = infer_bounds(s, inputs);
+  result = infer_bounds(s, inputs, add_checks);
   // We cannot simplify between infer_bounds and fold_storage, because we need to be able to rewrite the bounds
   // of producers while we still understand the dependencies between stages.
   result = slide_and_fold_storage(ctx).mutate(result);
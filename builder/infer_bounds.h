@@ -7,7 +7,9 @@
 
 namespace slinky {
 
-stmt infer_bounds(const stmt& s, node_context& ctx, const std::vector<symbol_id>& inputs);
+// Infers the bounds of the buffers in `s`. If `add_checks` is true, checks that the `inputs` are big enough are added.
+// The simplifier assumes checks are true, so these should not be added if they will not be enforced.
+stmt infer_bounds(const stmt& s, node_context& ctx, const std::vector<symbol_id>& inputs, bool add_checks = true);
 
 }  // namespace slinky
 
@@ -97,7 +97,7 @@ void node_mutator::visit(const select_expr* op) {
 }
 
 void node_mutator::visit(const call* op) {
-  std::vector<expr> args;
+  small_vector<expr, 4> args;
   args.reserve(op->args.size());
   bool changed = false;
   for (const expr& i : op->args) {
@@ -112,12 +112,17 @@ void node_mutator::visit(const call* op) {
 }
 
 void node_mutator::visit(const block* op) {
-  stmt a = mutate(op->a);
-  stmt b = mutate(op->b);
-  if (a.same_as(op->a) && b.same_as(op->b)) {
+  std::vector<stmt> stmts;
+  stmts.reserve(op->stmts.size());
+  bool changed = false;
+  for (const stmt& i : op->stmts) {
+    stmts.push_back(mutate(i));
+    changed = changed || !stmts.back().same_as(i);
+  }
+  if (!changed) {
     set_result(op);
   } else {
-    set_result(block::make(std::move(a), std::move(b)));
+    set_result(block::make(std::move(stmts)));
   }
 }
 void node_mutator::visit(const loop* op) {
@@ -142,7 +147,7 @@ void node_mutator::visit(const if_then_else* op) {
 }
 void node_mutator::visit(const call_stmt* op) { set_result(op); }
 void node_mutator::visit(const copy_stmt* op) {
-  std::vector<expr> src_x;
+  small_vector<expr, 4> src_x;
   src_x.reserve(op->src_x.size());
   bool changed = false;
   for (const expr& i : op->src_x) {
@@ -156,7 +161,7 @@ void node_mutator::visit(const copy_stmt* op) {
   }
 }
 void node_mutator::visit(const allocate* op) {
-  std::vector<dim_expr> dims;
+  small_vector<dim_expr, 4> dims;
   dims.reserve(op->dims.size());
   bool changed = false;
   for (const dim_expr& i : op->dims) {
@@ -174,7 +179,7 @@ void node_mutator::visit(const allocate* op) {
 void node_mutator::visit(const make_buffer* op) {
   expr base = mutate(op->base);
   expr elem_size = mutate(op->elem_size);
-  std::vector<dim_expr> dims;
+  small_vector<dim_expr, 4> dims;
   dims.reserve(op->dims.size());
   bool changed = false;
   for (const dim_expr& i : op->dims) {
@@ -198,7 +203,7 @@ void node_mutator::visit(const clone_buffer* op) {
   }
 }
 void node_mutator::visit(const crop_buffer* op) {
-  std::vector<interval_expr> bounds;
+  box_expr bounds;
   bounds.reserve(op->bounds.size());
   bool changed = false;
   for (const interval_expr& i : op->bounds) {
@@ -222,7 +227,7 @@ void node_mutator::visit(const crop_dim* op) {
   }
 }
 void node_mutator::visit(const slice_buffer* op) {
-  std::vector<expr> at;
+  small_vector<expr, 4> at;
   at.reserve(op->at.size());
   bool changed = false;
   for (const expr& i : op->at) {
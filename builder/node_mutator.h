@@ -23,9 +23,10 @@ public:
   const expr& mutated_expr() const { return e_; }
   const stmt& mutated_stmt() const { return s_; }
 
+  // These use `dispatch` rather than `accept`, so mutating a node costs one virtual call instead of two.
   virtual expr mutate(const expr& e) {
     if (e.defined()) {
-      e.accept(this);
+      dispatch(*this, e.get());
       return std::move(e_);
     } else {
       return expr();
@@ -33,7 +34,7 @@ public:
   }
   virtual stmt mutate(const stmt& s) {
     if (s.defined()) {
-      s.accept(this);
+      dispatch(*this, s.get());
       return std::move(s_);
     } else {
       return stmt();
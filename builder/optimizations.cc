@@ -15,6 +15,7 @@
 #include "runtime/evaluate.h"
 #include "runtime/expr.h"
 #include "builder/node_mutator.h"
+#include "builder/simplify.h"
 #include "builder/substitute.h"
 #include "runtime/util.h"
 
@@ -23,17 +24,17 @@ namespace slinky {
 namespace {
 
 // Get a reference to `n`th vector element of v, resizing the vector if necessary.
-template <typename T>
-T& vector_at(std::vector<T>& v, std::size_t n) {
+template <typename Vector>
+auto& vector_at(Vector& v, std::size_t n) {
   if (n >= v.size()) {
     v.resize(n + 1);
   }
   return v[n];
 }
-template <typename T>
-T& vector_at(std::optional<std::vector<T>>& v, std::size_t n) {
+template <typename Vector>
+auto& vector_at(std::optional<Vector>& v, std::size_t n) {
   if (!v) {
-    v = std::vector<T>(n + 1);
+    v = Vector(n + 1);
   }
   return vector_at(*v, n);
 }
@@ -88,7 +89,7 @@ bool is_copy(expr in, var out, expr& offset) {
   return false;
 }
 
-bool is_copy(const copy_stmt* op, std::vector<expr>& offset) {
+bool is_copy(const copy_stmt* op, small_vector<expr, 4>& offset) {
   if (op->src_x.size() != op->dst_x.size()) return false;
   offset.resize(op->dst_x.size());
   for (std::size_t d = 0; d < op->dst_x.size(); ++d) {
@@ -127,7 +128,7 @@ public:
 
 class buffer_aliaser : public node_mutator {
   struct buffer_alias {
-    std::vector<expr> offset;
+    small_vector<expr, 4> offset;
   };
 
   class buffer_info {
@@ -153,22 +154,45 @@ class buffer_aliaser : public node_mutator {
   symbol_map<box_expr> buffer_bounds;
   symbol_map<std::size_t> elem_sizes;
   symbol_map<bool> do_not_alias;
+  // The conditions of the checks that have run so far in the enclosing blocks.
+  fact_set facts;
+
+  // Buffers we didn't allocate have an elem_size if a check told us what it is.
+  std::optional<std::size_t> elem_size(symbol_id sym) const {
+    if (std::optional<std::size_t> result = elem_sizes[sym]) return result;
+    interval_expr bounds = facts.bounds_of(buffer_elem_size(variable::make(sym)));
+    const index_t* min = as_constant(bounds.min);
+    const index_t* max = as_constant(bounds.max);
+    if (min && max && *min == *max) return *min;
+    return std::nullopt;
+  }
 
 public:
   void visit(const allocate* op) override {
     box_expr bounds;
     bounds.reserve(op->dims.size());
     bool do_not_alias_sym = false;
+    // Aliasing this buffer would replace its strides with those of the target, so we can only alias it if it has the
+    // default dense strides.
+    bool dense = true;
+    expr dense_stride = static_cast<index_t>(op->elem_size);
     for (const dim_expr& d : op->dims) {
       bounds.push_back(d.bounds);
       if (d.fold_factor.defined()) {
         // This buffer can't be aliased.
         do_not_alias_sym = true;
       }
+      if (is_zero(d.stride)) {
+        // The simplifier sets the stride of dimensions that only store one element to 0.
+        continue;
+      }
+      dense = dense && prove_true(d.stride == dense_stride);
+      dense_stride *= d.fold_factor.defined() ? min(d.bounds.extent(), d.fold_factor) : d.bounds.extent();
     }
     auto set_do_not_alias = set_value_in_scope(do_not_alias, op->sym, do_not_alias_sym);
     auto set_buffer_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
     auto set_elem_size = set_value_in_scope(elem_sizes, op->sym, op->elem_size);
+    fact_set::scope body_facts(facts, op->sym);
 
     // When we allocate a buffer, we can look for all the uses of this buffer. If it is:
     // - consumed elemenwise,
@@ -182,15 +206,15 @@ public:
     stmt body = mutate(op->body);
     const std::map<symbol_id, buffer_alias>& can_alias = alias_info[op->sym]->can_alias();
 
-    if (!can_alias.empty()) {
+    if (dense && !can_alias.empty()) {
       const std::pair<symbol_id, buffer_alias>& target = *can_alias.begin();
       var target_var(target.first);
 
       // Here, we're essentially constructing make_buffer(op->sym, ...) { crop_buffer(op->sym, dims_bounds(op->dims) {
       // ... } }, but we can't do that (and just rely on the simplifier) because translated crops might require a
       // buffer_at call that is out of bounds.
-      std::vector<expr> at = target.second.offset;
-      std::vector<dim_expr> dims = buffer_dims(target_var, op->dims.size());
+      small_vector<expr, 4> at = target.second.offset;
+      small_vector<dim_expr, 4> dims = buffer_dims(target_var, op->dims.size());
       assert(at.size() <= dims.size());
       at.resize(dims.size());
       for (int d = 0; d < static_cast<int>(dims.size()); ++d) {
@@ -224,7 +248,7 @@ public:
   void visit(const call_stmt* op) override {
     set_result(op);
     for (symbol_id o : op->outputs) {
-      std::optional<std::size_t> elem_size_o = elem_sizes[o];
+      std::optional<std::size_t> elem_size_o = elem_size(o);
       if (!elem_size_o) continue;
 
       std::optional<bool> no_alias = do_not_alias[o];
@@ -236,7 +260,7 @@ public:
         const std::optional<box_expr>& in_x = buffer_bounds[i];
         std::optional<buffer_info>& info = alias_info[i];
         if (!info) continue;
-        std::optional<std::size_t> elem_size_i = elem_sizes[i];
+        std::optional<std::size_t> elem_size_i = elem_size(i);
         if (!elem_size_i) continue;
 
         if (!in_x || *elem_size_o != *elem_size_i || !is_elementwise(*in_x, o)) {
@@ -274,13 +298,33 @@ public:
     std::optional<box_expr> bounds = buffer_bounds[op->sym];
     merge_crop(bounds, op->bounds);
     auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
-    node_mutator::visit(op);
+    visit_crop(op);
   }
 
   void visit(const crop_dim* op) override {
     std::optional<box_expr> bounds = buffer_bounds[op->sym];
     merge_crop(bounds, op->dim, op->bounds);
     auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
+    visit_crop(op);
+  }
+
+  // Facts about a symbol don't apply to a new declaration of it.
+  template <typename T>
+  void visit_declaration(const T* op) {
+    fact_set::scope body_facts(facts, op->sym);
+    node_mutator::visit(op);
+  }
+
+  void visit(const let_stmt* op) override { visit_declaration(op); }
+  void visit(const loop* op) override { visit_declaration(op); }
+  void visit(const make_buffer* op) override { visit_declaration(op); }
+  void visit(const clone_buffer* op) override { visit_declaration(op); }
+
+  // A crop is a new declaration of the buffer too, but it has the same elem_size.
+  template <typename T>
+  void visit_crop(const T* op) {
+    fact_set::scope body_facts(
+        facts, op->sym, [](const call* c) { return c->intrinsic == intrinsic::buffer_elem_size; });
     node_mutator::visit(op);
   }
 
@@ -289,45 +333,22 @@ public:
   void visit(const slice_dim*) override { std::abort(); }
   void visit(const truncate_rank*) override { std::abort(); }
 
-  // We need a better way to do this. `check` doesn't have a scope, so we need to be careful to only learn information
-  // about buffers within the scope the check has been guaranteed to have run in. For now, only bother with checks at
-  // the global scope.
-  bool at_root_scope = true;
-
-  void visit(const check* op) override {
-    set_result(op);
-    if (!at_root_scope) return;
-    if (const equal* eq = op->condition.as<equal>()) {
-      if (const call* op = eq->a.as<call>()) {
-        if (op->intrinsic == intrinsic::buffer_elem_size) {
-          const symbol_id* buf = as_variable(op->args[0]);
-          const index_t* value = as_constant(eq->b);
-          if (buf && value) {
-            elem_sizes[*buf] = *value;
-          }
-        }
-      }
-    }
-  }
-
   void visit(const block* op) override {
-    stmt a, b;
-    if (op->a.defined()) {
-      if (!op->a.as<check>() && !op->a.as<block>()) {
-        at_root_scope = false;
-      }
-      a = mutate(op->a);
-    }
-    if (op->b.defined()) {
-      if (!op->b.as<check>() && !op->b.as<block>()) {
-        at_root_scope = false;
+    std::vector<stmt> stmts;
+    stmts.reserve(op->stmts.size());
+    bool changed = false;
+    fact_set::scope block_facts(facts);
+    for (const stmt& i : op->stmts) {
+      stmts.push_back(mutate(i));
+      changed = changed || !stmts.back().same_as(i);
+      if (const check* c = i.as<check>()) {
+        facts.learn(c->condition);
       }
-      b = mutate(op->b);
     }
-    if (a.same_as(op->a) && b.same_as(op->b)) {
+    if (!changed) {
       set_result(op);
     } else {
-      set_result(block::make(std::move(a), std::move(b)));
+      set_result(block::make(std::move(stmts)));
     }
   }
 };
@@ -354,8 +375,8 @@ public:
     var src_var(op->src);
     var dst_var(op->dst);
 
-    std::vector<expr> src_x = op->src_x;
-    std::vector<dim_expr> src_dims;
+    small_vector<expr, 4> src_x = op->src_x;
+    small_vector<dim_expr, 4> src_dims;
     std::vector<std::pair<symbol_id, int>> dst_x;
     int dst_d = 0;
 
@@ -416,8 +437,9 @@ namespace {
 template <typename Fn>
 void for_each_stmt_forward(const stmt& s, const Fn& fn) {
   if (const block* b = s.as<block>()) {
-    if (b->a.defined()) for_each_stmt_forward(b->a, fn);
-    if (b->b.defined()) for_each_stmt_forward(b->b, fn);
+    for (auto i = b->stmts.begin(); i != b->stmts.end(); ++i) {
+      for_each_stmt_forward(*i, fn);
+    }
   } else {
     fn(s);
   }
@@ -426,8 +448,9 @@ void for_each_stmt_forward(const stmt& s, const Fn& fn) {
 template <typename Fn>
 void for_each_stmt_backward(const stmt& s, const Fn& fn) {
   if (const block* b = s.as<block>()) {
-    if (b->b.defined()) for_each_stmt_backward(b->b, fn);
-    if (b->a.defined()) for_each_stmt_backward(b->a, fn);
+    for (auto i = b->stmts.rbegin(); i != b->stmts.rend(); ++i) {
+      for_each_stmt_backward(*i, fn);
+    }
   } else {
     fn(s);
   }
@@ -438,33 +461,28 @@ void for_each_stmt_backward(const stmt& s, const Fn& fn) {
 // - stmts that do depend on `vars`
 // - stmts that don't depend on `vars`
 std::tuple<stmt, stmt, stmt> split_body(const stmt& body, span<const symbol_id> vars) {
-  stmt before;
-  stmt new_body_after;
+  std::vector<stmt> before;
+  std::vector<stmt> new_body_after;
   bool depended_on = false;
   // First, split the body into the before, and the new body + after.
   for_each_stmt_forward(body, [&](const stmt& s) {
     if (depended_on || depends_on(s, vars)) {
-      new_body_after = block::make({new_body_after, s});
+      new_body_after.push_back(s);
       depended_on = true;
     } else {
-      before = block::make({before, s});
+      before.push_back(s);
     }
   });
 
   // Now, split the new body + after into the new body and the after.
-  stmt new_body;
-  stmt after;
-  depended_on = false;
-  for_each_stmt_backward(new_body_after, [&](const stmt& s) {
-    if (!depended_on && !depends_on(s, vars)) {
-      after = block::make({s, after});
-    } else {
-      new_body = block::make({s, new_body});
-      depended_on = true;
-    }
-  });
+  std::size_t new_body_end = new_body_after.size();
+  while (new_body_end > 0 && !depends_on(new_body_after[new_body_end - 1], vars)) {
+    --new_body_end;
+  }
+  stmt new_body = block::make(new_body_after.begin(), new_body_after.begin() + new_body_end);
+  stmt after = block::make(new_body_after.begin() + new_body_end, new_body_after.end());
 
-  return {before, new_body, after};
+  return {block::make(std::move(before)), new_body, after};
 }
 
 std::tuple<stmt, stmt, stmt> split_body(const stmt& body, symbol_id var) {
@@ -5,7 +5,9 @@
 #include <cstddef>
 #include <cstdlib>
 #include <iostream>
+#include <functional>
 #include <list>
+#include <map>
 #include <optional>
 #include <set>
 #include <string>
@@ -64,6 +66,24 @@ buffer_expr_ptr buffer_expr::make(node_context& ctx, const std::string& sym, con
   return buffer_expr_ptr(new buffer_expr(ctx.insert_unique(sym), buffer));
 }
 
+buffer_expr& buffer_expr::storage_order(std::vector<int> order) {
+  std::vector<bool> seen(rank(), false);
+  bool is_permutation = order.size() == rank();
+  for (int d : order) {
+    if (!is_permutation || d < 0 || d >= static_cast<int>(rank()) || seen[d]) {
+      is_permutation = false;
+      break;
+    }
+    seen[d] = true;
+  }
+  if (!is_permutation) {
+    std::cerr << "Storage order of a buffer must be a permutation of its dimensions" << std::endl;
+    std::abort();
+  }
+  storage_order_ = std::move(order);
+  return *this;
+}
+
 void buffer_expr::set_producer(func* f) {
   assert(producer_ == nullptr || f == nullptr);
   producer_ = f;
@@ -123,7 +143,7 @@ stmt func::make_call() const {
     std::vector<stmt> copies;
     for (const func::input& input : inputs_) {
       assert(outputs_.size() == 1);
-      std::vector<expr> src_x;
+      small_vector<expr, 4> src_x;
       std::vector<symbol_id> dst_x;
       for (const interval_expr& i : input.bounds) {
         assert(match(i.min, i.max));
@@ -152,6 +172,227 @@ bool operator==(const loop_id& a, const loop_id& b) {
   }
 }
 
+// Returns true if `f` is an elementwise func: it has one output, and each input is accessed at the same point as the
+// output.
+bool is_elementwise(const func* f) {
+  if (!f->impl() || f->outputs().size() != 1) return false;
+  const func::output& o = f->outputs().front();
+  for (const func::input& i : f->inputs()) {
+    if (i.buffer->rank() != o.dims.size() || i.bounds.size() != o.dims.size()) return false;
+    for (std::size_t d = 0; d < o.dims.size(); ++d) {
+      if (!is_variable(i.bounds[d].min, o.dims[d].sym()) || !is_variable(i.bounds[d].max, o.dims[d].sym())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns true if the user has not constrained the layout of `b`.
+bool has_default_dims(const buffer_expr_ptr& b) {
+  if (!b->has_default_layout()) return false;
+  expr buf_var = variable::make(b->sym());
+  for (int d = 0; d < static_cast<int>(b->rank()); ++d) {
+    const dim_expr& dim = b->dim(d);
+    if (!match(dim.bounds.min, buffer_min(buf_var, d)) || !match(dim.bounds.max, buffer_max(buf_var, d)) ||
+        !match(dim.stride, buffer_stride(buf_var, d)) || !match(dim.fold_factor, buffer_fold_factor(buf_var, d))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The callable implementing a chain of fused elementwise funcs. The output is split into sub-tiles of approximately
+// `tile_bytes` (including the inputs and intermediates), and the stages are called in order on each sub-tile.
+class fused_elementwise_call {
+public:
+  std::vector<call_stmt::callable> stages;
+  // The buffers from outside the fused call, including the output.
+  std::vector<symbol_id> buffers;
+  symbol_id output;
+  // The buffers produced and consumed by the stages, and their element sizes.
+  std::vector<std::pair<symbol_id, index_t>> intermediates;
+  index_t tile_bytes;
+
+private:
+  struct tile_state {
+    span<const raw_buffer*> originals;
+    span<raw_buffer*> views;
+    span<raw_buffer*> intermediates;
+    span<const index_t> tile_extents;
+  };
+
+  // Crops the views of the buffers to the current tile, and calls the stages.
+  index_t run_tile(eval_context& ctx, const tile_state& s) const {
+    for (std::size_t i = 0; i < s.views.size(); ++i) {
+      raw_buffer* view = s.views[i];
+      index_t offset = 0;
+      for (std::size_t d = 0; d < view->rank; ++d) {
+        offset += s.originals[i]->dim(d).flat_offset_bytes(view->dim(d).min());
+      }
+      view->base = offset_bytes(s.originals[i]->base, offset);
+    }
+    for (const call_stmt::callable& i : stages) {
+      index_t result = i(ctx);
+      if (result) return result;
+    }
+    return 0;
+  }
+
+  index_t for_each_tile(eval_context& ctx, const tile_state& s, const raw_buffer& out, int d) const {
+    if (d < 0) return run_tile(ctx, s);
+    const index_t step = s.tile_extents[d];
+    for (index_t x = out.dim(d).begin(); x < out.dim(d).end(); x += step) {
+      const index_t x_max = std::min(x + step - 1, out.dim(d).max());
+      for (raw_buffer* i : s.views) {
+        i->dim(d).set_bounds(x, x_max);
+      }
+      for (raw_buffer* i : s.intermediates) {
+        i->dim(d).set_bounds(x, x_max);
+      }
+      index_t result = for_each_tile(ctx, s, out, d - 1);
+      if (result) return result;
+    }
+    return 0;
+  }
+
+public:
+  index_t operator()(eval_context& ctx) const {
+    const raw_buffer* out = ctx.lookup_buffer(output);
+    const std::size_t rank = out->rank;
+    for (std::size_t d = 0; d < rank; ++d) {
+      if (out->dim(d).extent() <= 0) return 0;
+    }
+
+    // Everything below is allocated on the stack, so a fused call does not touch the heap. The intermediates of a
+    // sub-tile are bounded by `tile_bytes`.
+    const std::size_t n = buffers.size();
+    const std::size_t m = intermediates.size();
+    auto** originals = reinterpret_cast<const raw_buffer**>(alloca(sizeof(const raw_buffer*) * n));
+    auto** views = reinterpret_cast<raw_buffer**>(alloca(sizeof(raw_buffer*) * n));
+    auto** intms = reinterpret_cast<raw_buffer**>(alloca(sizeof(raw_buffer*) * m));
+    auto* tile_extents = reinterpret_cast<index_t*>(alloca(sizeof(index_t) * rank));
+    auto* old_values = reinterpret_cast<std::optional<index_t>*>(alloca(sizeof(std::optional<index_t>) * (n + m)));
+
+    // Choose the sub-tile shape, greedily filling the innermost dimensions first. Dimensions that are folded in any of
+    // the buffers are not tiled, so a sub-tile never spans a folding boundary.
+    index_t bytes_per_element = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      originals[i] = ctx.lookup_buffer(buffers[i]);
+      bytes_per_element += originals[i]->elem_size;
+    }
+    for (const auto& i : intermediates) {
+      bytes_per_element += i.second;
+    }
+    index_t elements = std::max<index_t>(1, tile_bytes / bytes_per_element);
+    index_t tile_elements = 1;
+    for (std::size_t d = 0; d < rank; ++d) {
+      bool folded = false;
+      for (std::size_t i = 0; i < n; ++i) {
+        folded = folded || originals[i]->dim(d).fold_factor() != dim::unfolded;
+      }
+      tile_extents[d] = folded ? 1 : std::min(elements, out->dim(d).extent());
+      elements = std::max<index_t>(1, elements / tile_extents[d]);
+      tile_elements *= tile_extents[d];
+    }
+
+    // Make views of the buffers that we can crop to each sub-tile, and the intermediate buffers.
+    const std::size_t header_bytes = sizeof(raw_buffer) + sizeof(dim) * rank;
+    char* headers = reinterpret_cast<char*>(alloca(header_bytes * (n + m)));
+    auto make_header = [&](std::size_t i, std::size_t elem_size) {
+      raw_buffer* result = reinterpret_cast<raw_buffer*>(&headers[header_bytes * i]);
+      result->allocation = nullptr;
+      result->base = nullptr;
+      result->elem_size = elem_size;
+      result->rank = rank;
+      result->dims = reinterpret_cast<dim*>(&headers[header_bytes * i + sizeof(raw_buffer)]);
+      return result;
+    };
+    for (std::size_t i = 0; i < n; ++i) {
+      views[i] = make_header(i, originals[i]->elem_size);
+      for (std::size_t d = 0; d < rank; ++d) {
+        views[i]->dim(d) = originals[i]->dim(d);
+      }
+      new (&old_values[i]) std::optional<index_t>(ctx.lookup(buffers[i]));
+      ctx[buffers[i]] = reinterpret_cast<index_t>(views[i]);
+    }
+    constexpr index_t intermediate_alignment = 16;
+    index_t intermediate_bytes = 0;
+    for (const auto& i : intermediates) {
+      intermediate_bytes += align_up(i.second * tile_elements, intermediate_alignment);
+    }
+    char* data = reinterpret_cast<char*>(alloca(intermediate_bytes + intermediate_alignment));
+    data = reinterpret_cast<char*>(align_up(reinterpret_cast<index_t>(data), intermediate_alignment));
+    for (std::size_t i = 0; i < m; ++i) {
+      intms[i] = make_header(n + i, intermediates[i].second);
+      index_t stride = intermediates[i].second;
+      for (std::size_t d = 0; d < rank; ++d) {
+        intms[i]->dim(d).set_min_extent(0, tile_extents[d]);
+        intms[i]->dim(d).set_stride(stride);
+        intms[i]->dim(d).set_fold_factor(dim::unfolded);
+        stride *= tile_extents[d];
+      }
+      intms[i]->base = data;
+      data += align_up(stride, intermediate_alignment);
+      new (&old_values[n + i]) std::optional<index_t>(ctx.lookup(intermediates[i].first));
+      ctx[intermediates[i].first] = reinterpret_cast<index_t>(intms[i]);
+    }
+
+    tile_state s{{originals, n}, {views, n}, {intms, m}, {tile_extents, rank}};
+    index_t result = for_each_tile(ctx, s, *out, static_cast<int>(rank) - 1);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      ctx[buffers[i]] = old_values[i];
+    }
+    for (std::size_t i = 0; i < m; ++i) {
+      ctx[intermediates[i].first] = old_values[n + i];
+    }
+    return result;
+  }
+};
+
+// Returns the dims of an allocation of `b`, with the strides computed according to the layout of `b`. Strides that the
+// user has set explicitly are not changed. If the layout is the default, the strides are left to `infer_bounds`.
+std::vector<dim_expr> layout_dims(const buffer_expr_ptr& b) {
+  std::vector<dim_expr> dims = b->dims();
+  if (b->has_default_layout()) return dims;
+
+  std::vector<int> order = b->storage_order();
+  if (order.empty()) {
+    for (int d = 0; d < static_cast<int>(dims.size()); ++d) {
+      order.push_back(d);
+    }
+  }
+
+  expr buf_var = variable::make(b->sym());
+  const index_t alignment = b->row_alignment();
+  // The padding must keep the strides aligned, and move them off a multiple of `conflict_stride_bytes`.
+  index_t padding = align_up(buffer_expr::cache_line_bytes, alignment);
+  if (padding % buffer_expr::conflict_stride_bytes == 0) padding += alignment;
+  if (b->pad_strides() && padding % buffer_expr::conflict_stride_bytes == 0) {
+    std::cerr << "Cannot pad the strides of a buffer with rows aligned to a multiple of "
+              << buffer_expr::conflict_stride_bytes << " bytes" << std::endl;
+    std::abort();
+  }
+  expr stride = b->elem_size();
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    dim_expr& dim = dims[order[i]];
+    if (i > 0) {
+      if (alignment > 1) {
+        stride = align_up(stride, expr(alignment));
+      }
+      if (b->pad_strides()) {
+        stride += select(stride % buffer_expr::conflict_stride_bytes == 0, padding, 0);
+      }
+    }
+    if (match(dim.stride, buffer_stride(buf_var, order[i]))) {
+      dim.stride = stride;
+    }
+    stride = dim.stride * min(dim.extent(), dim.fold_factor);
+  }
+  return dims;
+}
+
 class pipeline_builder {
   // We're going to incrementally build the body, starting at the end of the pipeline and adding
   // producers as necessary.
@@ -160,11 +401,19 @@ class pipeline_builder {
   std::set<buffer_expr_ptr> produced, consumed;
   std::set<buffer_expr_ptr> allocated;
 
+  // Chains of elementwise funcs that are fused into one call, keyed by the last func of the chain.
+  struct fused_chain {
+    std::vector<func::input> inputs;
+    std::vector<buffer_expr_ptr> intermediates;
+    call_stmt::callable impl;
+  };
+  std::map<const func*, fused_chain> fused;
+
   stmt result;
 
 public:
   pipeline_builder(const std::vector<buffer_expr_ptr>& inputs, const std::vector<buffer_expr_ptr>& outputs,
-      std::set<buffer_expr_ptr>& constants) {
+      std::set<buffer_expr_ptr>& constants, const build_options& options) {
     // To start with, we need to produce the outputs.
     for (auto& i : outputs) {
       to_produce.insert(i);
@@ -197,6 +446,92 @@ public:
 
       to_produce.insert(produce_next.begin(), produce_next.end());
     }
+
+    if (options.fuse_elementwise) {
+      fuse_elementwise(outputs, options.fused_tile_bytes);
+    }
+  }
+
+  // Find chains of elementwise funcs where each func is only consumed by the next func in the chain, and make a fused
+  // call for each of them.
+  void fuse_elementwise(const std::vector<buffer_expr_ptr>& outputs, index_t tile_bytes) {
+    std::map<buffer_expr_ptr, std::set<const func*>> consumers;
+    for (const buffer_expr_ptr& i : to_produce) {
+      if (!i->producer()) continue;
+      for (const func::input& j : i->producer()->inputs()) {
+        consumers[j.buffer].insert(i->producer());
+      }
+    }
+
+    // Map the buffers that can be fused into their consumer to that consumer.
+    std::map<buffer_expr_ptr, const func*> fused_into;
+    for (const buffer_expr_ptr& i : to_produce) {
+      const func* f = i->producer();
+      if (!f || produced.count(i) || !is_elementwise(f) || !f->loops().empty() || f->compute_at()) continue;
+      if (i->store_at() || !has_default_dims(i)) continue;
+      if (std::find(outputs.begin(), outputs.end(), i) != outputs.end()) continue;
+      const std::set<const func*>& c = consumers[i];
+      if (c.size() != 1 || !is_elementwise(*c.begin())) continue;
+      fused_into[i] = *c.begin();
+    }
+
+    std::set<const func*> fused_funcs;
+    for (const auto& i : fused_into) {
+      fused_funcs.insert(i.first->producer());
+    }
+
+    for (const buffer_expr_ptr& i : to_produce) {
+      const func* g = i->producer();
+      if (!g || fused_funcs.count(g) || !is_elementwise(g) || fused.count(g)) continue;
+
+      fused_chain chain;
+      fused_elementwise_call call;
+      const func::output& out = g->outputs().front();
+      box_expr bounds;
+      for (const var& d : out.dims) {
+        bounds.push_back(point(d));
+      }
+
+      // Add the stages producing the inputs of f (recursively) to the chain, and then f.
+      std::set<buffer_expr_ptr> visited;
+      std::function<void(const func*)> add_stage = [&](const func* f) {
+        for (const func::input& j : f->inputs()) {
+          if (!visited.insert(j.buffer).second) continue;
+          if (fused_into.count(j.buffer)) {
+            add_stage(j.buffer->producer());
+            chain.intermediates.push_back(j.buffer);
+            call.intermediates.emplace_back(j.sym(), j.buffer->elem_size());
+          } else {
+            chain.inputs.push_back({j.buffer, bounds});
+            call.buffers.push_back(j.sym());
+          }
+        }
+        call.stages.push_back(f->impl());
+      };
+      add_stage(g);
+      if (chain.intermediates.empty()) continue;
+
+      call.buffers.push_back(out.sym());
+      call.output = out.sym();
+      call.tile_bytes = tile_bytes;
+      chain.impl = std::move(call);
+      fused[g] = std::move(chain);
+    }
+  }
+
+  const std::vector<func::input>& inputs_of(const func* f) const {
+    auto i = fused.find(f);
+    return i != fused.end() ? i->second.inputs : f->inputs();
+  }
+
+  stmt make_call(const func* f) const {
+    auto i = fused.find(f);
+    if (i == fused.end()) return f->make_call();
+    call_stmt::symbol_list inputs;
+    for (const func::input& j : i->second.inputs) {
+      inputs.push_back(j.sym());
+    }
+    return call_stmt::make(i->second.impl, std::move(inputs), {f->outputs().front().sym()});
   }
 
   // f can be called if it doesn't have an output that is consumed by a not yet produced buffer's producer.
@@ -281,7 +616,7 @@ public:
       }
     }
     // Use the output bounds, and the bounds expressions of the inputs, to determine the bounds required of the input.
-    for (const func::input& i : f->inputs()) {
+    for (const func::input& i : inputs_of(f)) {
       box_expr crop(i.buffer->rank());
       for (int d = 0; d < static_cast<int>(crop.size()); ++d) {
         // TODO (https://github.com/dsharlet/slinky/issues/21): We may have been given bounds on the input that are
@@ -329,7 +664,7 @@ public:
       // TODO: I think this check is technically OK, but it is sloppy and allows incorrect explicit schedules (e.g. if
       // i->store_at() was set, but we didn't find the storage location).
       if (at.root() || (i->store_at() && *i->store_at() == at)) {
-        body = allocate::make(i->sym(), i->storage(), i->elem_size(), i->dims(), body);
+        body = allocate::make(i->sym(), i->storage(), i->elem_size(), layout_dims(i), body);
         allocated.insert(i);
       }
     }
@@ -372,7 +707,7 @@ public:
   // - Wrapping f with the loops it wanted to be explicit
   // - Producing all the buffers that f consumes (recursively).
   stmt produce(const func* f, const loop_id& current_at = loop_id()) {
-    stmt result = f->make_call();
+    stmt result = make_call(f);
     result = add_input_crops(result, f);
     for (const func::output& i : f->outputs()) {
       produced.insert(i.buffer);
@@ -380,7 +715,12 @@ public:
         to_allocate.push_front(i.buffer);
       }
     }
-    for (const func::input& i : f->inputs()) {
+    auto chain = fused.find(f);
+    if (chain != fused.end()) {
+      // The intermediate buffers of a fused chain are produced (and allocated) by the fused call.
+      produced.insert(chain->second.intermediates.begin(), chain->second.intermediates.end());
+    }
+    for (const func::input& i : inputs_of(f)) {
       consumed.insert(i.buffer);
     }
 
@@ -413,12 +753,15 @@ void add_buffer_checks(const buffer_expr_ptr& b, bool output, std::vector<stmt>&
       checks.push_back(check::make(b->dim(d).extent() <= fold_factor));
     }
   }
+  for (const expr& i : b->constraints()) {
+    checks.push_back(check::make(i));
+  }
 }
 
 stmt build_pipeline(node_context& ctx, const std::vector<buffer_expr_ptr>& inputs,
     const std::vector<buffer_expr_ptr>& outputs, std::set<buffer_expr_ptr>& constants,
     const build_options& options) {
-  pipeline_builder builder(inputs, outputs, constants);
+  pipeline_builder builder(inputs, outputs, constants, options);
 
   stmt result;
 
@@ -445,7 +788,8 @@ stmt build_pipeline(node_context& ctx, const std::vector<buffer_expr_ptr>& input
   for (const buffer_expr_ptr& i : outputs) {
     add_buffer_checks(i, /*output=*/true, checks);
   }
-  result = block::make(block::make(checks), result);
+  checks.push_back(result);
+  result = block::make(std::move(checks));
 
   std::vector<symbol_id> input_syms;
   input_syms.reserve(inputs.size());
@@ -455,13 +799,14 @@ stmt build_pipeline(node_context& ctx, const std::vector<buffer_expr_ptr>& input
   for (const buffer_expr_ptr& i : constants) {
     input_syms.push_back(i->sym());
   }
-  result = infer_bounds(result, ctx, input_syms);
+  result = infer_bounds(result, ctx, input_syms, /*add_checks=*/!options.no_checks);
 
   result = fix_buffer_races(result);
 
   result = simplify(result);
 
   if (options.no_checks) {
+    // The constraints the user set are still assumed to be true, we just don't check them.
     class remove_checks : public node_mutator {
     public:
       void visit(const check* op) override { set_result(stmt()); }
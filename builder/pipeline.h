@@ -1,6 +1,11 @@
 #ifndef SLINKY_BUILDER_PIPELINE_H
 #define SLINKY_BUILDER_PIPELINE_H
 
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include "runtime/elementwise_program.h"
 #include "runtime/evaluate.h"
 #include "runtime/expr.h"
 #include "runtime/util.h"
@@ -33,6 +38,12 @@ class buffer_expr : public ref_counted {
   memory_type storage_ = memory_type::heap;
   std::optional<loop_id> store_at_;
 
+  std::vector<int> storage_order_;
+  index_t row_alignment_ = 1;
+  bool pad_strides_ = false;
+
+  std::vector<expr> constraints_;
+
   buffer_expr(symbol_id sym, index_t elem_size, std::size_t rank);
   buffer_expr(symbol_id sym, const raw_buffer* buffer);
   buffer_expr(const buffer_expr&) = delete;
@@ -81,6 +92,44 @@ public:
   }
   const std::optional<loop_id>& store_at() const { return store_at_; }
 
+  // These control the layout of the buffer, if it is allocated by the pipeline. The builder computes the strides of the
+  // dimensions (except those whose stride has been set explicitly) from the layout.
+  //
+  // The order in which the dimensions are stored in memory, innermost first. This must be a permutation of the
+  // dimensions. By default, dimension 0 is innermost.
+  buffer_expr& storage_order(std::vector<int> order);
+  const std::vector<int>& storage_order() const { return storage_order_; }
+  // The strides of all but the innermost dimension are a multiple of `alignment` bytes.
+  buffer_expr& align_rows(index_t alignment) {
+    assert(alignment >= 1);
+    row_alignment_ = alignment;
+    return *this;
+  }
+  index_t row_alignment() const { return row_alignment_; }
+  // If true, strides that are a multiple of `conflict_stride_bytes` are padded by the smallest multiple of the row
+  // alignment that is at least `cache_line_bytes` and not a multiple of `conflict_stride_bytes`. Rows with such strides
+  // map to only a few sets of the cache, and suffer from 4K aliasing. Rows aligned to a multiple of
+  // `conflict_stride_bytes` can't be padded.
+  buffer_expr& pad_strides(bool pad = true) {
+    pad_strides_ = pad;
+    return *this;
+  }
+  bool pad_strides() const { return pad_strides_; }
+
+  static constexpr index_t conflict_stride_bytes = 512;
+  static constexpr index_t cache_line_bytes = 64;
+
+  bool has_default_layout() const { return storage_order_.empty() && row_alignment_ == 1 && !pad_strides_; }
+
+  // Add a condition on the metadata of this buffer that is true whenever the pipeline is called, e.g.
+  // `dim(0).extent() % 16 == 0`. Like the bounds and strides of the dims, constraints are checked once on entry to the
+  // pipeline (unless `build_options::no_checks` is set), and the pipeline is simplified assuming they are true.
+  buffer_expr& constrain(expr condition) {
+    constraints_.push_back(std::move(condition));
+    return *this;
+  }
+  const std::vector<expr>& constraints() const { return constraints_; }
+
   const func* producer() const { return producer_; }
 
   const raw_buffer* constant() const { return constant_; }
@@ -101,7 +150,7 @@ public:
     buffer_expr_ptr buffer;
 
     // These intervals should be a function of the expressions found in the output dims.
-    std::vector<interval_expr> bounds;
+    box_expr bounds;
 
     symbol_id sym() const { return buffer->sym(); }
   };
@@ -248,6 +297,35 @@ public:
         {std::move(in1)}, {std::move(out1), std::move(out2)});
   }
 
+  // Make an elementwise func computing `e` at each point of `out`. Variables of `e` that are the symbols of `inputs`
+  // refer to the element of that input at the same point, other variables are scalars (e.g. pipeline arguments). All
+  // of the buffers must have elements of type `T`. The expression is evaluated by `elementwise_program`.
+  template <typename T>
+  static func make_elementwise(const expr& e, std::vector<buffer_expr_ptr> inputs, output out) {
+    box_expr bounds;
+    for (const var& i : out.dims) {
+      bounds.push_back(point(i));
+    }
+    std::vector<input> func_inputs;
+    std::vector<symbol_id> input_syms;
+    for (buffer_expr_ptr& i : inputs) {
+      input_syms.push_back(i->sym());
+      func_inputs.push_back({std::move(i), bounds});
+    }
+    auto program = std::make_shared<const elementwise_program<T>>(e, input_syms);
+    symbol_id out_sym = out.sym();
+    return func(
+        [=](eval_context& ctx) -> index_t {
+          small_vector<const raw_buffer*, 4> input_bufs;
+          for (symbol_id i : input_syms) {
+            input_bufs.push_back(ctx.lookup_buffer(i));
+          }
+          program->evaluate(ctx, input_bufs, *ctx.lookup_buffer(out_sym));
+          return 0;
+        },
+        std::move(func_inputs), {std::move(out)});
+  }
+
   static func make_copy(std::vector<input> in, output out) { return func(std::move(in), {std::move(out)}); }
   static func make_copy(input in, output out, std::vector<char> padding = {}) {
     return func(std::move(in), {std::move(out)}, std::move(padding));
@@ -267,6 +345,15 @@ public:
 struct build_options {
   // If true, removes bounds checks
   bool no_checks = false;
+
+  // If true, chains of elementwise funcs (funcs with one output, where every input is accessed at a point equal to the
+  // output dims) are fused into one call. Intermediate buffers consumed only by the next func in the chain are not
+  // allocated by the pipeline. Instead, the fused call runs each func in turn on sub-tiles of the output, using small
+  // intermediate buffers that can stay in the L1 cache.
+  bool fuse_elementwise = false;
+  // The target total size in bytes of the inputs, intermediates, and output of one sub-tile of a fused call. The
+  // intermediates of a sub-tile are allocated on the stack of the thread running the call.
+  index_t fused_tile_bytes = 32 * 1024;
 };
 
 // Constructs a body and a pipeline object for a graph described by input and output buffers.
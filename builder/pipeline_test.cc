@@ -1,10 +1,14 @@
 #include <gtest/gtest.h>
 
 #include <cassert>
+#include <memory>
+#include <thread>
 
 #include "runtime/pipeline.h"
 #include "runtime/expr.h"
+#include "runtime/print.h"
 #include "builder/pipeline.h"
+#include "builder/simplify.h"
 #include "runtime/thread_pool.h"
 
 using namespace slinky;
@@ -312,9 +316,7 @@ TEST(pipeline, matmuls) {
       c->dim(1).stride = c->elem_size();
       abc->dim(1).stride = abc->elem_size();
 
-      // TODO: There should be a more user friendly way to control the strides.
-      ab->dim(1).stride = static_cast<index_t>(sizeof(int));
-      ab->dim(0).stride = ab->dim(1).extent() * ab->dim(1).stride;
+      ab->storage_order({1, 0});
 
       if (split > 0) {
         matmul_abc.loops({{i, split, lm}});
@@ -392,6 +394,107 @@ index_t downsample2x(const buffer<const int>& in, const buffer<int>& out) {
   return 0;
 }
 
+index_t upsample2x(const buffer<const int>& in, const buffer<int>& out) {
+  for (index_t y = out.dim(1).begin(); y < out.dim(1).end(); ++y) {
+    for (index_t x = out.dim(0).begin(); x < out.dim(0).end(); ++x) {
+      out(x, y) = in((x + 0) >> 1, (y + 0) >> 1) + in((x + 1) >> 1, (y + 0) >> 1) + in((x + 0) >> 1, (y + 1) >> 1) +
+                  in((x + 1) >> 1, (y + 1) >> 1);
+    }
+  }
+  return 0;
+}
+
+TEST(pipeline, layout) {
+  for (int pad : {0, 1}) {
+    for (index_t alignment : {1, 32, 48}) {
+      // Make the pipeline
+      node_context ctx;
+
+      auto in = buffer_expr::make(ctx, "in", sizeof(short), 3);
+      auto out = buffer_expr::make(ctx, "out", sizeof(short), 3);
+      auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 3);
+
+      var x(ctx, "x");
+      var y(ctx, "y");
+      var c(ctx, "c");
+
+      // Store the intermediate with the channels innermost.
+      intm->storage_order({2, 0, 1}).align_rows(alignment).pad_strides(pad);
+
+      index_t intm_strides[3];
+      auto check_layout = [&](const buffer<const short>& in, const buffer<short>& out) -> index_t {
+        for (int d = 0; d < 3; ++d) {
+          intm_strides[d] = in.dim(d).stride();
+        }
+        return multiply_2<short>(in, out);
+      };
+
+      func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y), point(c)}}, {intm, {x, y, c}});
+      func mul = func::make<const short, short>(
+          std::move(check_layout), {intm, {point(x), point(y), point(c)}}, {out, {x, y, c}});
+
+      pipeline p = build_pipeline(ctx, {in}, {out});
+
+      // Run the pipeline
+      const int W = 128;
+      const int H = 10;
+      const int C = 3;
+
+      buffer<short, 3> in_buf({W, H, C});
+      init_random(in_buf);
+      buffer<short, 3> out_buf({W, H, C});
+      out_buf.allocate();
+
+      const raw_buffer* inputs[] = {&in_buf};
+      const raw_buffer* outputs[] = {&out_buf};
+      test_context eval_ctx;
+      p.evaluate(inputs, outputs, eval_ctx);
+
+      index_t stride_x = align_up<index_t>(C * sizeof(short), alignment);
+      index_t stride_y = stride_x * W;
+      // W * alignment is a multiple of 512 bytes when alignment is 32 or 48. The padding is the smallest multiple of
+      // the alignment that is at least a cache line.
+      if (pad && stride_y % buffer_expr::conflict_stride_bytes == 0) {
+        stride_y += align_up<index_t>(buffer_expr::cache_line_bytes, alignment);
+      }
+      ASSERT_EQ(intm_strides[2], sizeof(short));
+      ASSERT_EQ(intm_strides[0], stride_x);
+      ASSERT_EQ(intm_strides[1], stride_y);
+
+      for_each_index(out_buf, [&](auto i) { ASSERT_EQ(out_buf(i), 2 * (in_buf(i) + 1)); });
+    }
+  }
+}
+
+TEST(pipeline, invalid_pad_strides) {
+  node_context ctx;
+  auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  // Any padding that keeps the rows aligned to 1024 bytes leaves the stride a multiple of 512 bytes.
+  intm->align_rows(1024).pad_strides();
+
+  func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func mul = func::make<const short, short>(multiply_2<short>, {intm, {point(x), point(y)}}, {out, {x, y}});
+
+  EXPECT_DEATH(build_pipeline(ctx, {in}, {out}), "Cannot pad");
+}
+
+TEST(pipeline, invalid_storage_order) {
+  node_context ctx;
+  auto b = buffer_expr::make(ctx, "b", sizeof(short), 3);
+  EXPECT_DEATH(b->storage_order({0, 1}), "permutation");
+  EXPECT_DEATH(b->storage_order({0, 1, 1}), "permutation");
+  EXPECT_DEATH(b->storage_order({0, 1, 3}), "permutation");
+  EXPECT_DEATH(b->storage_order({0, -1, 2}), "permutation");
+  b->storage_order({2, 0, 1});
+  ASSERT_EQ(b->storage_order(), std::vector<int>({2, 0, 1}));
+}
+
 TEST(pipeline, pyramid) {
   // Make the pipeline
   node_context ctx;
@@ -432,6 +535,66 @@ TEST(pipeline, pyramid) {
   ASSERT_EQ(eval_ctx.heap.total_count, 1);
 }
 
+TEST(pipeline, upsample_chain) {
+  // Make the pipeline
+  node_context ctx;
+
+  auto in = buffer_expr::make(ctx, "in", sizeof(int), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(int), 2);
+
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(int), 2);
+  auto up = buffer_expr::make(ctx, "up", sizeof(int), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func add = func::make<const int, int>(add_1<int>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func upsample1 =
+      func::make<const int, int>(upsample2x, {intm, {bounds(x, x + 1) / 2, bounds(y, y + 1) / 2}}, {up, {x, y}});
+  func upsample2 =
+      func::make<const int, int>(upsample2x, {up, {bounds(x, x + 1) / 2, bounds(y, y + 1) / 2}}, {out, {x, y}});
+
+  upsample2.loops({{y, 1}});
+
+  pipeline p = build_pipeline(ctx, {in}, {out});
+
+  // Run the pipeline.
+  const int W = 20;
+  const int H = 20;
+  buffer<int, 2> in_buf({W / 4 + 1, H / 4 + 1});
+  buffer<int, 2> out_buf({W, H});
+
+  init_random(in_buf);
+  out_buf.allocate();
+
+  // Not having span(std::initializer_list<T>) is unfortunate.
+  const raw_buffer* inputs[] = {&in_buf};
+  const raw_buffer* outputs[] = {&out_buf};
+  test_context eval_ctx;
+  p.evaluate(inputs, outputs, eval_ctx);
+  // Both intermediates should be folded to the two rows needed at their own rate.
+  ASSERT_EQ(eval_ctx.heap.total_size, ((W / 2 + 1) * 2 + (W / 4 + 1) * 2) * sizeof(int));
+  ASSERT_EQ(eval_ctx.heap.total_count, 2);
+
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      int correct = 0;
+      for (int dy = 0; dy <= 1; ++dy) {
+        for (int dx = 0; dx <= 1; ++dx) {
+          const int ux = (x + dx) >> 1;
+          const int uy = (y + dy) >> 1;
+          for (int ddy = 0; ddy <= 1; ++ddy) {
+            for (int ddx = 0; ddx <= 1; ++ddx) {
+              correct += in_buf((ux + ddx) >> 1, (uy + ddy) >> 1) + 1;
+            }
+          }
+        }
+      }
+      ASSERT_EQ(correct, out_buf(x, y)) << x << " " << y;
+    }
+  }
+}
+
 TEST(pipeline, stencil) {
   for (int split : {0, 1, 2, 3}) {
     for (loop_mode lm : {loop_mode::serial, loop_mode::parallel}) {
@@ -495,6 +658,58 @@ TEST(pipeline, stencil) {
   }
 }
 
+// Finds the `crop_dim`s of a buffer in the body of a loop.
+class find_crops_in_loops : public recursive_node_visitor {
+  int loop_depth = 0;
+
+public:
+  symbol_id sym;
+  std::vector<interval_expr> crops;
+
+  find_crops_in_loops(symbol_id sym) : sym(sym) {}
+
+  void visit(const loop* op) override {
+    ++loop_depth;
+    recursive_node_visitor::visit(op);
+    --loop_depth;
+  }
+  void visit(const crop_dim* op) override {
+    if (loop_depth > 0 && op->sym == sym) crops.push_back(op->bounds);
+    recursive_node_visitor::visit(op);
+  }
+};
+
+TEST(pipeline, stencil_steady_state) {
+  for (int split : {1, 2, 3}) {
+    node_context ctx;
+
+    auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+    auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+    auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+
+    var x(ctx, "x");
+    var y(ctx, "y");
+
+    func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y)}}, {intm, {x, y}});
+    func stencil =
+        func::make<const short, short>(sum3x3<short>, {intm, {bounds(-1, 1) + x, bounds(-1, 1) + y}}, {out, {x, y}});
+    stencil.loops({{y, split}});
+
+    pipeline p = build_pipeline(ctx, {in}, {out});
+
+    // The warm up of the sliding window is peeled out of the loop, so each iteration of the loop produces a constant
+    // number of new rows of the intermediate, without selecting or clamping.
+    find_crops_in_loops crops(intm->sym());
+    p.body().accept(&crops);
+    ASSERT_FALSE(crops.crops.empty());
+    for (const interval_expr& i : crops.crops) {
+      expr extent = simplify(i.extent());
+      ASSERT_TRUE(as_constant(extent)) << extent;
+      ASSERT_EQ(*as_constant(extent), split);
+    }
+  }
+}
+
 TEST(pipeline, stencil_chain) {
   for (int split : {0, 1, 2}) {
     for (loop_mode lm : {loop_mode::serial, loop_mode::parallel}) {
@@ -1164,3 +1379,74 @@ TEST(pipeline, parallel_stencils) {
     }
   }
 }
+
+TEST(pipeline, concurrent_evaluate) {
+  // Make the pipeline
+  node_context ctx;
+
+  auto in = buffer_expr::make(ctx, "in", sizeof(short), 2);
+  auto out = buffer_expr::make(ctx, "out", sizeof(short), 2);
+
+  auto intm = buffer_expr::make(ctx, "intm", sizeof(short), 2);
+
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  func add = func::make<const short, short>(add_1<short>, {in, {point(x), point(y)}}, {intm, {x, y}});
+  func stencil =
+      func::make<const short, short>(sum3x3<short>, {intm, {bounds(-1, 1) + x, bounds(-1, 1) + y}}, {out, {x, y}});
+
+  stencil.loops({{y, 2}});
+
+  pipeline p = build_pipeline(ctx, {in}, {out});
+
+  const int W = 20;
+  const int H = 10;
+  buffer<short, 2> in_buf({W + 2, H + 2});
+  in_buf.translate(-1, -1);
+  init_random(in_buf);
+
+  // Evaluate the same pipeline on the same input from many threads at once.
+  const int thread_count = 8;
+  const int iterations = 20;
+  std::vector<std::unique_ptr<buffer<short, 2>>> out_bufs;
+  for (int t = 0; t < thread_count; ++t) {
+    out_bufs.push_back(std::make_unique<buffer<short, 2>>(std::initializer_list<index_t>{W, H}));
+    out_bufs.back()->allocate();
+  }
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < thread_count; ++t) {
+    workers.emplace_back([&, t]() {
+      const raw_buffer* inputs[] = {&in_buf};
+      const raw_buffer* outputs[] = {out_bufs[t].get()};
+      for (int i = 0; i < iterations; ++i) {
+        test_context eval_ctx;
+        p.evaluate(inputs, outputs, eval_ctx);
+      }
+    });
+  }
+  for (std::thread& i : workers) {
+    i.join();
+  }
+
+  // The input buffer should not have been modified.
+  ASSERT_EQ(in_buf.dim(0).min(), -1);
+  ASSERT_EQ(in_buf.dim(0).extent(), W + 2);
+  ASSERT_EQ(in_buf.dim(1).min(), -1);
+  ASSERT_EQ(in_buf.dim(1).extent(), H + 2);
+
+  for (const auto& out_buf : out_bufs) {
+    for (int y = 0; y < H; ++y) {
+      for (int x = 0; x < W; ++x) {
+        int correct = 0;
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            correct += in_buf(x + dx, y + dy) + 1;
+          }
+        }
+        ASSERT_EQ(correct, (*out_buf)(x, y)) << x << " " << y;
+      }
+    }
+  }
+}
@@ -3,10 +3,13 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <optional>
+#include <set>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -449,6 +452,7 @@ expr simplify(const add* op, expr a, expr b) {
       {x + (y - x), y},
       //{x + x * y, x * (y + 1)},  // Needs x to be non-constant or it loops with c0 * (x + c1) -> c0 * x + c0 * c1... how?
       {x * y + x * z, x * (y + z)},
+      {x * c0 + y * c1, (x - y) * c0, c0 + c1 == 0},
       {(x + y) + (x + z), x * 2 + (y + z)},
       {(x - y) + (x + z), x * 2 + (z - y)},
       {(y - x) + (x + z), y + z},
@@ -541,6 +545,8 @@ expr simplify(const sub* op, expr a, expr b) {
       {(x + c0) - (y + c1), (x - y) + (c0 - c1)},
 
       {(x + y) / c0 - x / c0, (y + (x % c0)) / c0, c0 > 0},
+      {(x + c0) / c2 - (x + c1) / c2, ((x + c1) % c2 + (c0 - c1)) / c2, c2 > 0},
+      {x / c2 - (x + c1) / c2, ((x + c1) % c2 - c1) / c2, c2 > 0},
 
       {min(x, y + z) - z, min(y, x - z)},
       {max(x, y + z) - z, max(y, x - z)},
@@ -696,6 +702,14 @@ expr simplify(const less* op, expr a, expr b) {
       {x - y < x - z, z < y},
       {x - y < z - y, x < z},
 
+      {(x + c0) / c2 < (x + c1) / c2, false, c1 <= c0 && 0 < c2},
+      {(x + c0) / c2 < (x + c1) / c2, true, c0 + c2 <= c1 && 0 < c2},
+      {x / c2 < (x + c1) / c2, false, c1 <= 0 && 0 < c2},
+      {x / c2 < (x + c1) / c2, true, c2 <= c1 && 0 < c2},
+      {(x + c0) / c2 < x / c2, false, 0 <= c0 && 0 < c2},
+      {x * c0 < y * c0, x < y, 0 < c0},
+      {x * c0 < y * c0 + c1, x <= y + (c1 - 1) / c0, 0 < c0},
+
       {min(x, y) < x, y < x},
       {min(x, min(y, z)) < y, min(x, z) < y},
       {max(x, y) < x, false},
@@ -744,8 +758,10 @@ expr simplify(const less_equal* op, expr a, expr b) {
       {x <= c1 - y, x + y <= c1},
       {x + c0 <= y + c1, x - y <= c1 - c0},
 
-      {(x + c0) / c1 <= x / c1, c0 <= 0},
-      {x / c1 <= (x + c0) / c1, 0 <= c0},
+      {(x + c0) / c1 <= x / c1, true, c0 <= 0 && 0 < c1},
+      {(x + c0) / c1 <= x / c1, false, c1 <= c0 && 0 < c1},
+      {x / c1 <= (x + c0) / c1, true, 0 <= c0 && 0 < c1},
+      {x / c1 <= (x + c0) / c1, false, c0 + c1 <= 0 && 0 < c1},
 
       {x <= x + y, 0 <= y},
       {x + y <= x, y <= 0},
@@ -755,6 +771,11 @@ expr simplify(const less_equal* op, expr a, expr b) {
       {x - y <= x - z, z <= y},
       {x - y <= z - y, x <= z},
 
+      {(x + c0) / c2 <= (x + c1) / c2, true, c0 <= c1 && 0 < c2},
+      {(x + c0) / c2 <= (x + c1) / c2, false, c1 + c2 <= c0 && 0 < c2},
+      {x * c0 <= y * c0, x <= y, 0 < c0},
+      {x * c0 <= y * c0 + c1, x <= y + c1 / c0, 0 < c0},
+
       {min(x, y) <= x, true},
       {min(x, min(y, z)) <= y, true},
       {max(x, y) <= x, y <= x},
@@ -937,7 +958,7 @@ expr simplify(const select_expr* op, expr c, expr t, expr f) {
   return rules.apply(e);
 }
 
-expr simplify(const call* op, std::vector<expr> args) {
+expr simplify(const call* op, small_vector<expr, 4> args) {
   bool constant = true;
   bool changed = false;
   assert(op->args.size() == args.size());
@@ -987,12 +1008,188 @@ expr simplify(const call* op, std::vector<expr> args) {
 
 namespace {
 
+// Returns the union of the crop `bounds` over all the iterations of the loop `op`, or std::nullopt if the crops of
+// consecutive iterations might not be contiguous.
+std::optional<interval_expr> coarsen_crop(const loop* op, const interval_expr& bounds) {
+  if (!depends_on(bounds, op->sym)) return bounds;
+  if (!bounds.min.defined() || !bounds.max.defined()) return std::nullopt;
+
+  // Find the bounds of the crop on the next iteration.
+  interval_expr next_iter = {
+      substitute(bounds.min, op->sym, var(op->sym) + op->step),
+      substitute(bounds.max, op->sym, var(op->sym) + op->step),
+  };
+  if (!prove_true(bounds.max + 1 >= next_iter.min || next_iter.max + 1 >= bounds.min)) {
+    return std::nullopt;
+  }
+  return interval_expr{
+      substitute(bounds.min, op->sym, op->bounds.min),
+      substitute(bounds.max, op->sym, op->bounds.max),
+  };
+}
+
+// Returns true if the boxes `a` and `b` are disjoint in some dimension.
+bool is_disjoint(const box_expr& a, const box_expr& b) {
+  for (std::size_t d = 0; d < std::min(a.size(), b.size()); ++d) {
+    const interval_expr& a_d = a[d];
+    const interval_expr& b_d = b[d];
+    if (!a_d.min.defined() || !a_d.max.defined() || !b_d.min.defined() || !b_d.max.defined()) continue;
+    if (prove_true(a_d.max < b_d.min || b_d.max < a_d.min)) return true;
+  }
+  return false;
+}
+
+stmt coarsen_loop_of_copies(const loop* op, const block* b);
+
+// Attempts to rewrite `body`, the body of the serial loop `op`, to run once on the union of the crops covered by the
+// loop. Returns an undefined stmt if this is not possible. If the innermost stmt is a copy, `copy` and `copy_dst_crops`
+// receive the copy and the bounds of the crops of its destination.
+stmt coarsen_loop_body(
+    const loop* op, const stmt& body, const copy_stmt** copy = nullptr, box_expr* copy_dst_crops = nullptr) {
+  stmt result = body;
+  std::vector<std::tuple<symbol_id, int, interval_expr>> crops;
+  // The dimensions of each buffer that are cropped to bounds that move with the loop. If more than one dimension of a
+  // buffer moves with the loop (in one crop or several), the union of the crops is not a box.
+  std::map<symbol_id, std::set<int>> loop_dims;
+  auto add_loop_dim = [&](symbol_id sym, int dim, const interval_expr& bounds) {
+    if (!depends_on(bounds, op->sym)) return true;
+    std::set<int>& dims = loop_dims[sym];
+    dims.insert(dim);
+    return dims.size() <= 1;
+  };
+  // The stmts (crops or lets) to wrap around the coarsened body, outermost first.
+  std::vector<std::function<stmt(stmt)>> wrappers;
+  while (true) {
+    if (const crop_dim* crop = result.as<crop_dim>()) {
+      std::optional<interval_expr> new_crop = coarsen_crop(op, crop->bounds);
+      if (!new_crop) return stmt();
+      if (!add_loop_dim(crop->sym, crop->dim, crop->bounds)) return stmt();
+      crops.emplace_back(crop->sym, crop->dim, *new_crop);
+      // `crop` may be freed when we replace `result`, so capture what we need by value.
+      wrappers.push_back([sym = crop->sym, dim = crop->dim, new_crop = *new_crop](stmt body) {
+        return crop_dim::make(sym, dim, new_crop, std::move(body));
+      });
+      result = crop->body;
+    } else if (const crop_buffer* crop = result.as<crop_buffer>()) {
+      box_expr new_crop(crop->bounds.size());
+      for (std::size_t d = 0; d < crop->bounds.size(); ++d) {
+        std::optional<interval_expr> new_crop_d = coarsen_crop(op, crop->bounds[d]);
+        if (!new_crop_d) return stmt();
+        if (!add_loop_dim(crop->sym, d, crop->bounds[d])) return stmt();
+        new_crop[d] = *new_crop_d;
+        crops.emplace_back(crop->sym, d, *new_crop_d);
+      }
+      wrappers.push_back([sym = crop->sym, new_crop = std::move(new_crop)](stmt body) {
+        return crop_buffer::make(sym, new_crop, std::move(body));
+      });
+      result = crop->body;
+    } else if (const let_stmt* l = result.as<let_stmt>()) {
+      if (depends_on(l->value, op->sym)) {
+        // The value of this let changes with each iteration, substitute it into the body instead.
+        result = substitute(l->body, l->sym, l->value);
+      } else {
+        wrappers.push_back(
+            [sym = l->sym, value = l->value](stmt body) { return let_stmt::make(sym, value, std::move(body)); });
+        result = l->body;
+      }
+    } else if (const block* b = result.as<block>()) {
+      result = coarsen_loop_of_copies(op, b);
+      if (!result.defined()) return stmt();
+      break;
+    } else if (const copy_stmt* c = result.as<copy_stmt>()) {
+      // The copy's src_x can refer to the loop variable, unless it is shadowed by one of the dst_x.
+      if (std::find(c->dst_x.begin(), c->dst_x.end(), op->sym) == c->dst_x.end()) {
+        for (const expr& i : c->src_x) {
+          if (depends_on(i, op->sym)) return stmt();
+        }
+      }
+      if (copy) *copy = c;
+      if (copy_dst_crops) {
+        for (const auto& i : crops) {
+          if (std::get<0>(i) != c->dst) continue;
+          std::size_t d = std::get<1>(i);
+          if (copy_dst_crops->size() <= d) copy_dst_crops->resize(d + 1);
+          (*copy_dst_crops)[d] = std::get<2>(i);
+        }
+      }
+      break;
+    } else if (result.as<call_stmt>()) {
+      break;
+    } else {
+      return stmt();
+    }
+  }
+  for (auto i = wrappers.rbegin(); i != wrappers.rend(); ++i) {
+    result = (*i)(std::move(result));
+  }
+  return result;
+}
+
+// A block of copies to the same buffer (e.g. a concatenation) can be coarsened if each copy can be coarsened. The
+// copies will run in a different order, so they must write disjoint regions of the destination.
+stmt coarsen_loop_of_copies(const loop* op, const block* b) {
+  std::vector<stmt> result;
+  std::vector<box_expr> dst_crops;
+  symbol_id dst = 0;
+  for (const stmt& i : b->stmts) {
+    const copy_stmt* copy = nullptr;
+    box_expr copy_dst_crops;
+    stmt coarsened = coarsen_loop_body(op, i, &copy, &copy_dst_crops);
+    if (!coarsened.defined() || !copy) return stmt();
+    if (copy->src == copy->dst || (!result.empty() && copy->dst != dst)) return stmt();
+    for (const box_expr& j : dst_crops) {
+      if (!is_disjoint(j, copy_dst_crops)) return stmt();
+    }
+    dst = copy->dst;
+    dst_crops.push_back(std::move(copy_dst_crops));
+    result.push_back(std::move(coarsened));
+  }
+  return block::make(std::move(result));
+}
+
+// Returns true if the buffer intrinsic `c` has the same value in a crop of its buffer, where `cropped(d)` indicates if
+// dimension `d` is cropped.
+template <typename Fn>
+bool unchanged_by_crop(const call* c, Fn cropped) {
+  switch (c->intrinsic) {
+  case intrinsic::buffer_rank:
+  case intrinsic::buffer_elem_size:
+  case intrinsic::buffer_stride:
+  case intrinsic::buffer_fold_factor: return true;
+  case intrinsic::buffer_min:
+  case intrinsic::buffer_max:
+  case intrinsic::buffer_extent: {
+    const index_t* d = c->args.size() > 1 ? as_constant(c->args[1]) : nullptr;
+    return d && !cropped(*d);
+  }
+  default: return false;
+  }
+}
+
+// Returns true if the buffer intrinsic `c` has the same value in a slice of its buffer, where `first` is the first
+// dimension removed by the slice.
+bool unchanged_by_slice(const call* c, index_t first) {
+  switch (c->intrinsic) {
+  case intrinsic::buffer_elem_size: return true;
+  case intrinsic::buffer_min:
+  case intrinsic::buffer_max:
+  case intrinsic::buffer_extent:
+  case intrinsic::buffer_stride:
+  case intrinsic::buffer_fold_factor: {
+    const index_t* d = c->args.size() > 1 ? as_constant(c->args[1]) : nullptr;
+    return d && 0 <= *d && *d < first;
+  }
+  default: return false;
+  }
+}
+
 // This is based on the simplifier in Halide: https://github.com/halide/Halide/blob/main/src/Simplify_Internal.h
 class simplifier : public node_mutator {
   symbol_map<int> references;
   symbol_map<box_expr> buffer_bounds;
   symbol_map<bool> bounds_used;
   bounds_map expr_bounds;
+  fact_set facts;
 
   interval_expr result_bounds;
 
@@ -1077,13 +1274,30 @@ public:
     }
   }
 
+  // Sets the result to `x`, with `bounds` tightened by the facts known about `x`.
+  void set_result_with_facts(expr x, interval_expr bounds) {
+    interval_expr known = facts.bounds_of(x);
+    if (known.min.defined() && known.max.defined() && as_constant(known.min) && match(known.min, known.max)) {
+      set_result(known.min, point(known.min));
+      return;
+    }
+    if (known.min.defined()) {
+      bounds.min = match(bounds.min, x) ? known.min : simplify(max(bounds.min, known.min));
+    }
+    if (known.max.defined()) {
+      bounds.max = match(bounds.max, x) ? known.max : simplify(min(bounds.max, known.max));
+    }
+    set_result(std::move(x), std::move(bounds));
+  }
+
   void visit(const variable* op) override {
     visit_symbol(op->sym);
     std::optional<interval_expr> bounds = expr_bounds[op->sym];
-    if (bounds) {
-      set_result(op, std::move(*bounds));
+    interval_expr op_bounds = bounds ? std::move(*bounds) : point(op);
+    if (!facts.empty()) {
+      set_result_with_facts(op, std::move(op_bounds));
     } else {
-      set_result(op, {op, op});
+      set_result(op, std::move(op_bounds));
     }
   }
 
@@ -1172,7 +1386,22 @@ public:
 
   void visit(const mul* op) override { visit_binary(op); }
   void visit(const div* op) override { visit_binary(op); }
-  void visit(const mod* op) override { visit_binary(op); }
+  void visit(const mod* op) override {
+    interval_expr a_bounds;
+    expr a = mutate(op->a, &a_bounds);
+    interval_expr b_bounds;
+    expr b = mutate(op->b, &b_bounds);
+
+    expr result = simplify(op, std::move(a), std::move(b));
+    if (!result.same_as(op)) {
+      mutate_and_set_result(result);
+    } else if (!facts.empty()) {
+      // We might know something like `buffer_extent(b, 0) % 16 == 0`.
+      set_result_with_facts(result, bounds_of(op, std::move(a_bounds), std::move(b_bounds)));
+    } else {
+      set_result(result, bounds_of(op, std::move(a_bounds), std::move(b_bounds)));
+    }
+  }
   void visit(const less* op) override { visit_binary(op); }
   void visit(const less_equal* op) override { visit_binary(op); }
   void visit(const equal* op) override { visit_binary(op); }
@@ -1222,8 +1451,8 @@ public:
   }
 
   void visit(const call* op) override {
-    std::vector<expr> args;
-    std::vector<interval_expr> args_bounds;
+    small_vector<expr, 4> args;
+    box_expr args_bounds;
     args.reserve(op->args.size());
     args_bounds.reserve(op->args.size());
     for (const expr& i : op->args) {
@@ -1234,7 +1463,11 @@ public:
 
     expr e = simplify(op, std::move(args));
     if (e.same_as(op)) {
-      set_result(e, bounds_of(op, std::move(args_bounds)));
+      if (!facts.empty() && is_buffer_intrinsic(op->intrinsic)) {
+        set_result_with_facts(e, bounds_of(op, std::move(args_bounds)));
+      } else {
+        set_result(e, bounds_of(op, std::move(args_bounds)));
+      }
     } else {
       mutate_and_set_result(e);
     }
@@ -1245,6 +1478,7 @@ public:
     expr value = mutate(op->value, &value_bounds);
 
     auto set_bounds = set_value_in_scope(expr_bounds, op->sym, value_bounds);
+    fact_set::scope body_facts(facts, op->sym);
     auto ref_count = set_value_in_scope(references, op->sym, 0);
     interval_expr body_bounds;
     expr body = mutate(op->body, &body_bounds);
@@ -1267,6 +1501,7 @@ public:
     expr value = mutate(op->value, &value_bounds);
 
     auto set_bounds = set_value_in_scope(expr_bounds, op->sym, value_bounds);
+    fact_set::scope body_facts(facts, op->sym);
     auto ref_count = set_value_in_scope(references, op->sym, 0);
     stmt body = mutate(op->body);
     if (!body.defined()) {
@@ -1304,6 +1539,7 @@ public:
     }
 
     auto set_bounds = set_value_in_scope(expr_bounds, op->sym, bounds);
+    fact_set::scope body_facts(facts, op->sym);
     stmt body = mutate(op->body);
     if (!body.defined()) {
       set_result(stmt());
@@ -1314,45 +1550,9 @@ public:
       // Due to either scheduling or other simplifications, we can end up with a loop that runs a single call or copy on
       // contiguous crops of a buffer. In these cases, we can drop the loop in favor of just calling the body on the
       // union of the bounds covered by the loop.
-      stmt result = body;
-      std::vector<std::tuple<symbol_id, int, interval_expr>> new_crops;
-      bool drop_loop = true;
-      while (true) {
-        // For now, we only handle crop_dim. I don't think crop_buffer can ever yield this simplification?
-        if (const crop_dim* crop = result.as<crop_dim>()) {
-          // Find the bounds of the crop on the next iteration.
-          interval_expr next_iter = {
-              substitute(crop->bounds.min, op->sym, var(op->sym) + op->step),
-              substitute(crop->bounds.max, op->sym, var(op->sym) + op->step),
-          };
-          if (prove_true(crop->bounds.max + 1 >= next_iter.min || next_iter.max + 1 >= crop->bounds.min)) {
-            result = crop->body;
-            interval_expr new_crop = {
-                substitute(crop->bounds.min, op->sym, op->bounds.min),
-                substitute(crop->bounds.max, op->sym, op->bounds.max),
-            };
-            new_crops.emplace_back(crop->sym, crop->dim, new_crop);
-          } else {
-            // This crop was not contiguous, we can't drop the loop.
-            drop_loop = false;
-            break;
-          }
-        } else if (result.as<call_stmt>() || result.as<copy_stmt>()) {
-          // We've found the actual body of the loop.
-          break;
-        } else {
-          // TODO: We might be able to handle other cases too, like blocks of copies all to the same buffer (a
-          // concatenate?).
-          drop_loop = false;
-          break;
-        }
-      }
-      if (drop_loop) {
-        // Rewrite the crops to cover the whole loop, and drop the loop.
-        for (auto i = new_crops.rbegin(); i != new_crops.rend(); ++i) {
-          result = crop_dim::make(std::get<0>(*i), std::get<1>(*i), std::get<2>(*i), result);
-        }
-        set_result(std::move(result));
+      stmt result = coarsen_loop_body(op, body);
+      if (result.defined()) {
+        set_result(mutate(result));
         return;
       }
     }
@@ -1375,8 +1575,17 @@ public:
       return;
     }
 
-    stmt t = mutate(op->true_body);
-    stmt f = mutate(op->false_body);
+    stmt t, f;
+    {
+      fact_set::scope true_facts(facts);
+      facts.learn(c);
+      t = mutate(op->true_body);
+    }
+    {
+      fact_set::scope false_facts(facts);
+      facts.learn(simplify(!c));
+      f = mutate(op->false_body);
+    }
 
     if (const logical_not* n = c.as<logical_not>()) {
       c = n->a;
@@ -1395,29 +1604,53 @@ public:
   }
 
   void visit(const block* op) override {
-    stmt a = mutate(op->a);
-    stmt b = mutate(op->b);
-
-    const if_then_else* a_if = a.as<if_then_else>();
-    const if_then_else* b_if = b.as<if_then_else>();
+    // The checks in this block are facts for the rest of the block.
+    fact_set::scope block_facts(facts);
+    std::vector<stmt> stmts;
+    stmts.reserve(op->stmts.size());
+    bool changed = false;
+    for (const stmt& i : op->stmts) {
+      stmt s = mutate(i);
+      changed = changed || !s.same_as(i);
+      if (!s.defined()) continue;
+      if (const check* c = s.as<check>()) {
+        facts.learn(c->condition);
+      }
 
-    if (a_if && b_if && match(a_if->condition, b_if->condition)) {
-      stmt true_body = mutate(block::make({a_if->true_body, b_if->true_body}));
-      stmt false_body = mutate(block::make({a_if->false_body, b_if->false_body}));
-      set_result(if_then_else::make(a_if->condition, true_body, false_body));
-    } else if (!a.defined() && !b.defined()) {
-      set_result(stmt());
-    } else if (!a.defined()) {
-      set_result(b);
-    } else if (!b.defined()) {
-      set_result(a);
-    } else if (a.same_as(op->a) && b.same_as(op->b)) {
+      const if_then_else* a_if = !stmts.empty() ? stmts.back().as<if_then_else>() : nullptr;
+      const if_then_else* b_if = s.as<if_then_else>();
+      if (a_if && b_if && match(a_if->condition, b_if->condition)) {
+        // Merge consecutive ifs with the same condition.
+        stmt true_body = mutate(block::make({a_if->true_body, b_if->true_body}));
+        stmt false_body = mutate(block::make({a_if->false_body, b_if->false_body}));
+        stmts.back() = if_then_else::make(a_if->condition, true_body, false_body);
+      } else {
+        stmts.push_back(std::move(s));
+      }
+    }
+    if (!changed && stmts.size() == op->stmts.size()) {
       set_result(op);
     } else {
-      set_result(block::make(std::move(a), std::move(b)));
+      set_result(block::make(std::move(stmts)));
     }
   }
 
+  // Make a block of `make_op(s)` for each stmt s in `b`, and simplify it.
+  template <typename Fn>
+  stmt mutate_each(const block* b, Fn&& make_op) {
+    std::vector<stmt> stmts;
+    stmts.reserve(b->stmts.size());
+    for (const stmt& i : b->stmts) {
+      stmts.push_back(mutate(make_op(i)));
+    }
+    return block::make(std::move(stmts));
+  }
+
+  void visit(const clone_buffer* op) override {
+    fact_set::scope body_facts(facts, op->sym);
+    node_mutator::visit(op);
+  }
+
   void visit(const call_stmt* op) override {
     for (symbol_id i : op->inputs) {
       visit_symbol(i, /*bounds_used=*/false);
@@ -1435,7 +1668,7 @@ public:
   }
 
   void visit(const allocate* op) override {
-    std::vector<dim_expr> dims;
+    small_vector<dim_expr, 4> dims;
     box_expr bounds;
     dims.reserve(op->dims.size());
     stmt body = op->body;
@@ -1453,6 +1686,7 @@ public:
       bounds.push_back(std::move(bounds_d));
     }
     auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, std::move(bounds));
+    fact_set::scope body_facts(facts, op->sym);
     body = mutate(body);
     if (!body.defined()) {
       set_result(stmt());
@@ -1466,7 +1700,7 @@ public:
   void visit(const make_buffer* op) override {
     expr base = mutate(op->base);
     expr elem_size = mutate(op->elem_size);
-    std::vector<dim_expr> dims;
+    small_vector<dim_expr, 4> dims;
     box_expr bounds;
     dims.reserve(op->dims.size());
     bounds.reserve(op->dims.size());
@@ -1486,6 +1720,7 @@ public:
     }
 
     auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, std::move(bounds));
+    fact_set::scope body_facts(facts, op->sym);
     body = mutate(body);
     if (!body.defined()) {
       set_result(stmt());
@@ -1543,7 +1778,7 @@ public:
           }
         }
         if (is_slice && slice_rank == dims.size()) {
-          std::vector<expr> at(bc->args.begin() + 1, bc->args.end());
+          small_vector<expr, 4> at(bc->args.begin() + 1, bc->args.end());
           set_result(slice_buffer::make(op->sym, std::move(at), std::move(body)));
           return;
         }
@@ -1633,6 +1868,12 @@ public:
     {
       auto set_bounds_used = set_value_in_scope(bounds_used, op->sym, false);
       auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
+      fact_set::scope body_facts(facts, op->sym, [op](const call* c) {
+        return unchanged_by_crop(c, [op](index_t d) {
+          return d < static_cast<index_t>(op->bounds.size()) &&
+                 (op->bounds[d].min.defined() || op->bounds[d].max.defined());
+        });
+      });
       for (index_t d = 0; d < static_cast<index_t>(new_bounds.size()); ++d) {
         if (new_bounds[d].min.defined() || new_bounds[d].max.defined()) {
           body = substitute_bounds(body, op->sym, d, new_bounds[d]);
@@ -1653,8 +1894,7 @@ public:
       // This crop was a no-op.
       set_result(std::move(body));
     } else if (const block* b = body.as<block>()) {
-      set_result(block::make(
-          mutate(crop_buffer::make(op->sym, new_bounds, b->a)), mutate(crop_buffer::make(op->sym, new_bounds, b->b))));
+      set_result(mutate_each(b, [&](const stmt& s) { return crop_buffer::make(op->sym, new_bounds, s); }));
     } else if (dims_count == 1) {
       // This crop is of one dimension, replace it with crop_dim.
       // We removed undefined trailing bounds, so this must be the dim we want.
@@ -1667,9 +1907,25 @@ public:
     }
   }
 
+  // Returns true if `s` only writes to the buffer `sym`.
+  static bool only_writes(const stmt& s, symbol_id sym) {
+    if (const call_stmt* c = s.as<call_stmt>()) {
+      return c->outputs.size() == 1 && c->outputs[0] == sym;
+    } else if (const copy_stmt* c = s.as<copy_stmt>()) {
+      return c->dst == sym;
+    }
+    return false;
+  }
+
   void visit(const crop_dim* op) override {
     interval_expr bounds = simplify_crop_bounds(mutate(op->bounds), op->sym, op->dim);
     expr sym_var = variable::make(op->sym);
+    if (only_writes(op->body, op->sym) &&
+        prove_true(bounds.max < buffer_min(sym_var, op->dim) || bounds.min > buffer_max(sym_var, op->dim))) {
+      // The crop is empty, and the body does nothing else.
+      set_result(stmt());
+      return;
+    }
     if (prove_true(bounds.min <= buffer_min(sym_var, op->dim))) bounds.min = expr();
     if (prove_true(bounds.max >= buffer_max(sym_var, op->dim))) bounds.max = expr();
     if (!bounds.min.defined() && !bounds.max.defined()) {
@@ -1696,6 +1952,8 @@ public:
     {
       auto set_bounds_used = set_value_in_scope(bounds_used, op->sym, false);
       auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, buf_bounds);
+      fact_set::scope body_facts(facts, op->sym,
+          [op](const call* c) { return unchanged_by_crop(c, [op](index_t d) { return d == op->dim; }); });
       body = substitute_bounds(op->body, op->sym, op->dim, bounds);
       body = mutate(body);
       if (!body.defined() || !*bounds_used[op->sym]) {
@@ -1726,8 +1984,7 @@ public:
     }
 
     if (const block* b = body.as<block>()) {
-      set_result(block::make(mutate(crop_dim::make(op->sym, op->dim, bounds, b->a)),
-          mutate(crop_dim::make(op->sym, op->dim, bounds, b->b))));
+      set_result(mutate_each(b, [&](const stmt& s) { return crop_dim::make(op->sym, op->dim, bounds, s); }));
     } else if (bounds.same_as(op->bounds) && body.same_as(op->body)) {
       set_result(op);
     } else {
@@ -1738,7 +1995,7 @@ public:
   void visit(const slice_buffer* op) override {
     // Update the bounds for the slice. Sliced dimensions are removed from the bounds.
     std::optional<box_expr> bounds = buffer_bounds[op->sym];
-    std::vector<expr> at(op->at.size());
+    small_vector<expr, 4> at(op->at.size());
     std::size_t dims_count = 0;
     bool changed = false;
     for (index_t i = 0; i < static_cast<index_t>(op->at.size()); ++i) {
@@ -1760,6 +2017,11 @@ public:
 
     {
       auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
+      index_t first = 0;
+      while (first < static_cast<index_t>(op->at.size()) && !op->at[first].defined()) {
+        ++first;
+      }
+      fact_set::scope body_facts(facts, op->sym, [first](const call* c) { return unchanged_by_slice(c, first); });
       body = mutate(body);
     }
     if (!body.defined()) {
@@ -1776,8 +2038,7 @@ public:
       // This slice was a no-op.
       set_result(std::move(body));
     } else if (const block* b = body.as<block>()) {
-      set_result(
-          block::make(mutate(slice_buffer::make(op->sym, at, b->a)), mutate(slice_buffer::make(op->sym, at, b->b))));
+      set_result(mutate_each(b, [&](const stmt& s) { return slice_buffer::make(op->sym, at, s); }));
     } else if (dims_count == 1) {
       // This slice is of one dimension, replace it with slice_dim.
       // We removed undefined trailing bounds, so this must be the dim we want.
@@ -1804,13 +2065,13 @@ public:
 
     {
       auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
+      fact_set::scope body_facts(facts, op->sym, [op](const call* c) { return unchanged_by_slice(c, op->dim); });
       body = mutate(body);
     }
     if (!body.defined()) {
       set_result(stmt());
     } else if (const block* b = body.as<block>()) {
-      set_result(block::make(
-          mutate(slice_dim::make(op->sym, op->dim, at, b->a)), mutate(slice_dim::make(op->sym, op->dim, at, b->b))));
+      set_result(mutate_each(b, [&](const stmt& s) { return slice_dim::make(op->sym, op->dim, at, s); }));
     } else if (at.same_as(op->at) && body.same_as(op->body)) {
       set_result(op);
     } else {
@@ -1835,13 +2096,13 @@ public:
     stmt body;
     {
       auto set_bounds = set_value_in_scope(buffer_bounds, op->sym, bounds);
+      fact_set::scope body_facts(facts, op->sym, [op](const call* c) { return unchanged_by_slice(c, op->rank); });
       body = mutate(op->body);
     }
     if (!body.defined()) {
       set_result(stmt());
     } else if (const block* b = body.as<block>()) {
-      set_result(block::make(
-          mutate(truncate_rank::make(op->sym, op->rank, b->a)), mutate(truncate_rank::make(op->sym, op->rank, b->b))));
+      set_result(mutate_each(b, [&](const stmt& s) { return truncate_rank::make(op->sym, op->rank, s); }));
     } else if (body.same_as(op->body)) {
       set_result(op);
     } else {
@@ -1872,6 +2133,134 @@ public:
 
 }  // namespace
 
+namespace {
+
+// We learn facts about variables, buffer metadata, and the remainder of these modulo a constant. This returns the
+// symbol of the variable or buffer, which indexes the facts.
+std::optional<symbol_id> fact_symbol(const expr& x) {
+  if (const mod* m = x.as<mod>()) return as_constant(m->b) ? fact_symbol(m->a) : std::nullopt;
+  if (const variable* v = x.as<variable>()) return v->sym;
+  const call* c = x.as<call>();
+  if (c && is_buffer_intrinsic(c->intrinsic) && !c->args.empty()) {
+    if (const variable* buf = c->args[0].as<variable>()) return buf->sym;
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+void fact_set::learn_bounds(const expr& x, interval_expr bounds) {
+  std::optional<symbol_id> sym = fact_symbol(x);
+  if (!sym) return;
+  std::optional<std::vector<std::pair<expr, interval_expr>>>& facts = bounds_[*sym];
+  if (!facts) facts.emplace();
+  facts->emplace_back(x, std::move(bounds));
+  learned_.push_back(*sym);
+}
+
+void fact_set::learn(const expr& condition) {
+  if (const logical_and* a = condition.as<logical_and>()) {
+    learn(a->a);
+    learn(a->b);
+  } else if (const equal* e = condition.as<equal>()) {
+    learn_bounds(e->a, point(e->b));
+    learn_bounds(e->b, point(e->a));
+  } else if (const less* l = condition.as<less>()) {
+    learn_bounds(l->a, {expr(), simplify(l->b - 1)});
+    learn_bounds(l->b, {simplify(l->a + 1), expr()});
+  } else if (const less_equal* l = condition.as<less_equal>()) {
+    learn_bounds(l->a, {expr(), l->b});
+    learn_bounds(l->b, {l->a, expr()});
+  }
+}
+
+namespace {
+
+// Finds uses of `sym`, except the buffer intrinsic calls of `sym` for which `unchanged` returns true.
+class find_changed_uses : public recursive_node_visitor {
+  symbol_id sym;
+  const std::function<bool(const call*)>& unchanged;
+
+public:
+  bool found = false;
+
+  find_changed_uses(symbol_id sym, const std::function<bool(const call*)>& unchanged)
+      : sym(sym), unchanged(unchanged) {}
+
+  void visit(const variable* op) override { found = found || op->sym == sym; }
+  void visit(const call* op) override {
+    if (is_buffer_intrinsic(op->intrinsic) && !op->args.empty() && is_variable(op->args[0], sym) && unchanged(op)) {
+      for (std::size_t i = 1; i < op->args.size(); ++i) {
+        if (op->args[i].defined()) op->args[i].accept(this);
+      }
+    } else {
+      recursive_node_visitor::visit(op);
+    }
+  }
+
+  bool operator()(const expr& e) {
+    found = false;
+    if (e.defined()) e.accept(this);
+    return found;
+  }
+};
+
+}  // namespace
+
+fact_set::scope::scope(fact_set& facts, symbol_id sym) : scope(facts, sym, [](const call*) { return false; }) {}
+
+fact_set::scope::scope(fact_set& facts, symbol_id sym, const std::function<bool(const call*)>& unchanged)
+    : facts_(facts), size_(facts.learned_.size()) {
+  find_changed_uses changed(sym, unchanged);
+  for (symbol_id s = 0; s < facts_.bounds_.size(); ++s) {
+    std::optional<std::vector<std::pair<expr, interval_expr>>>& bounds = facts_.bounds_[s];
+    if (!bounds) continue;
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < bounds->size(); ++i) {
+      std::pair<expr, interval_expr>& fact = (*bounds)[i];
+      if (changed(fact.first) || changed(fact.second.min) || changed(fact.second.max)) {
+        forgotten_.push_back({s, i, std::move(fact)});
+      } else {
+        if (kept != i) (*bounds)[kept] = std::move(fact);
+        ++kept;
+      }
+    }
+    bounds->resize(kept);
+  }
+  facts_.hidden_ += forgotten_.size();
+}
+
+fact_set::scope::~scope() {
+  // The facts learned in this scope are at the end of their symbol's facts.
+  while (facts_.learned_.size() > size_) {
+    facts_.bounds_[facts_.learned_.back()]->pop_back();
+    facts_.learned_.pop_back();
+  }
+  // Put the forgotten facts back where they were, so enclosing scopes find the facts they expect.
+  for (forgotten_fact& i : forgotten_) {
+    std::vector<std::pair<expr, interval_expr>>& bounds = *facts_.bounds_[i.sym];
+    bounds.insert(bounds.begin() + i.index, std::move(i.fact));
+  }
+  facts_.hidden_ -= forgotten_.size();
+}
+
+interval_expr fact_set::bounds_of(const expr& x) const {
+  interval_expr result;
+  std::optional<symbol_id> sym = fact_symbol(x);
+  if (!sym) return result;
+  static const std::vector<std::pair<expr, interval_expr>> no_facts;
+  for (const auto& i : bounds_.lookup(*sym, no_facts)) {
+    if (!match(i.first, x)) continue;
+    if (i.second.min.defined()) {
+      result.min = result.min.defined() ? simplify(max(result.min, i.second.min)) : i.second.min;
+    }
+    if (i.second.max.defined()) {
+      result.max = result.max.defined() ? simplify(min(result.max, i.second.max)) : i.second.max;
+    }
+  }
+  return result;
+}
+
 expr simplify(const expr& e, const bounds_map& bounds) { return simplifier(bounds).mutate(e, nullptr); }
 stmt simplify(const stmt& s, const bounds_map& bounds) { return simplifier(bounds).mutate(s); }
 interval_expr simplify(const interval_expr& e, const bounds_map& bounds) {
@@ -1886,11 +2275,21 @@ interval_expr bounds_of_linear(const T* op, interval_expr a, interval_expr b) {
   return {simplify(op, std::move(a.min), std::move(b.min)), simplify(op, std::move(a.max), std::move(b.max))};
 }
 
+template <typename T>
+expr simplify_less(const T* op, expr a, expr b) {
+  expr result = simplify(op, std::move(a), std::move(b));
+  // The rules can rewrite a comparison to a comparison of constants, which we need to fold to prove anything.
+  if (const T* r = result.as<T>()) {
+    if (as_constant(r->a) && as_constant(r->b)) return simplify(r, r->a, r->b);
+  }
+  return result;
+}
+
 template <typename T>
 interval_expr bounds_of_less(const T* op, interval_expr a, interval_expr b) {
   // This bit of genius comes from
   // https://github.com/halide/Halide/blob/61b8d384b2b799cd47634e4a3b67aa7c7f580a46/src/Bounds.cpp#L829
-  return {simplify(op, std::move(a.max), std::move(b.min)), simplify(op, std::move(a.min), std::move(b.max))};
+  return {simplify_less(op, std::move(a.max), std::move(b.min)), simplify_less(op, std::move(a.min), std::move(b.max))};
 }
 
 }  // namespace
@@ -1973,7 +2372,10 @@ interval_expr bounds_of(const div* op, interval_expr a, interval_expr b) {
     return a | -a;
   }
 }
-interval_expr bounds_of(const mod* op, interval_expr a, interval_expr b) { return {0, max(abs(b.min), abs(b.max))}; }
+interval_expr bounds_of(const mod* op, interval_expr a, interval_expr b) {
+  // The result of a mod is less than the divisor, unless the divisor is 0, in which case the result is 0.
+  return {0, simplify(max(max(abs(b.min), abs(b.max)) + -1, 0))};
+}
 
 interval_expr bounds_of(const class min* op, interval_expr a, interval_expr b) {
   return bounds_of_linear(op, std::move(a), std::move(b));
@@ -2019,7 +2421,7 @@ interval_expr bounds_of(const select_expr* op, interval_expr c, interval_expr t,
   }
 }
 
-interval_expr bounds_of(const call* op, std::vector<interval_expr> args) {
+interval_expr bounds_of(const call* op, box_expr args) {
   switch (op->intrinsic) {
   case intrinsic::abs:
     assert(args.size() == 1);
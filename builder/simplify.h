@@ -1,12 +1,65 @@
 #ifndef SLINKY_BUILDER_SIMPLIFY_H
 #define SLINKY_BUILDER_SIMPLIFY_H
 
+#include <functional>
+#include <utility>
+#include <vector>
+
 #include "runtime/expr.h"
 
 namespace slinky {
 
 using bounds_map = symbol_map<interval_expr>;
 
+// A set of facts known to be true in some scope, such as the conditions of `check`s that have already run, or the
+// condition of an `if_then_else` in its body. The facts are kept as bounds of variables and buffer metadata,
+// and of their remainders modulo constants.
+class fact_set {
+  // The facts are indexed by the variable they bound, or the buffer of the metadata they bound.
+  symbol_map<std::vector<std::pair<expr, interval_expr>>> bounds_;
+  // The symbols of the facts in `bounds_`, in the order they were learned.
+  std::vector<symbol_id> learned_;
+  // The number of facts hidden by scopes.
+  std::size_t hidden_ = 0;
+
+  void learn_bounds(const expr& x, interval_expr bounds);
+
+public:
+  // Learn that `condition` is true. Conditions that don't bound one of the above are ignored.
+  void learn(const expr& condition);
+
+  // Returns the bounds of `x` implied by the facts, which are undefined if there are no such facts.
+  interval_expr bounds_of(const expr& x) const;
+
+  bool empty() const { return learned_.size() == hidden_; }
+
+  // The facts learned during the lifetime of a scope are forgotten when it is destroyed.
+  class scope {
+    struct forgotten_fact {
+      symbol_id sym;
+      std::size_t index;
+      std::pair<expr, interval_expr> fact;
+    };
+
+    fact_set& facts_;
+    std::size_t size_;
+    // Facts that depend on a redeclared symbol, and where they were in `bounds_`.
+    std::vector<forgotten_fact> forgotten_;
+
+  public:
+    scope(fact_set& facts) : facts_(facts), size_(facts.learned_.size()) {}
+    // Also hides the facts that depend on `sym` during the lifetime of the scope, for a scope that redeclares `sym`.
+    scope(fact_set& facts, symbol_id sym);
+    // For a scope that redeclares the buffer `sym` with some of the same metadata (e.g. a crop): only hides the facts
+    // that depend on `sym` other than through the buffer intrinsic calls of `sym` for which `unchanged` returns true.
+    scope(fact_set& facts, symbol_id sym, const std::function<bool(const call*)>& unchanged);
+    ~scope();
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+  };
+};
+
 // Try to simplify an expr or stmt.
 expr simplify(const expr& e, const bounds_map& bounds = bounds_map());
 stmt simplify(const stmt& s, const bounds_map& bounds = bounds_map());
@@ -43,7 +96,7 @@ expr simplify(const logical_and* op, expr a, expr b);
 expr simplify(const logical_or* op, expr a, expr b);
 expr simplify(const logical_not* op, expr a);
 expr simplify(const select_expr* op, expr c, expr t, expr f);
-expr simplify(const call* op, std::vector<expr> args);
+expr simplify(const call* op, small_vector<expr, 4> args);
 
 // Helpers for producing the bounds of ops.
 interval_expr bounds_of(const class min* op, interval_expr a, interval_expr b);
@@ -61,7 +114,7 @@ interval_expr bounds_of(const logical_and* op, interval_expr a, interval_expr b)
 interval_expr bounds_of(const logical_or* op, interval_expr a, interval_expr b);
 interval_expr bounds_of(const logical_not* op, interval_expr a);
 interval_expr bounds_of(const select_expr* op, interval_expr c, interval_expr t, interval_expr f);
-interval_expr bounds_of(const call* op, std::vector<interval_expr> args);
+interval_expr bounds_of(const call* op, box_expr args);
 
 }  // namespace slinky
 
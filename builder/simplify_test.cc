@@ -123,6 +123,53 @@ TEST(simplify, basic) {
 
   test_simplify(select(x, y + 1, y + 2), y + select(x, 1, 2));
   test_simplify(select(x, 1, 2) + 1, select(x, 2, 3));
+
+  // Rate-changing bounds.
+  test_simplify((x + 1) / 2 < x / 2, false);
+  test_simplify(x / 2 < (x + 2) / 2, true);
+  test_simplify((x + 1) / 2 <= (x + 3) / 2, true);
+  test_simplify((x + 5) / 2 <= (x + 1) / 2, false);
+  test_simplify((x + 2) / 4 <= (x + 1) / 4, (x + 2) / 4 <= (x + 1) / 4);
+  test_simplify(x * 2 < y * 2, x < y);
+  test_simplify(x * 2 - y * 2, (x - y) * 2);
+}
+
+// Check that `simplify(e)` has the same value as `e` for all values of x and y in [-12, 12].
+void test_simplify_exhaustive(const expr& e) {
+  expr simplified = simplify(e);
+  eval_context ctx;
+  for (index_t i = -12; i <= 12; ++i) {
+    for (index_t j = -12; j <= 12; ++j) {
+      ctx[x] = i;
+      ctx[y] = j;
+      ASSERT_EQ(evaluate(simplified, ctx), evaluate(e, ctx))
+          << e << " -> " << simplified << " at x=" << i << ", y=" << j;
+    }
+  }
+}
+
+TEST(simplify, rate_changing) {
+  for (index_t c0 = -5; c0 <= 5; ++c0) {
+    for (index_t c1 = -5; c1 <= 5; ++c1) {
+      for (index_t c2 = -4; c2 <= 4; ++c2) {
+        if (c2 == 0) continue;
+        test_simplify_exhaustive((x + c0) / c2 - (x + c1) / c2);
+        test_simplify_exhaustive(x / c2 - (x + c1) / c2);
+        test_simplify_exhaustive((x + c0) / c2 < (x + c1) / c2);
+        test_simplify_exhaustive(x / c2 < (x + c1) / c2);
+        test_simplify_exhaustive((x + c0) / c2 < x / c2);
+        test_simplify_exhaustive((x + c0) / c2 <= (x + c1) / c2);
+        test_simplify_exhaustive(x / c2 <= (x + c1) / c2);
+        test_simplify_exhaustive((x + c0) / c2 <= x / c2);
+      }
+      if (c0 == 0) continue;
+      test_simplify_exhaustive(x * c0 + y * c1);
+      test_simplify_exhaustive(x * c0 < y * c0);
+      test_simplify_exhaustive(x * c0 < y * c0 + c1);
+      test_simplify_exhaustive(x * c0 <= y * c0);
+      test_simplify_exhaustive(x * c0 <= y * c0 + c1);
+    }
+  }
 }
 
 TEST(simplify, let) {
@@ -145,8 +192,104 @@ TEST(simplify, buffer_intrinsics) {
 TEST(simplify, if_then_else) {
   test_simplify(if_then_else::make(x == x, check::make(y), check::make(z)), check::make(y));
   test_simplify(if_then_else::make(x != x, check::make(y), check::make(z)), check::make(z));
-  test_simplify(block::make(if_then_else::make(x, check::make(y)), if_then_else::make(x, check::make(z))),
-      if_then_else::make(x, block::make(check::make(y), check::make(z))));
+  test_simplify(block::make({if_then_else::make(x, check::make(y)), if_then_else::make(x, check::make(z))}),
+      if_then_else::make(x, block::make({check::make(y), check::make(z)})));
+  test_simplify(block::make({if_then_else::make(x, check::make(y)), if_then_else::make(x, check::make(z)),
+                    if_then_else::make(x, check::make(w))}),
+      if_then_else::make(x, block::make({check::make(y), check::make(z), check::make(w)})));
+}
+
+TEST(simplify, block) {
+  // Nested blocks are flattened, and undefined stmts are removed.
+  stmt b = block::make({block::make({check::make(x), stmt()}), block::make({check::make(y), check::make(z)})});
+  ASSERT_TRUE(b.as<block>());
+  ASSERT_EQ(b.as<block>()->stmts.size(), 3);
+  ASSERT_TRUE(block::make({stmt(), check::make(x)}).as<check>());
+  ASSERT_FALSE(block::make({stmt(), stmt()}).defined());
+
+  test_simplify(block::make({check::make(x), check::make(y == y), check::make(z)}),
+      block::make({check::make(x), check::make(z)}));
+}
+
+TEST(simplify, facts) {
+  // Conditions of if_then_else are known in the branches.
+  test_simplify(if_then_else::make(x < 10, check::make(x < 11)), stmt());
+  test_simplify(
+      if_then_else::make(x < 10, check::make(y), check::make(5 <= x)), if_then_else::make(x < 10, check::make(y)));
+  test_simplify(if_then_else::make(x == 3, check::make(y == x + 1)), if_then_else::make(x == 3, check::make(y == 4)));
+
+  // Checks are known to be true in the rest of the block.
+  expr b = variable::make(w.sym());
+  test_simplify(block::make({check::make(buffer_elem_size(b) == 4), check::make(buffer_elem_size(b) == 4)}),
+      check::make(buffer_elem_size(b) == 4));
+  test_simplify(block::make({check::make(0 <= x && x < y), check::make(-1 < x), check::make(y)}),
+      block::make({check::make(0 <= x && x < y), check::make(y)}));
+
+  test_simplify(block::make({check::make(buffer_extent(b, 0) % 16 == 0),
+                    if_then_else::make(buffer_extent(b, 0) % 16 == 0, check::make(y), check::make(z))}),
+      block::make({check::make(buffer_extent(b, 0) % 16 == 0), check::make(y)}));
+
+  // But not before the check, or outside the block.
+  test_simplify(
+      block::make({check::make(x < 5), check::make(x < 3)}), block::make({check::make(x < 5), check::make(x < 3)}));
+  stmt inner = if_then_else::make(y, block::make({check::make(x < 3), check::make(z)}));
+  test_simplify(block::make({inner, check::make(x < 5)}), block::make({inner, check::make(x < 5)}));
+
+  // Or inside a new declaration of a symbol the facts depend on.
+  stmt x_loop = loop::make(x.sym(), loop_mode::serial, bounds(0, y), 1, check::make(x == 3));
+  test_simplify(if_then_else::make(x == 3, x_loop), if_then_else::make(x == 3, x_loop));
+  stmt x_let = let_stmt::make(x.sym(), y, check::make(x == 3));
+  test_simplify(block::make({check::make(x == 3), x_let}), block::make({check::make(x == 3), x_let}));
+  stmt b_slice = slice_dim::make(w.sym(), 0, y, check::make(buffer_min(b, 0) == 0));
+  test_simplify(block::make({check::make(buffer_min(b, 0) == 0), b_slice}),
+      block::make({check::make(buffer_min(b, 0) == 0), b_slice}));
+  stmt b_make = make_buffer::make(w.sym(), 0, 2, {}, check::make(buffer_elem_size(b) == 4));
+  test_simplify(block::make({check::make(buffer_elem_size(b) == 4), b_make}),
+      block::make({check::make(buffer_elem_size(b) == 4), b_make}));
+
+  // Crops and slices only redeclare some of the buffer's metadata.
+  stmt b_call = call_stmt::make(nullptr, {}, {w.sym()});
+  test_simplify(block::make({check::make(buffer_elem_size(b) == 4), check::make(buffer_stride(b, 0) == 4),
+                    crop_dim::make(w.sym(), 1, {0, 10},
+                        block::make({check::make(buffer_elem_size(b) == 4), check::make(buffer_stride(b, 0) == 4),
+                            b_call}))}),
+      block::make({check::make(buffer_elem_size(b) == 4), check::make(buffer_stride(b, 0) == 4),
+          crop_dim::make(w.sym(), 1, {0, 10}, b_call)}));
+  // But the bounds of the cropped or sliced dimensions are not known.
+  test_simplify(block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20),
+                    crop_dim::make(w.sym(), 1, {y, z},
+                        block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20)}))}),
+      block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20),
+          crop_dim::make(w.sym(), 1, {y, z}, check::make(buffer_extent(b, 1) == 20))}));
+  test_simplify(block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20),
+                    slice_dim::make(w.sym(), 1, y,
+                        block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20)}))}),
+      block::make({check::make(buffer_min(b, 0) == 0), check::make(buffer_extent(b, 1) == 20),
+          slice_dim::make(w.sym(), 1, y, check::make(buffer_extent(b, 1) == 20))}));
+}
+
+TEST(substitute, batch) {
+  expr b = variable::make(w.sym());
+  std::pair<expr, expr> subs[] = {
+      {buffer_min(b, 0), x},
+      {buffer_max(b, 0), buffer_min(b, 0) + 10},
+  };
+  ASSERT_TRUE(match(substitute(buffer_min(b, 0) + buffer_max(b, 0), subs), x + (buffer_min(b, 0) + 10)));
+
+  // Subtrees that don't depend on any target are not rebuilt.
+  expr unrelated = (y + z) * 2;
+  expr e = unrelated + buffer_min(b, 0);
+  expr result = substitute(e, subs);
+  ASSERT_TRUE(match(result, unrelated + x));
+  ASSERT_TRUE(result.as<add>()->a.same_as(unrelated));
+  ASSERT_TRUE(substitute(unrelated, subs).same_as(unrelated));
+
+  symbol_map<expr> vars = {{y.sym(), z}};
+  ASSERT_TRUE(match(substitute(e, vars, subs), (z + z) * 2 + x));
+
+  // Expression targets are not substituted in the body of a declaration that the body depends on.
+  stmt s = let_stmt::make(w.sym(), 0, check::make(buffer_min(b, 0) < y));
+  ASSERT_TRUE(substitute(s, subs).same_as(s));
 }
 
 TEST(simplify, bounds) {
@@ -168,6 +311,69 @@ TEST(simplify, bounds) {
       stmt());
 }
 
+TEST(simplify, coarsen_loops) {
+  var in(symbols, "in");
+  var in2(symbols, "in2");
+  var out(symbols, "out");
+  var t(symbols, "t");
+  var u(symbols, "u");
+  var v(symbols, "v");
+
+  stmt call = call_stmt::make(nullptr, {in.sym()}, {out.sym()});
+  auto make_loop = [&](expr step, stmt body) {
+    return loop::make(x.sym(), loop_mode::serial, bounds(0, y), std::move(step), std::move(body));
+  };
+
+  // Contiguous crop_dim and crop_buffer.
+  test_simplify(
+      make_loop(1, crop_dim::make(out.sym(), 1, point(x), call)), crop_dim::make(out.sym(), 1, bounds(0, y), call));
+  test_simplify(make_loop(1, crop_buffer::make(out.sym(), {bounds(z, w), point(x)}, call)),
+      crop_buffer::make(out.sym(), {bounds(z, w), bounds(0, y)}, call));
+
+  // Calls that only write to an empty crop are removed.
+  test_simplify(loop::make(x.sym(), loop_mode::serial, bounds(buffer_min(out, 1) - 4, buffer_min(out, 1) - 1), 1,
+                    crop_dim::make(out.sym(), 1, point(x), call)),
+      stmt());
+
+  // The union of a crop that moves in two dimensions is not a box.
+  stmt diagonal = make_loop(1, crop_buffer::make(out.sym(), {point(x), point(x)}, call));
+  test_simplify(diagonal, diagonal);
+  // The same, with the dimensions moved by different crops of the buffer.
+  stmt mixed_diagonal = make_loop(
+      1, crop_buffer::make(out.sym(), {point(x), bounds(0, 10)}, crop_dim::make(out.sym(), 1, point(x), call)));
+  test_simplify(mixed_diagonal, mixed_diagonal);
+  stmt dim_diagonal =
+      make_loop(1, crop_dim::make(out.sym(), 0, point(x), crop_dim::make(out.sym(), 1, point(x), call)));
+  test_simplify(dim_diagonal, dim_diagonal);
+  // Crops of different buffers can each move in a different dimension.
+  stmt call2 = call_stmt::make(nullptr, {in.sym()}, {out.sym(), in2.sym()});
+  test_simplify(make_loop(1, crop_dim::make(out.sym(), 0, point(x), crop_dim::make(in2.sym(), 1, point(x), call2))),
+      crop_dim::make(out.sym(), 0, bounds(0, y), crop_dim::make(in2.sym(), 1, bounds(0, y), call2)));
+
+  // Lets that depend on the loop are substituted, others are kept.
+  test_simplify(make_loop(4, let_stmt::make(t.sym(), x * 2, crop_dim::make(out.sym(), 1, bounds(t, t + 7), call))),
+      crop_dim::make(out.sym(), 1, bounds(0, y * 2 + 7), call));
+  test_simplify(make_loop(1, let_stmt::make(t.sym(), z * 3,
+                                 crop_buffer::make(out.sym(), {bounds(t, t + w), point(x)}, call))),
+      let_stmt::make(t.sym(), z * 3, crop_buffer::make(out.sym(), {bounds(t, t + w), bounds(0, y)}, call)));
+
+  // A block of copies to disjoint regions of the same buffer.
+  auto copy_to = [&](var src, int c) {
+    return crop_buffer::make(out.sym(), {point(x), point(c)},
+        copy_stmt::make(src.sym(), {u, v}, out.sym(), {u.sym(), v.sym()}, {}));
+  };
+  auto copy_result = [&](var src, int c) {
+    return crop_buffer::make(out.sym(), {bounds(0, y), point(c)},
+        copy_stmt::make(src.sym(), {u, v}, out.sym(), {u.sym(), v.sym()}, {}));
+  };
+  test_simplify(make_loop(1, block::make({copy_to(in, 0), copy_to(in2, 1)})),
+      block::make({copy_result(in, 0), copy_result(in2, 1)}));
+
+  // If the copies overlap, the order matters.
+  stmt overlapping = make_loop(1, block::make({copy_to(in, 0), copy_to(in2, 0)}));
+  test_simplify(overlapping, overlapping);
+}
+
 TEST(simplify, bounds_of) {
   // Test bounds_of by testing expressions of up to two operands, and setting the
   // bounds of the two operands to all possible cases of overlap. This approach
@@ -1,5 +1,6 @@
 #include "builder/substitute.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <functional>
@@ -14,7 +15,7 @@
 
 namespace slinky {
 
-class matcher : public node_visitor {
+class matcher {
   // In this class, we visit the pattern, and manually traverse the expression being matched.
   const base_node* self;
   symbol_map<expr>* matches;
@@ -46,15 +47,8 @@ public:
     return match == 0;
   }
 
-  // Skip the visitor pattern (two virtual function calls) for a few node types that are very frequently visited.
-  void visit(const expr& op) {
-    switch (op.type()) {
-    case node_type::add: visit(reinterpret_cast<const add*>(op.get())); return;
-    case node_type::min: visit(reinterpret_cast<const class min*>(op.get())); return;
-    case node_type::max: visit(reinterpret_cast<const class max*>(op.get())); return;
-    default: op.accept(this);
-    }
-  }
+  void visit(const expr& op) { dispatch(*this, op.get()); }
+  void visit(const stmt& op) { dispatch(*this, op.get()); }
 
   bool try_match(const expr& e, const expr& op) {
     if (!e.defined() && !op.defined()) {
@@ -79,7 +73,7 @@ public:
       match = 1;
     } else {
       self = s.get();
-      op.accept(this);
+      visit(op);
     }
     return match == 0;
   }
@@ -98,7 +92,7 @@ public:
   }
 
   template <typename T>
-  bool try_match(const std::vector<T>& self, const std::vector<T>& op) {
+  bool try_match(span<const T> self, span<const T> op) {
     if (self.size() < op.size()) {
       match = -1;
       return false;
@@ -113,6 +107,14 @@ public:
 
     return true;
   }
+  template <typename T>
+  bool try_match(const std::vector<T>& self, const std::vector<T>& op) {
+    return try_match(span<const T>(self), span<const T>(op));
+  }
+  template <typename T, std::size_t N>
+  bool try_match(const small_vector<T, N>& self, const small_vector<T, N>& op) {
+    return try_match(span<const T>(self), span<const T>(op));
+  }
 
   template <typename T>
   const T* match_self_as(const T* op) {
@@ -137,7 +139,7 @@ public:
     if (!try_match(ex->b, op->b)) return;
   }
 
-  void match_wildcard(symbol_id sym, std::function<bool(const expr&)> predicate) {
+  void match_wildcard(symbol_id sym, const std::function<bool(const expr&)>& predicate) {
     if (match) return;
 
     std::optional<expr>& matched = (*matches)[sym];
@@ -146,7 +148,7 @@ public:
       if (!matched->same_as(static_cast<const base_expr_node*>(self))) {
         symbol_map<expr>* old_matches = matches;
         matches = nullptr;
-        matched->accept(this);
+        visit(*matched);
         matches = old_matches;
       }
     } else if (!predicate || predicate(static_cast<const base_expr_node*>(self))) {
@@ -159,7 +161,7 @@ public:
     }
   }
 
-  void visit(const variable* op) override {
+  void visit(const variable* op) {
     if (matches) {
       match_wildcard(op->sym, nullptr);
     } else {
@@ -170,7 +172,7 @@ public:
     }
   }
 
-  void visit(const wildcard* op) override {
+  void visit(const wildcard* op) {
     if (matches) {
       match_wildcard(op->sym, op->matches);
     } else {
@@ -181,7 +183,7 @@ public:
     }
   }
 
-  void visit(const constant* op) override {
+  void visit(const constant* op) {
     if (match) return;
 
     const constant* ec = match_self_as(op);
@@ -201,21 +203,21 @@ public:
     if (!try_match(el->body, op->body)) return;
   }
 
-  void visit(const let* op) override { visit_let(op); }
-  void visit(const add* op) override { match_binary(op); }
-  void visit(const sub* op) override { match_binary(op); }
-  void visit(const mul* op) override { match_binary(op); }
-  void visit(const div* op) override { match_binary(op); }
-  void visit(const mod* op) override { match_binary(op); }
-  void visit(const class min* op) override { match_binary(op); }
-  void visit(const class max* op) override { match_binary(op); }
-  void visit(const equal* op) override { match_binary(op); }
-  void visit(const not_equal* op) override { match_binary(op); }
-  void visit(const less* op) override { match_binary(op); }
-  void visit(const less_equal* op) override { match_binary(op); }
-  void visit(const logical_and* op) override { match_binary(op); }
-  void visit(const logical_or* op) override { match_binary(op); }
-  void visit(const logical_not* op) override {
+  void visit(const let* op) { visit_let(op); }
+  void visit(const add* op) { match_binary(op); }
+  void visit(const sub* op) { match_binary(op); }
+  void visit(const mul* op) { match_binary(op); }
+  void visit(const div* op) { match_binary(op); }
+  void visit(const mod* op) { match_binary(op); }
+  void visit(const class min* op) { match_binary(op); }
+  void visit(const class max* op) { match_binary(op); }
+  void visit(const equal* op) { match_binary(op); }
+  void visit(const not_equal* op) { match_binary(op); }
+  void visit(const less* op) { match_binary(op); }
+  void visit(const less_equal* op) { match_binary(op); }
+  void visit(const logical_and* op) { match_binary(op); }
+  void visit(const logical_or* op) { match_binary(op); }
+  void visit(const logical_not* op) {
     if (match) return;
     const class logical_not* ne = match_self_as(op);
     if (!ne) return;
@@ -223,7 +225,7 @@ public:
     try_match(ne->a, op->a);
   }
 
-  void visit(const select_expr* op) override {
+  void visit(const select_expr* op) {
     if (match) return;
     const select_expr* se = match_self_as(op);
     if (!se) return;
@@ -233,7 +235,7 @@ public:
     if (!try_match(se->false_value, op->false_value)) return;
   }
 
-  void visit(const call* op) override {
+  void visit(const call* op) {
     if (match) return;
     const call* c = match_self_as(op);
     if (!c) return;
@@ -242,18 +244,17 @@ public:
     if (!try_match(c->args, op->args)) return;
   }
 
-  void visit(const let_stmt* op) override { visit_let(op); }
+  void visit(const let_stmt* op) { visit_let(op); }
 
-  void visit(const block* op) override {
+  void visit(const block* op) {
     if (match) return;
     const block* bs = match_self_as(op);
     if (!bs) return;
 
-    if (!try_match(bs->a, op->a)) return;
-    if (!try_match(bs->b, op->b)) return;
+    if (!try_match(bs->stmts, op->stmts)) return;
   }
 
-  void visit(const loop* op) override {
+  void visit(const loop* op) {
     if (match) return;
     const loop* ls = match_self_as(op);
     if (!ls) return;
@@ -264,7 +265,7 @@ public:
     if (!try_match(ls->body, op->body)) return;
   }
 
-  void visit(const if_then_else* op) override {
+  void visit(const if_then_else* op) {
     if (match) return;
     const if_then_else* is = match_self_as(op);
     if (!is) return;
@@ -274,7 +275,7 @@ public:
     if (!try_match(is->false_body, op->false_body)) return;
   }
 
-  void visit(const call_stmt* op) override {
+  void visit(const call_stmt* op) {
     if (match) return;
     const call_stmt* cs = match_self_as(op);
     if (!cs) return;
@@ -283,7 +284,7 @@ public:
     if (!try_match(cs->outputs, op->outputs)) return;
   }
 
-  void visit(const copy_stmt* op) override {
+  void visit(const copy_stmt* op) {
     if (match) return;
     const copy_stmt* cs = match_self_as(op);
     if (!cs) return;
@@ -295,7 +296,7 @@ public:
     if (!try_match(cs->padding, op->padding)) return;
   }
 
-  void visit(const allocate* op) override {
+  void visit(const allocate* op) {
     if (match) return;
     const allocate* as = match_self_as(op);
     if (!as) return;
@@ -306,7 +307,7 @@ public:
     if (!try_match(as->body, op->body)) return;
   }
 
-  void visit(const make_buffer* op) override {
+  void visit(const make_buffer* op) {
     if (match) return;
     const make_buffer* mbs = match_self_as(op);
     if (!mbs) return;
@@ -318,7 +319,7 @@ public:
     if (!try_match(mbs->body, op->body)) return;
   }
 
-  void visit(const clone_buffer* op) override {
+  void visit(const clone_buffer* op) {
     if (match) return;
     const clone_buffer* mbs = match_self_as(op);
     if (!mbs) return;
@@ -328,7 +329,7 @@ public:
     if (!try_match(mbs->body, op->body)) return;
   }
 
-  void visit(const crop_buffer* op) override {
+  void visit(const crop_buffer* op) {
     if (match) return;
     const crop_buffer* cbs = match_self_as(op);
     if (!cbs) return;
@@ -338,7 +339,7 @@ public:
     if (!try_match(cbs->body, op->body)) return;
   }
 
-  void visit(const crop_dim* op) override {
+  void visit(const crop_dim* op) {
     if (match) return;
     const crop_dim* cds = match_self_as(op);
     if (!cds) return;
@@ -349,7 +350,7 @@ public:
     if (!try_match(cds->body, op->body)) return;
   }
 
-  void visit(const slice_buffer* op) override {
+  void visit(const slice_buffer* op) {
     if (match) return;
     const slice_buffer* cbs = match_self_as(op);
     if (!cbs) return;
@@ -359,7 +360,7 @@ public:
     if (!try_match(cbs->body, op->body)) return;
   }
 
-  void visit(const slice_dim* op) override {
+  void visit(const slice_dim* op) {
     if (match) return;
     const slice_dim* cds = match_self_as(op);
     if (!cds) return;
@@ -370,7 +371,7 @@ public:
     if (!try_match(cds->body, op->body)) return;
   }
 
-  void visit(const truncate_rank* op) override {
+  void visit(const truncate_rank* op) {
     if (match) return;
     const truncate_rank* trs = match_self_as(op);
     if (!trs) return;
@@ -380,7 +381,7 @@ public:
     if (!try_match(trs->body, op->body)) return;
   }
 
-  void visit(const check* op) override {
+  void visit(const check* op) {
     if (match) return;
     const check* cs = match_self_as(op);
     if (!cs) return;
@@ -391,7 +392,7 @@ public:
 
 bool match(const expr& p, const expr& e, symbol_map<expr>& matches) {
   matcher m(e, &matches);
-  p.accept(&m);
+  m.visit(p);
   return m.match == 0;
 }
 
@@ -407,7 +408,7 @@ int compare(const expr& a, const expr& b) {
   // TODO: It would be nice if we didn't need to duplicate this tricky logic.
   if (!b.defined()) return a.defined() ? 1 : 0;
   matcher m(a);
-  b.accept(&m);
+  m.visit(b);
   return m.match;
 }
 
@@ -416,7 +417,7 @@ int compare(const stmt& a, const stmt& b) {
   // TODO: It would be nice if we didn't need to duplicate this tricky logic.
   if (!b.defined()) return a.defined() ? 1 : 0;
   matcher m(a);
-  b.accept(&m);
+  m.visit(b);
   return m.match;
 }
 
@@ -427,25 +428,59 @@ symbol_map<expr> empty_replacements;
 class substitutor : public node_mutator {
   const symbol_map<expr>& replacements = empty_replacements;
   symbol_id target_var = -1;
-  expr target;
-  expr replacement;
+  expr var_replacement;
+  span<const std::pair<expr, expr>> exprs;
+  bool exprs_enabled = true;
+
+  // The symbols that any of the targets depend on. Subtrees that don't depend on these can't contain a target. This is
+  // only valid if `can_skip` is true, which is not the case if some target doesn't depend on any symbols.
+  std::vector<symbol_id> target_syms;
+  bool can_skip = true;
 
   // Track newly declared variables that might shadow the variables we want to replace.
   symbol_map<bool> shadowed;
 
+  void add_target_syms(const expr& target) {
+    std::vector<symbol_id> syms = find_dependencies(target);
+    if (syms.empty()) can_skip = false;
+    target_syms.insert(target_syms.end(), syms.begin(), syms.end());
+  }
+
+  void init_targets() {
+    for (symbol_id i = 0; i < replacements.size(); ++i) {
+      if (replacements.contains(i)) target_syms.push_back(i);
+    }
+    for (const std::pair<expr, expr>& i : exprs) {
+      add_target_syms(i.first);
+    }
+    std::sort(target_syms.begin(), target_syms.end());
+    target_syms.erase(std::unique(target_syms.begin(), target_syms.end()), target_syms.end());
+  }
+
 public:
-  substitutor(const symbol_map<expr>& replacements) : replacements(replacements) {}
-  substitutor(symbol_id target, const expr& replacement) : target_var(target), replacement(replacement) {}
-  substitutor(const expr& target, const expr& replacement) : target(target), replacement(replacement) {}
+  substitutor(const symbol_map<expr>& replacements, span<const std::pair<expr, expr>> exprs = {})
+      : replacements(replacements), exprs(exprs) {
+    init_targets();
+  }
+  substitutor(symbol_id target, const expr& replacement) : target_var(target), var_replacement(replacement) {
+    target_syms.push_back(target);
+    init_targets();
+  }
+  substitutor(span<const std::pair<expr, expr>> exprs) : exprs(exprs) { init_targets(); }
 
   expr mutate(const expr& op) override {
-    if (target.defined() && op.defined() && match(op, target)) {
-      return replacement;
-    } else {
-      return node_mutator::mutate(op);
+    if (!op.defined() || (can_skip && !depends_on(op, target_syms))) return op;
+    if (exprs_enabled) {
+      for (const std::pair<expr, expr>& i : exprs) {
+        if (match(op, i.first)) return i.second;
+      }
     }
+    return node_mutator::mutate(op);
+  }
+  stmt mutate(const stmt& op) override {
+    if (!op.defined() || (can_skip && !depends_on(op, target_syms))) return op;
+    return node_mutator::mutate(op);
   }
-  using node_mutator::mutate;
 
   template <typename T>
   void visit_variable(const T* v) {
@@ -453,29 +488,33 @@ public:
       // This variable has been shadowed, don't substitute it.
       set_result(v);
     } else if (v->sym == target_var) {
-      set_result(replacement);
+      set_result(var_replacement);
+    } else if (replacements.contains(v->sym)) {
+      set_result(*replacements[v->sym]);
     } else {
-      std::optional<expr> r = replacements.lookup(v->sym);
-      set_result(r ? *r : v);
+      set_result(v);
     }
   }
 
   void visit(const variable* v) override { visit_variable(v); }
   void visit(const wildcard* v) override { visit_variable(v); }
 
+  // Mutate the body of a declaration of `sym`.
   template <typename T>
   T mutate_decl_body(symbol_id sym, const T& x) {
-    if (target.defined() && depends_on(x, sym)) {
-      return x;
-    } else {
-      return mutate(x);
-    }
+    auto s = set_value_in_scope(shadowed, sym, true);
+    if (exprs.empty() || !depends_on(x, sym)) return mutate(x);
+    // The expression targets might depend on the shadowed symbol. Conservatively, don't substitute them in this body.
+    bool old_exprs_enabled = exprs_enabled;
+    exprs_enabled = false;
+    T result = mutate(x);
+    exprs_enabled = old_exprs_enabled;
+    return result;
   }
 
   template <typename T>
   auto mutate_let(const T* op) {
     expr value = mutate(op->value);
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     auto body = mutate_decl_body(op->sym, op->body);
     if (value.same_as(op->value) && body.same_as(op->body)) {
       return decltype(body){op};
@@ -490,7 +529,6 @@ public:
   void visit(const loop* op) override {
     interval_expr bounds = {mutate(op->bounds.min), mutate(op->bounds.max)};
     expr step = mutate(op->step);
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (bounds.same_as(op->bounds) && step.same_as(op->step) && body.same_as(op->body)) {
       set_result(op);
@@ -499,7 +537,7 @@ public:
     }
   }
   void visit(const allocate* op) override {
-    std::vector<dim_expr> dims;
+    small_vector<dim_expr, 4> dims;
     dims.reserve(op->dims.size());
     bool changed = false;
     for (const dim_expr& i : op->dims) {
@@ -507,7 +545,6 @@ public:
       dims.push_back({std::move(bounds), mutate(i.stride), mutate(i.fold_factor)});
       changed = changed || !dims.back().same_as(i);
     }
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (!changed && body.same_as(op->body)) {
       set_result(op);
@@ -518,15 +555,14 @@ public:
   void visit(const make_buffer* op) override {
     expr base = mutate(op->base);
     expr elem_size = mutate(op->elem_size);
-    std::vector<dim_expr> dims;
+    small_vector<dim_expr, 4> dims;
     dims.reserve(op->dims.size());
     bool changed = false;
     for (const dim_expr& i : op->dims) {
       interval_expr bounds = {mutate(i.bounds.min), mutate(i.bounds.max)};
       dims.push_back({std::move(bounds), mutate(i.stride), mutate(i.fold_factor)});
-      changed = changed || dims.back().same_as(i);
+      changed = changed || !dims.back().same_as(i);
     }
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (!changed && base.same_as(op->base) && elem_size.same_as(op->elem_size) && body.same_as(op->body)) {
       set_result(op);
@@ -535,7 +571,6 @@ public:
     }
   }
   void visit(const clone_buffer* op) override {
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (body.same_as(op->body)) {
       set_result(op);
@@ -544,14 +579,13 @@ public:
     }
   }
   void visit(const slice_buffer* op) override {
-    std::vector<expr> at;
+    small_vector<expr, 4> at;
     at.reserve(op->at.size());
     bool changed = false;
     for (const expr& i : op->at) {
       at.push_back(mutate(i));
-      changed = changed || at.back().same_as(i);
+      changed = changed || !at.back().same_as(i);
     }
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (!changed && body.same_as(op->body)) {
       set_result(op);
@@ -561,7 +595,6 @@ public:
   }
   void visit(const slice_dim* op) override {
     expr at = mutate(op->at);
-    auto s = set_value_in_scope(shadowed, op->sym, true);
     stmt body = mutate_decl_body(op->sym, op->body);
     if (at.same_as(op->at) && body.same_as(op->body)) {
       set_result(op);
@@ -572,31 +605,24 @@ public:
 };
 
 template <typename T>
-T substitute(T op, span<const std::pair<expr, expr>> subs) {
-  for (const std::pair<expr, expr>& i : subs) {
-    op = substitutor(i.first, i.second).mutate(op);
-  }
-  return op;
-}
-
-template <typename T>
-T substitute_bounds_impl(T op, symbol_id buffer, int dim, const interval_expr& bounds) {
+T substitute_bounds_impl(const T& op, symbol_id buffer, int dim, const interval_expr& bounds) {
   expr buf_var = variable::make(buffer);
-  if (bounds.min.defined()) op = substitute(op, buffer_min(buf_var, dim), bounds.min);
-  if (bounds.max.defined()) op = substitute(op, buffer_max(buf_var, dim), bounds.max);
-  return op;
+  small_vector<std::pair<expr, expr>, 2> subs;
+  if (bounds.min.defined()) subs.emplace_back(buffer_min(buf_var, dim), bounds.min);
+  if (bounds.max.defined()) subs.emplace_back(buffer_max(buf_var, dim), bounds.max);
+  return substitutor(subs).mutate(op);
 }
 
 template <typename T>
-T substitute_bounds_impl(T op, symbol_id buffer, const box_expr& bounds) {
+T substitute_bounds_impl(const T& op, symbol_id buffer, const box_expr& bounds) {
   expr buf_var = variable::make(buffer);
-  std::vector<std::pair<expr, expr>> subs;
+  small_vector<std::pair<expr, expr>, 8> subs;
   subs.reserve(bounds.size() * 2);
   for (index_t d = 0; d < static_cast<index_t>(bounds.size()); ++d) {
     if (bounds[d].min.defined()) subs.emplace_back(buffer_min(buf_var, d), bounds[d].min);
     if (bounds[d].max.defined()) subs.emplace_back(buffer_max(buf_var, d), bounds[d].max);
   }
-  return substitute(op, subs);
+  return substitutor(subs).mutate(op);
 }
 
 }  // namespace
@@ -612,10 +638,27 @@ stmt substitute(const stmt& s, symbol_id target, const expr& replacement) {
 }
 
 expr substitute(const expr& e, const expr& target, const expr& replacement) {
-  return substitutor(target, replacement).mutate(e);
+  std::pair<expr, expr> subs[] = {{target, replacement}};
+  return substitutor(subs).mutate(e);
 }
 stmt substitute(const stmt& s, const expr& target, const expr& replacement) {
-  return substitutor(target, replacement).mutate(s);
+  std::pair<expr, expr> subs[] = {{target, replacement}};
+  return substitutor(subs).mutate(s);
+}
+
+expr substitute(const expr& e, span<const std::pair<expr, expr>> replacements) {
+  return substitutor(replacements).mutate(e);
+}
+stmt substitute(const stmt& s, span<const std::pair<expr, expr>> replacements) {
+  return substitutor(replacements).mutate(s);
+}
+expr substitute(
+    const expr& e, const symbol_map<expr>& replacements, span<const std::pair<expr, expr>> expr_replacements) {
+  return substitutor(replacements, expr_replacements).mutate(e);
+}
+stmt substitute(
+    const stmt& s, const symbol_map<expr>& replacements, span<const std::pair<expr, expr>> expr_replacements) {
+  return substitutor(replacements, expr_replacements).mutate(s);
 }
 
 expr substitute_bounds(const expr& e, symbol_id buffer, const box_expr& bounds) {
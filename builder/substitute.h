@@ -1,6 +1,8 @@
 #ifndef SLINKY_BUILDER_SUBSTITUTE_H
 #define SLINKY_BUILDER_SUBSTITUTE_H
 
+#include <utility>
+
 #include "runtime/expr.h"
 
 namespace slinky {
@@ -20,6 +22,15 @@ expr substitute(const expr& e, symbol_id target, const expr& replacement);
 stmt substitute(const stmt& s, symbol_id target, const expr& replacement);
 expr substitute(const expr& e, const expr& target, const expr& replacement);
 stmt substitute(const stmt& s, const expr& target, const expr& replacement);
+// Apply many substitutions in one pass: variables are replaced according to `replacements`, and each expression matching
+// the first of a pair in `expr_replacements` is replaced by the second. The substitutions are applied simultaneously,
+// the replacements are not themselves substituted. Subtrees that do not depend on any target are not rebuilt.
+expr substitute(const expr& e, span<const std::pair<expr, expr>> expr_replacements);
+stmt substitute(const stmt& s, span<const std::pair<expr, expr>> expr_replacements);
+expr substitute(
+    const expr& e, const symbol_map<expr>& replacements, span<const std::pair<expr, expr>> expr_replacements);
+stmt substitute(
+    const stmt& s, const symbol_map<expr>& replacements, span<const std::pair<expr, expr>> expr_replacements);
 expr substitute_bounds(const expr& e, symbol_id buffer, const box_expr& bounds);
 stmt substitute_bounds(const stmt& s, symbol_id buffer, const box_expr& bounds);
 expr substitute_bounds(const expr& e, symbol_id buffer, int dim, const interval_expr& bounds);
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <cstdint>
 #include <cstdlib>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "runtime/util.h"
 
@@ -32,3 +37,113 @@ TEST(arithmetic, euclidean_div_mod) {
     ASSERT_EQ(euclidean_div(-a, -b) * -b + euclidean_mod(-a, -b), -a);
   }
 }
+
+template <typename T>
+void test_invariant_divisor(T b, const std::vector<T>& numerators) {
+  invariant_divisor<T> d(b);
+  for (T a : numerators) {
+    if constexpr (std::is_signed_v<T>) {
+      // The quotient of min / -1 overflows.
+      if (a == std::numeric_limits<T>::min() && b == -1) continue;
+      // `euclidean_div` and `euclidean_mod` overflow for some of these values (e.g. `abs(min)`), so compute the
+      // expected results in a wider type.
+      __int128 wide_q = 0;
+      __int128 wide_r = 0;
+      if (b != 0) {
+        wide_q = static_cast<__int128>(a) / b;
+        wide_r = static_cast<__int128>(a) % b;
+        if (wide_r < 0) {
+          wide_q += b < 0 ? 1 : -1;
+          wide_r += b < 0 ? -static_cast<__int128>(b) : static_cast<__int128>(b);
+        }
+      }
+      ASSERT_EQ(d.div(a), static_cast<T>(wide_q)) << a << " " << b;
+      ASSERT_EQ(d.mod(a), static_cast<T>(wide_r)) << a << " " << b;
+    } else {
+      ASSERT_EQ(d.div(a), b != 0 ? a / b : 0) << a << " " << b;
+      ASSERT_EQ(d.mod(a), b != 0 ? a % b : 0) << a << " " << b;
+    }
+  }
+}
+
+template <typename T>
+void test_invariant_divisor() {
+  std::vector<T> values = {0, 1, 2, 3, 7, 8, 9, std::numeric_limits<T>::max(), std::numeric_limits<T>::max() - 1};
+  if constexpr (std::is_signed_v<T>) {
+    for (T i : {-1, -2, -3, -7, -8, -9}) {
+      values.push_back(i);
+    }
+    values.push_back(std::numeric_limits<T>::min());
+    values.push_back(std::numeric_limits<T>::min() + 1);
+  }
+  for (int i = 0; i < 100; ++i) {
+    T r = 0;
+    for (std::size_t j = 0; j < sizeof(T); ++j) {
+      r = static_cast<T>((r << 8) | (rand() & 0xff));
+    }
+    values.push_back(r);
+    // Small values are the most common divisors.
+    values.push_back(static_cast<T>(rand() % 100));
+  }
+  for (T b : values) {
+    test_invariant_divisor(b, values);
+  }
+}
+
+TEST(arithmetic, invariant_divisor) {
+  test_invariant_divisor<std::int8_t>();
+  test_invariant_divisor<std::int16_t>();
+  test_invariant_divisor<std::int32_t>();
+  test_invariant_divisor<std::int64_t>();
+  test_invariant_divisor<std::uint8_t>();
+  test_invariant_divisor<std::uint16_t>();
+  test_invariant_divisor<std::uint32_t>();
+  test_invariant_divisor<std::uint64_t>();
+}
+
+TEST(small_vector, inline_and_heap) {
+  small_vector<std::shared_ptr<int>, 2> v;
+  ASSERT_TRUE(v.empty());
+  ASSERT_EQ(v.capacity(), 2);
+  for (int i = 0; i < 10; ++i) {
+    v.push_back(std::make_shared<int>(i));
+    ASSERT_EQ(v.size(), i + 1);
+    ASSERT_EQ(*v.back(), i);
+  }
+  ASSERT_GE(v.capacity(), 10);
+  // Pushing an element of the vector itself must survive the reallocation.
+  v.push_back(v.front());
+  ASSERT_EQ(v.back(), v.front());
+
+  small_vector<std::shared_ptr<int>, 2> copy = v;
+  ASSERT_EQ(copy.size(), v.size());
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(copy[i], v[i]);
+  }
+
+  // Moving must not throw, so containers of small_vectors move rather than copy them when they reallocate.
+  static_assert(std::is_nothrow_move_constructible<small_vector<std::shared_ptr<int>, 2>>::value, "");
+  static_assert(std::is_nothrow_move_assignable<small_vector<std::shared_ptr<int>, 2>>::value, "");
+  small_vector<std::shared_ptr<int>, 2> moved = std::move(copy);
+  ASSERT_EQ(moved.size(), v.size());
+  ASSERT_TRUE(copy.empty());
+
+  moved.erase(moved.begin() + 1, moved.end());
+  ASSERT_EQ(moved.size(), 1);
+  ASSERT_EQ(*moved[0], 0);
+  ASSERT_EQ(moved[0].use_count(), 3);
+
+  moved.insert(moved.begin(), std::make_shared<int>(-1));
+  ASSERT_EQ(*moved[0], -1);
+  ASSERT_EQ(*moved[1], 0);
+
+  small_vector<int, 4> small = {1, 2, 3};
+  ASSERT_EQ(small.capacity(), 4);
+  small.resize(2);
+  ASSERT_EQ(small.size(), 2);
+  small.resize(5, 7);
+  ASSERT_EQ(small.size(), 5);
+  ASSERT_EQ(small[4], 7);
+  small.clear();
+  ASSERT_TRUE(small.empty());
+}
@@ -65,6 +65,19 @@ public:
       return euclidean_mod(i - min_, fold_factor_) * stride_;
     }
   }
+
+  // A divisor for computing the offsets of many indices in a folded dimension without a divide for each one.
+  invariant_divisor<index_t> fold_divisor() const { return fold_factor_ == unfolded ? 1 : fold_factor_; }
+  std::ptrdiff_t flat_offset_bytes(index_t i, const invariant_divisor<index_t>& fold) const {
+    assert(i >= min_);
+    assert(i <= max());
+    assert(fold_factor_ == unfolded || fold.divisor() == fold_factor_);
+    if (fold_factor_ == unfolded) {
+      return (i - min_) * stride_;
+    } else {
+      return fold.mod(i - min_) * stride_;
+    }
+  }
 };
 
 template <typename T, std::size_t DimsSize = 0>
@@ -1,6 +1,8 @@
 #include "runtime/depends_on.h"
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 
 #include "runtime/expr.h"
 #include "runtime/util.h"
@@ -9,116 +11,161 @@ namespace slinky {
 
 namespace {
 
-class dependencies : public recursive_node_visitor {
-public:
-  span<const symbol_id> vars;
-  bool found_var = false;
-  bool found_buf = false;
-
-  dependencies(span<const symbol_id> vars) : vars(vars) {}
-
-  void accept_buffer(const expr& e) {
-    bool old_found_var = found_var;
-    found_var = false;
-    e.accept(this);
-    found_buf = found_buf || found_var;
-    found_var = old_found_var;
+void insert_sorted(std::vector<symbol_id>& to, symbol_id sym) {
+  auto i = std::lower_bound(to.begin(), to.end(), sym);
+  if (i == to.end() || *i != sym) to.insert(i, sym);
+}
+
+void merge_sorted(std::vector<symbol_id>& to, const std::vector<symbol_id>& from) {
+  if (from.empty()) return;
+  if (to.empty()) {
+    to = from;
+    return;
   }
+  std::vector<symbol_id> result;
+  result.reserve(to.size() + from.size());
+  std::set_union(to.begin(), to.end(), from.begin(), from.end(), std::back_inserter(result));
+  to = std::move(result);
+}
 
-  void visit_var(symbol_id sym) {
-    for (symbol_id i : vars) {
-      if (i == sym) {
-        found_var = true;
-        return;
-      }
+bool contains_sorted(const std::vector<symbol_id>& syms, symbol_id sym) {
+  return std::binary_search(syms.begin(), syms.end(), sym);
+}
+
+const symbol_summary& summarize(const base_node* n);
+
+// Computes the summary of one node from the (cached) summaries of its children.
+class summarizer : public recursive_visitor<summarizer> {
+public:
+  using recursive_visitor::visit;
+
+  symbol_summary result;
+
+  void add(const base_node* n) {
+    // Leaves are cheap to handle directly, avoid caching a summary for each of them.
+    if (const variable* v = n->as<variable>()) {
+      insert_sorted(result.vars, v->sym);
+    } else if (const wildcard* w = n->as<wildcard>()) {
+      insert_sorted(result.vars, w->sym);
+    } else if (n->type != node_type::constant) {
+      const symbol_summary& s = summarize(n);
+      merge_sorted(result.vars, s.vars);
+      merge_sorted(result.bufs, s.bufs);
     }
   }
 
-  void visit_buf(symbol_id sym) {
-    for (symbol_id i : vars) {
-      if (i == sym) {
-        found_buf = true;
-        return;
-      }
-    }
+  void visit(const expr& e) {
+    if (e.defined()) add(e.get());
+  }
+  void visit(const stmt& s) {
+    if (s.defined()) add(s.get());
   }
 
-  void visit(const variable* op) override { visit_var(op->sym); }
-  void visit(const wildcard* op) override { visit_var(op->sym); }
-  void visit(const call* op) override {
+  void visit(const variable* op) { insert_sorted(result.vars, op->sym); }
+  void visit(const wildcard* op) { insert_sorted(result.vars, op->sym); }
+  void visit(const call* op) {
     if (is_buffer_intrinsic(op->intrinsic)) {
       assert(op->args.size() >= 1);
-      accept_buffer(op->args[0]);
+      // Everything the buffer argument depends on is a buffer dependency.
+      summarizer buf;
+      buf.visit(op->args[0]);
+      merge_sorted(result.bufs, buf.result.vars);
+      merge_sorted(result.bufs, buf.result.bufs);
 
       for (std::size_t i = 1; i < op->args.size(); ++i) {
-        if (op->args[i].defined()) op->args[i].accept(this);
+        visit(op->args[i]);
       }
     } else {
-      recursive_node_visitor::visit(op);
+      recursive_visitor::visit(op);
     }
   }
 
-  void visit(const call_stmt* op) override {
+  void visit(const call_stmt* op) {
     for (symbol_id i : op->inputs) {
-      visit_buf(i);
+      insert_sorted(result.bufs, i);
     }
     for (symbol_id i : op->outputs) {
-      visit_buf(i);
+      insert_sorted(result.bufs, i);
     }
   }
-  void visit(const copy_stmt* op) override {
-    visit_buf(op->src);
-    visit_buf(op->dst);
+  void visit(const copy_stmt* op) {
+    insert_sorted(result.bufs, op->src);
+    insert_sorted(result.bufs, op->dst);
   }
 };
 
+const symbol_summary& summarize(const base_node* n) {
+  const symbol_summary* cached = n->symbols.load(std::memory_order_acquire);
+  if (cached) return *cached;
+
+  summarizer v;
+  dispatch(v, n);
+  symbol_summary* result = new symbol_summary(std::move(v.result));
+  // Another thread may have computed the summary while we were, in which case we use theirs.
+  if (n->symbols.compare_exchange_strong(cached, result, std::memory_order_acq_rel, std::memory_order_acquire)) {
+    return *result;
+  } else {
+    delete result;
+    return *cached;
+  }
+}
+
 }  // namespace
 
 bool depends_on(const expr& e, symbol_id var) {
   if (!e.defined()) return false;
-  symbol_id vars[] = {var};
-  dependencies v(vars);
-  e.accept(&v);
-  return v.found_var || v.found_buf;
+  if (const symbol_id* sym = as_variable(e)) return *sym == var;
+  const symbol_summary& s = summarize(e.get());
+  return contains_sorted(s.vars, var) || contains_sorted(s.bufs, var);
 }
 
-bool depends_on(const interval_expr& e, symbol_id var) {
-  symbol_id vars[] = {var};
-  dependencies v(vars);
-  if (e.min.defined()) e.min.accept(&v);
-  if (e.max.defined()) e.max.accept(&v);
-  return v.found_var || v.found_buf;
+bool depends_on(const expr& e, span<const symbol_id> vars) {
+  if (!e.defined()) return false;
+  if (const symbol_id* sym = as_variable(e)) {
+    return std::find(vars.begin(), vars.end(), *sym) != vars.end();
+  }
+  const symbol_summary& s = summarize(e.get());
+  for (symbol_id i : vars) {
+    if (contains_sorted(s.vars, i) || contains_sorted(s.bufs, i)) return true;
+  }
+  return false;
 }
 
+bool depends_on(const interval_expr& e, symbol_id var) { return depends_on(e.min, var) || depends_on(e.max, var); }
+
 bool depends_on(const stmt& s, symbol_id var) {
-  if (!s.defined()) return false;
   symbol_id vars[] = {var};
-  dependencies v(vars);
-  s.accept(&v);
-  return v.found_var || v.found_buf;
+  return depends_on(s, vars);
 }
 
 bool depends_on(const stmt& s, span<const symbol_id> vars) {
   if (!s.defined()) return false;
-  dependencies v(vars);
-  s.accept(&v);
-  return v.found_var || v.found_buf;
+  const symbol_summary& summary = summarize(s.get());
+  for (symbol_id i : vars) {
+    if (contains_sorted(summary.vars, i) || contains_sorted(summary.bufs, i)) return true;
+  }
+  return false;
 }
 
 bool depends_on_variable(const expr& e, symbol_id var) {
   if (!e.defined()) return false;
-  symbol_id vars[] = {var};
-  dependencies v(vars);
-  e.accept(&v);
-  return v.found_var;
+  if (const symbol_id* sym = as_variable(e)) return *sym == var;
+  return contains_sorted(summarize(e.get()).vars, var);
 }
 
 bool depends_on_buffer(const expr& e, symbol_id buf) {
-  if (!e.defined()) return false;
-  symbol_id bufs[] = {buf};
-  dependencies v(bufs);
-  e.accept(&v);
-  return v.found_buf;
+  if (!e.defined() || e.as<variable>()) return false;
+  return contains_sorted(summarize(e.get()).bufs, buf);
+}
+
+std::vector<symbol_id> find_dependencies(const expr& e) {
+  if (!e.defined()) return {};
+  if (const symbol_id* sym = as_variable(e)) return {*sym};
+  const symbol_summary& s = summarize(e.get());
+  std::vector<symbol_id> result;
+  result.reserve(s.vars.size() + s.bufs.size());
+  std::set_union(s.vars.begin(), s.vars.end(), s.bufs.begin(), s.bufs.end(), std::back_inserter(result));
+  return result;
 }
 
 }  // namespace slinky
@@ -1,12 +1,15 @@
 #ifndef SLINKY_RUNTIME_DEPENDS_ON_H
 #define SLINKY_RUNTIME_DEPENDS_ON_H
 
+#include <vector>
+
 #include "runtime/expr.h"
 
 namespace slinky {
 
 // Check if the node depends on a symbol or set of symbols.
 bool depends_on(const expr& e, symbol_id var);
+bool depends_on(const expr& e, span<const symbol_id> vars);
 bool depends_on(const interval_expr& e, symbol_id var);
 bool depends_on(const stmt& s, symbol_id var);
 bool depends_on(const stmt& s, span<const symbol_id> vars);
@@ -16,6 +19,9 @@ bool depends_on(const stmt& s, span<const symbol_id> vars);
 bool depends_on_variable(const expr& e, symbol_id var);
 bool depends_on_buffer(const expr& e, symbol_id buf);
 
+// Find the symbols `e` depends on, either as a variable or a buffer, in sorted order.
+std::vector<symbol_id> find_dependencies(const expr& e);
+
 }  // namespace slinky
 
 #endif  // SLINKY_RUNTIME_DEPENDS_ON_H
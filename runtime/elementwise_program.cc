@@ -0,0 +1,384 @@
+#include "runtime/elementwise_program.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <type_traits>
+
+#include "runtime/depends_on.h"
+#include "runtime/print.h"
+#include "runtime/util.h"
+
+namespace slinky {
+
+namespace {
+
+template <typename T>
+class compiler : public recursive_node_visitor {
+  using program = elementwise_program<T>;
+  using opcode = typename program::op;
+  using instruction = typename program::instruction;
+
+  const std::vector<symbol_id>& inputs;
+  symbol_map<int> lets;
+  // Reuse the result of nodes that appear more than once. This is only valid within one let scope.
+  std::map<const base_expr_node*, int> compiled;
+  int result = -1;
+
+public:
+  std::vector<instruction> instructions;
+  std::vector<expr> divisors;
+
+  compiler(const std::vector<symbol_id>& inputs) : inputs(inputs) {}
+
+  int compile(const expr& e) {
+    auto i = compiled.find(e.get());
+    if (i != compiled.end()) return i->second;
+    e.accept(this);
+    compiled[e.get()] = result;
+    return result;
+  }
+
+  void emit(opcode code, int a = -1, int b = -1, int c = -1, index_t value = 0) {
+    instruction i;
+    i.code = code;
+    i.dst = static_cast<int>(instructions.size());
+    i.a = a;
+    i.b = b;
+    i.c = c;
+    i.value = value;
+    instructions.push_back(i);
+    result = i.dst;
+  }
+
+  [[noreturn]] void unsupported(const expr& e) {
+    std::cerr << "Unsupported expression in elementwise_program: " << e << std::endl;
+    std::abort();
+  }
+
+  void visit(const variable* op) override {
+    if (std::optional<int> value = lets[op->sym]) {
+      result = *value;
+      return;
+    }
+    auto i = std::find(inputs.begin(), inputs.end(), op->sym);
+    if (i != inputs.end()) {
+      emit(opcode::load, -1, -1, -1, i - inputs.begin());
+    } else {
+      emit(opcode::scalar, -1, -1, -1, op->sym);
+    }
+  }
+  void visit(const wildcard* op) override { unsupported(expr(op)); }
+  void visit(const constant* op) override { emit(opcode::constant, -1, -1, -1, op->value); }
+  void visit(const let* op) override {
+    int value = compile(op->value);
+    compiled.clear();
+    {
+      auto set_value = set_value_in_scope(lets, op->sym, value);
+      result = compile(op->body);
+    }
+    compiled.clear();
+  }
+
+  template <typename Node>
+  void visit_binary(opcode code, const Node* op) {
+    int a = compile(op->a);
+    int b = compile(op->b);
+    emit(code, a, b);
+  }
+
+  void visit(const add* op) override { visit_binary(opcode::add, op); }
+  void visit(const sub* op) override { visit_binary(opcode::sub, op); }
+  void visit(const mul* op) override { visit_binary(opcode::mul, op); }
+  // Returns true if `e` is the same for every element.
+  bool is_invariant(const expr& e) {
+    for (symbol_id i : find_dependencies(e)) {
+      if (lets.contains(i) || std::find(inputs.begin(), inputs.end(), i) != inputs.end()) return false;
+    }
+    return true;
+  }
+
+  // Divisions by a value that is the same for every element are strength reduced when the program is evaluated.
+  template <typename Node>
+  void visit_div(opcode code, opcode invariant_code, const Node* op) {
+    int a = compile(op->a);
+    if (is_invariant(op->b)) {
+      emit(invariant_code, a, -1, -1, divisors.size());
+      divisors.push_back(op->b);
+    } else {
+      emit(code, a, compile(op->b));
+    }
+  }
+
+  void visit(const div* op) override { visit_div(opcode::div, opcode::div_invariant, op); }
+  void visit(const mod* op) override { visit_div(opcode::mod, opcode::mod_invariant, op); }
+  void visit(const class min* op) override { visit_binary(opcode::min, op); }
+  void visit(const class max* op) override { visit_binary(opcode::max, op); }
+  void visit(const equal* op) override { visit_binary(opcode::equal, op); }
+  void visit(const not_equal* op) override { visit_binary(opcode::not_equal, op); }
+  void visit(const less* op) override { visit_binary(opcode::less, op); }
+  void visit(const less_equal* op) override { visit_binary(opcode::less_equal, op); }
+  void visit(const logical_and* op) override { visit_binary(opcode::logical_and, op); }
+  void visit(const logical_or* op) override { visit_binary(opcode::logical_or, op); }
+  void visit(const logical_not* op) override { emit(opcode::logical_not, compile(op->a)); }
+  void visit(const select_expr* op) override {
+    int c = compile(op->condition);
+    int t = compile(op->true_value);
+    int f = compile(op->false_value);
+    emit(opcode::select, c, t, f);
+  }
+  void visit(const call* op) override {
+    if (op->intrinsic == intrinsic::abs) {
+      assert(op->args.size() == 1);
+      emit(opcode::abs, compile(op->args[0]));
+    } else {
+      unsupported(expr(op));
+    }
+  }
+};
+
+// Reassign the registers of `program` (where each instruction initially writes its own register), so registers are
+// reused after their last use. Returns the number of registers needed.
+template <typename T>
+int allocate_registers(std::vector<typename elementwise_program<T>::instruction>& program, int& result) {
+  std::vector<int> last_use(program.size(), -1);
+  for (int i = 0; i < static_cast<int>(program.size()); ++i) {
+    for (int r : {program[i].a, program[i].b, program[i].c}) {
+      if (r >= 0) last_use[r] = i;
+    }
+  }
+  // The result is needed after the program runs.
+  last_use[result] = program.size();
+
+  std::vector<int> mapping(program.size(), -1);
+  std::vector<int> free_registers;
+  int count = 0;
+  for (int i = 0; i < static_cast<int>(program.size()); ++i) {
+    auto& inst = program[i];
+    // Allocate the destination before releasing the operands, so the destination does not alias an operand.
+    if (free_registers.empty()) {
+      mapping[i] = count++;
+    } else {
+      mapping[i] = free_registers.back();
+      free_registers.pop_back();
+    }
+    inst.dst = mapping[i];
+    for (int* r : {&inst.a, &inst.b, &inst.c}) {
+      if (*r < 0) continue;
+      int old = *r;
+      *r = mapping[old];
+      if (last_use[old] == i) {
+        free_registers.push_back(mapping[old]);
+        last_use[old] = -1;
+      }
+    }
+    if (last_use[i] < 0) {
+      // This value is never used.
+      free_registers.push_back(mapping[i]);
+    }
+  }
+  result = mapping[result];
+  return count;
+}
+
+template <typename T>
+void load(T* dst, const void* src, index_t stride, index_t n) {
+  if (stride == sizeof(T)) {
+    memcpy(dst, src, n * sizeof(T));
+  } else if (stride == 0) {
+    std::fill(dst, dst + n, *reinterpret_cast<const T*>(src));
+  } else {
+    for (index_t i = 0; i < n; ++i) {
+      dst[i] = *offset_bytes(reinterpret_cast<const T*>(src), i * stride);
+    }
+  }
+}
+
+template <typename T>
+void store(const T* src, void* dst, index_t stride, index_t n) {
+  if (stride == sizeof(T)) {
+    memcpy(dst, src, n * sizeof(T));
+  } else {
+    for (index_t i = 0; i < n; ++i) {
+      *offset_bytes(reinterpret_cast<T*>(dst), i * stride) = src[i];
+    }
+  }
+}
+
+// Division and modulus with the same semantics as `evaluate`. For unsigned types, these are just the usual operators,
+// except for division by zero.
+template <typename T>
+T div_impl(T a, T b) {
+  if constexpr (std::is_signed_v<T>) {
+    return euclidean_div(a, b);
+  } else {
+    return b != 0 ? a / b : 0;
+  }
+}
+template <typename T>
+T mod_impl(T a, T b) {
+  if constexpr (std::is_signed_v<T>) {
+    return euclidean_mod(a, b);
+  } else {
+    return b != 0 ? a % b : 0;
+  }
+}
+
+// The kernels for each instruction. These always compute a whole block, even if only part of it is used, so the trip
+// count is a constant and the compiler can vectorize these loops without generating a scalar epilogue. Registers
+// never alias each other.
+template <typename T>
+using unsigned_t = std::make_unsigned_t<T>;
+
+// Converts an unsigned result of wrapping arithmetic back to T.
+template <typename T>
+T wrap(unsigned_t<T> x) {
+  return static_cast<T>(x);
+}
+
+template <typename T, typename Fn>
+void unary(T* __restrict r, const T* __restrict a, Fn fn) {
+  for (index_t i = 0; i < elementwise_program<T>::block_size; ++i) {
+    r[i] = fn(a[i]);
+  }
+}
+
+template <typename T, typename Fn>
+void binary(T* __restrict r, const T* __restrict a, const T* __restrict b, Fn fn) {
+  for (index_t i = 0; i < elementwise_program<T>::block_size; ++i) {
+    r[i] = fn(a[i], b[i]);
+  }
+}
+
+template <typename T>
+void select(T* __restrict r, const T* __restrict c, const T* __restrict t, const T* __restrict f) {
+  for (index_t i = 0; i < elementwise_program<T>::block_size; ++i) {
+    // Load both values unconditionally, so this is a blend instead of a branch.
+    T ti = t[i];
+    T fi = f[i];
+    r[i] = c[i] != 0 ? ti : fi;
+  }
+}
+
+// The number of elements from `x` in dimension 0 of `buf` that are contiguous (not split by a fold).
+index_t contiguous_extent(const raw_buffer& buf, index_t x) {
+  const dim& d = buf.dim(0);
+  if (d.fold_factor() == dim::unfolded) return std::numeric_limits<index_t>::max();
+  return d.fold_factor() - euclidean_mod(x - d.min(), d.fold_factor());
+}
+
+}  // namespace
+
+template <typename T>
+elementwise_program<T>::elementwise_program(const expr& e, const std::vector<symbol_id>& inputs) {
+  compiler<T> c(inputs);
+  result_ = c.compile(e);
+  program_ = std::move(c.instructions);
+  divisors_ = std::move(c.divisors);
+  registers_ = allocate_registers<T>(program_, result_);
+}
+
+template <typename T>
+void elementwise_program<T>::evaluate(eval_context& ctx, span<const raw_buffer*> inputs, const raw_buffer& out) const {
+  const std::size_t rank = out.rank;
+  for (std::size_t d = 0; d < rank; ++d) {
+    if (out.dim(d).extent() <= 0) return;
+  }
+
+  std::vector<T> registers(registers_ * block_size);
+
+  std::vector<invariant_divisor<T>> divisors(divisors_.size());
+  for (std::size_t i = 0; i < divisors_.size(); ++i) {
+    divisors[i] = static_cast<T>(slinky::evaluate(divisors_[i], ctx));
+  }
+  std::vector<const void*> input_ptrs(inputs.size());
+  std::vector<index_t> index(rank);
+
+  // Computes `n` elements of the output, starting at `index`.
+  auto run_block = [&](index_t n) {
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+      input_ptrs[i] = inputs[i]->address_at(index);
+    }
+    for (const instruction& i : program_) {
+      T* r = &registers[i.dst * block_size];
+      const T* a = i.a >= 0 ? &registers[i.a * block_size] : nullptr;
+      const T* b = i.b >= 0 ? &registers[i.b * block_size] : nullptr;
+      const T* c = i.c >= 0 ? &registers[i.c * block_size] : nullptr;
+      switch (i.code) {
+      case op::load: load(r, input_ptrs[i.value], rank > 0 ? inputs[i.value]->dim(0).stride() : 0, n); break;
+      case op::scalar: std::fill(r, r + n, static_cast<T>(ctx.get(i.value))); break;
+      case op::constant: std::fill(r, r + n, static_cast<T>(i.value)); break;
+      case op::add: binary(r, a, b, [](T a, T b) { return wrap<T>(unsigned_t<T>(a) + unsigned_t<T>(b)); }); break;
+      case op::sub: binary(r, a, b, [](T a, T b) { return wrap<T>(unsigned_t<T>(a) - unsigned_t<T>(b)); }); break;
+      case op::mul: binary(r, a, b, [](T a, T b) { return wrap<T>(unsigned_t<T>(a) * unsigned_t<T>(b)); }); break;
+      case op::div: binary(r, a, b, div_impl<T>); break;
+      case op::mod: binary(r, a, b, mod_impl<T>); break;
+      case op::div_invariant: {
+        const invariant_divisor<T>& d = divisors[i.value];
+        unary(r, a, [&d](T a) { return d.div(a); });
+        break;
+      }
+      case op::mod_invariant: {
+        const invariant_divisor<T>& d = divisors[i.value];
+        unary(r, a, [&d](T a) { return d.mod(a); });
+        break;
+      }
+      case op::min: binary(r, a, b, [](T a, T b) { return std::min(a, b); }); break;
+      case op::max: binary(r, a, b, [](T a, T b) { return std::max(a, b); }); break;
+      case op::equal: binary(r, a, b, [](T a, T b) -> T { return a == b; }); break;
+      case op::not_equal: binary(r, a, b, [](T a, T b) -> T { return a != b; }); break;
+      case op::less: binary(r, a, b, [](T a, T b) -> T { return a < b; }); break;
+      case op::less_equal: binary(r, a, b, [](T a, T b) -> T { return a <= b; }); break;
+      case op::logical_and: binary(r, a, b, [](T a, T b) -> T { return (a != 0) & (b != 0); }); break;
+      case op::logical_or: binary(r, a, b, [](T a, T b) -> T { return (a != 0) | (b != 0); }); break;
+      case op::logical_not: unary(r, a, [](T a) -> T { return a == 0; }); break;
+      case op::select: select(r, a, b, c); break;
+      case op::abs: unary(r, a, [](T a) -> T { return a < 0 ? wrap<T>(-unsigned_t<T>(a)) : a; }); break;
+      }
+    }
+    store(&registers[result_ * block_size], out.address_at(index), rank > 0 ? out.dim(0).stride() : 0, n);
+  };
+
+  if (rank == 0) {
+    run_block(1);
+    return;
+  }
+
+  // Loop over the rows of the output, computing blocks of each row.
+  for (std::size_t d = 1; d < rank; ++d) {
+    index[d] = out.dim(d).min();
+  }
+  while (true) {
+    for (index_t x = out.dim(0).begin(); x < out.dim(0).end();) {
+      index_t n = std::min(block_size, out.dim(0).end() - x);
+      n = std::min(n, contiguous_extent(out, x));
+      for (const raw_buffer* i : inputs) {
+        n = std::min(n, contiguous_extent(*i, x));
+      }
+      index[0] = x;
+      run_block(n);
+      x += n;
+    }
+
+    // Move to the next row.
+    std::size_t d = 1;
+    for (; d < rank; ++d) {
+      if (++index[d] <= out.dim(d).max()) break;
+      index[d] = out.dim(d).min();
+    }
+    if (d == rank) break;
+  }
+}
+
+template class elementwise_program<std::int8_t>;
+template class elementwise_program<std::int16_t>;
+template class elementwise_program<std::int32_t>;
+template class elementwise_program<std::int64_t>;
+template class elementwise_program<std::uint8_t>;
+template class elementwise_program<std::uint16_t>;
+template class elementwise_program<std::uint32_t>;
+template class elementwise_program<std::uint64_t>;
+
+}  // namespace slinky
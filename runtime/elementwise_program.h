@@ -0,0 +1,95 @@
+#ifndef SLINKY_RUNTIME_ELEMENTWISE_PROGRAM_H
+#define SLINKY_RUNTIME_ELEMENTWISE_PROGRAM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "runtime/buffer.h"
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+
+namespace slinky {
+
+// An expression compiled to a sequence of instructions that each compute a block of elements at once, for evaluating
+// the expression elementwise over buffers. The instructions are simple loops over the elements of a block, which the
+// compiler can vectorize, and the cost of dispatching each instruction is amortized over the block.
+//
+// The expression is evaluated with the arithmetic of `T`, so the results differ from `evaluate` when it overflows.
+template <typename T>
+class elementwise_program {
+public:
+  // The number of elements computed by each instruction.
+  static constexpr index_t block_size = 256;
+
+  enum class op {
+    // Load the block of input `value`.
+    load,
+    // Broadcast the value of the variable `value` in the `eval_context`.
+    scalar,
+    // Broadcast the constant `value`.
+    constant,
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    // Divide `a` by the invariant divisor `value`, an expression that does not depend on the elements.
+    div_invariant,
+    mod_invariant,
+    min,
+    max,
+    equal,
+    not_equal,
+    less,
+    less_equal,
+    logical_and,
+    logical_or,
+    logical_not,
+    select,
+    abs,
+  };
+
+  struct instruction {
+    op code;
+    // The registers written and read by this instruction.
+    int dst;
+    int a = -1, b = -1, c = -1;
+    index_t value = 0;
+  };
+
+private:
+  std::vector<instruction> program_;
+  std::vector<expr> divisors_;
+  int registers_ = 0;
+  int result_ = -1;
+
+public:
+  // Variables of `e` that are in `inputs` refer to the element of that input at the same point as the output. Other
+  // variables are scalars, read from the `eval_context` when evaluating the program.
+  elementwise_program(const expr& e, const std::vector<symbol_id>& inputs);
+
+  // Computes each element of `out` from the elements of `inputs` at the same point. The inputs must be in the same
+  // order as the symbols given to the constructor, and contain the bounds of `out`. All of the buffers must have the
+  // same rank, and elements of type `T`.
+  void evaluate(eval_context& ctx, span<const raw_buffer*> inputs, const raw_buffer& out) const;
+
+  const std::vector<instruction>& program() const { return program_; }
+  // The divisors of the `div_invariant` and `mod_invariant` instructions, which are evaluated once per call to
+  // `evaluate`.
+  const std::vector<expr>& divisors() const { return divisors_; }
+  // The number of blocks of temporary storage needed to evaluate the program.
+  int register_count() const { return registers_; }
+};
+
+extern template class elementwise_program<std::int8_t>;
+extern template class elementwise_program<std::int16_t>;
+extern template class elementwise_program<std::int32_t>;
+extern template class elementwise_program<std::int64_t>;
+extern template class elementwise_program<std::uint8_t>;
+extern template class elementwise_program<std::uint16_t>;
+extern template class elementwise_program<std::uint32_t>;
+extern template class elementwise_program<std::uint64_t>;
+
+}  // namespace slinky
+
+#endif  // SLINKY_RUNTIME_ELEMENTWISE_PROGRAM_H
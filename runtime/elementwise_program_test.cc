@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "runtime/buffer.h"
+#include "runtime/elementwise_program.h"
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+
+using namespace slinky;
+
+namespace {
+
+node_context ctx;
+var x(ctx, "x");
+var y(ctx, "y");
+var z(ctx, "z");
+var s(ctx, "s");
+var t(ctx, "t");
+
+template <typename T>
+void init_random(buffer<T, 2>& b) {
+  b.allocate();
+  for_each_index(b, [&](auto i) { b(i) = (rand() % 40) - 20; });
+}
+
+// Evaluate `e` with `elementwise_program` over `inputs` (the values of x, y, z), and check the result against `evaluate`
+// for each element. The scalar `s` is 3.
+template <typename T>
+void test_program(const expr& e, std::vector<buffer<T, 2>*> inputs, buffer<T, 2>& out) {
+  std::vector<symbol_id> syms = {x.sym(), y.sym(), z.sym()};
+  syms.resize(inputs.size());
+  elementwise_program<T> program(e, syms);
+
+  eval_context eval_ctx;
+  eval_ctx[s] = 3;
+
+  std::vector<const raw_buffer*> input_ptrs(inputs.begin(), inputs.end());
+  program.evaluate(eval_ctx, input_ptrs, out);
+
+  for_each_index(out, [&](auto i) {
+    for (std::size_t j = 0; j < inputs.size(); ++j) {
+      eval_ctx[syms[j]] = (*inputs[j])(i);
+    }
+    ASSERT_EQ(out(i), static_cast<T>(evaluate(e, eval_ctx)));
+  });
+}
+
+template <typename T>
+void test_program(const expr& e, index_t width = 600, index_t height = 3) {
+  buffer<T, 2> bx({width, height}), by({width, height}), bz({width, height});
+  init_random(bx);
+  init_random(by);
+  init_random(bz);
+  buffer<T, 2> out({width, height});
+  out.allocate();
+  test_program<T>(e, {&bx, &by, &bz}, out);
+}
+
+}  // namespace
+
+TEST(elementwise_program, arithmetic) {
+  test_program<int>(x + y * z);
+  test_program<int>(x - y / 3);
+  test_program<int>(x % 4 + y / (z + 1));
+  test_program<int>(min(x, y) - max(y, z));
+  test_program<int>(abs(x - y));
+  test_program<std::int64_t>(select(x < y, x * s, z));
+  test_program<std::int16_t>((x == y) + (x != z) + (y < z) + (y <= x));
+  test_program<std::int8_t>((x < 0 && y < 0) || !(z < 0));
+  test_program<int>(let::make(t.sym(), x + y, t * t - z));
+  test_program<int>(s * 5 + 2);
+}
+
+TEST(elementwise_program, unsigned) {
+  test_program<std::uint8_t>(x / 3 + y % 5);
+  test_program<std::uint16_t>(max(x, y) * 3 - z);
+  test_program<std::uint32_t>(abs(x) + select(y, z, x));
+}
+
+TEST(elementwise_program, invariant_divisors) {
+  // Divisions by scalars and constants use a precomputed divisor.
+  expr e = x / s + y % 7 - z / -3 + x % (s - 3);
+  elementwise_program<int> program(e, {x.sym(), y.sym(), z.sym()});
+  int invariant = 0;
+  for (const auto& i : program.program()) {
+    if (i.code == elementwise_program<int>::op::div_invariant || i.code == elementwise_program<int>::op::mod_invariant) {
+      ++invariant;
+    }
+  }
+  ASSERT_EQ(invariant, 4);
+  test_program<int>(e);
+  test_program<std::int8_t>(x / 3 - y % s);
+  test_program<std::uint16_t>(x / 5 + y % s);
+  test_program<std::int64_t>(x / s * s + x % s);
+}
+
+TEST(elementwise_program, registers) {
+  // A large expression with many common subexpressions should not need many registers.
+  expr e = x;
+  for (int i = 0; i < 8; ++i) {
+    e = e * y + (e - z);
+  }
+  elementwise_program<int> program(e, {x.sym(), y.sym(), z.sym()});
+  ASSERT_LE(program.register_count(), 5);
+  test_program<int>(e);
+}
+
+TEST(elementwise_program, layouts) {
+  // A strided input, an input broadcasted in dimension 0, and a translated output.
+  buffer<int, 2> bx({20, 10});
+  bx.dim(0).set_stride(2 * sizeof(int));
+  bx.dim(1).set_stride(40 * sizeof(int));
+  init_random(bx);
+  buffer<int, 2> by({1, 10});
+  init_random(by);
+  by.dim(0).set_bounds(0, 19);
+  by.dim(0).set_stride(0);
+
+  buffer<int, 2> out({20, 10});
+  out.allocate();
+  test_program<int>(x + y, {&bx, &by}, out);
+
+  buffer<int, 2> cropped({10, 5});
+  cropped.translate(5, 3);
+  cropped.allocate();
+  test_program<int>(x - y, {&bx, &by}, cropped);
+}
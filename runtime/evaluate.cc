@@ -6,11 +6,14 @@
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "runtime/buffer.h"
 #include "runtime/depends_on.h"
@@ -63,8 +66,8 @@ namespace {
 
 // This is a very slow implementation of copy_stmt. The expectation is that copies will have been lowered to aliases or
 // calls to `copy` in buffer.h/cc instead of relying on this implementation.
-void copy_stmt_impl(
-    eval_context& ctx, const raw_buffer& src, const dim* dst_dims, void* dst_base, const copy_stmt& c, int dim) {
+void copy_stmt_impl(eval_context& ctx, const raw_buffer& src, const invariant_divisor<index_t>* src_folds,
+    const dim* dst_dims, void* dst_base, const copy_stmt& c, int dim) {
   const class dim& dst_dim = dst_dims[dim];
   index_t dst_stride = dst_dim.stride();
   for (index_t dst_x = dst_dim.begin(); dst_x < dst_dim.end(); ++dst_x) {
@@ -76,7 +79,7 @@ void copy_stmt_impl(
 
         index_t src_x = evaluate(c.src_x[d], ctx);
         if (src_dim.contains(src_x)) {
-          src_base = offset_bytes(src_base, src_dim.flat_offset_bytes(src_x));
+          src_base = offset_bytes(src_base, src_dim.flat_offset_bytes(src_x, src_folds[d]));
         } else {
           src_base = nullptr;
           break;
@@ -90,7 +93,7 @@ void copy_stmt_impl(
         // Leave unmodified.
       }
     } else {
-      copy_stmt_impl(ctx, src, dst_dims, dst_base, c, dim - 1);
+      copy_stmt_impl(ctx, src, src_folds, dst_dims, dst_base, c, dim - 1);
     }
     dst_base = offset_bytes(dst_base, dst_stride);
   }
@@ -106,37 +109,186 @@ void copy_stmt_impl(eval_context& ctx, const raw_buffer& src, const raw_buffer&
     assert(src.rank == 0);
     memcpy(dst.base, src.base, dst.elem_size);
   } else {
-    copy_stmt_impl(ctx, src, dst.dims, dst.base, c, dst.rank - 1);
+    // Every element of the copy computes an offset in each dimension of src.
+    std::vector<invariant_divisor<index_t>> src_folds(src.rank);
+    for (std::size_t d = 0; d < src.rank; ++d) {
+      src_folds[d] = src.dims[d].fold_divisor();
+    }
+    copy_stmt_impl(ctx, src, src_folds.data(), dst.dims, dst.base, c, dst.rank - 1);
   }
 }
 
-// TODO(https://github.com/dsharlet/slinky/issues/2): I think the T::accept/node_visitor::visit
-// overhead (two virtual function calls per node) might be significant. This could be implemented
-// as a switch statement instead.
-class evaluator : public node_visitor {
+// Evaluates expressions for every value of a loop variable at once, one node at a time for all of the values.
+// Subexpressions that do not depend on the loop variable are evaluated once.
+class column_evaluator {
+  eval_context& context;
+  symbol_id sym;
+  const std::vector<index_t>& values;
+
+  template <typename T, typename Fn>
+  bool visit_binary(const T* op, index_t* result, Fn fn) {
+    std::vector<index_t> b(values.size());
+    if (!eval(op->a, result) || !eval(op->b, b.data())) return false;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      result[i] = fn(result[i], b[i]);
+    }
+    return true;
+  }
+
+  template <typename T>
+  bool visit_div(const T* op, index_t* result, bool is_mod) {
+    if (depends_on(op->b, sym)) {
+      if (is_mod) return visit_binary(op, result, euclidean_mod<index_t>);
+      return visit_binary(op, result, euclidean_div<index_t>);
+    }
+    if (!eval(op->a, result)) return false;
+    invariant_divisor<index_t> d = evaluate(op->b, context);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      result[i] = is_mod ? d.mod(result[i]) : d.div(result[i]);
+    }
+    return true;
+  }
+
+public:
+  column_evaluator(eval_context& context, symbol_id sym, const std::vector<index_t>& values)
+      : context(context), sym(sym), values(values) {}
+
+  // Writes the value of `e` for each of `values` to `result`. Returns false if `e` has a node that depends on the loop
+  // variable and is not supported here.
+  bool eval(const expr& e, index_t* result) {
+    const std::size_t n = values.size();
+    if (!depends_on(e, sym)) {
+      std::fill(result, result + n, evaluate(e, context));
+      return true;
+    }
+    switch (e.type()) {
+    case node_type::variable: std::copy(values.begin(), values.end(), result); return true;
+    case node_type::add: return visit_binary(e.as<add>(), result, std::plus<index_t>());
+    case node_type::sub: return visit_binary(e.as<sub>(), result, std::minus<index_t>());
+    case node_type::mul: return visit_binary(e.as<mul>(), result, std::multiplies<index_t>());
+    case node_type::div: return visit_div(e.as<div>(), result, /*is_mod=*/false);
+    case node_type::mod: return visit_div(e.as<mod>(), result, /*is_mod=*/true);
+    case node_type::min:
+      return visit_binary(e.as<class min>(), result, [](index_t a, index_t b) { return std::min(a, b); });
+    case node_type::max:
+      return visit_binary(e.as<class max>(), result, [](index_t a, index_t b) { return std::max(a, b); });
+    case node_type::equal: return visit_binary(e.as<equal>(), result, std::equal_to<index_t>());
+    case node_type::not_equal: return visit_binary(e.as<not_equal>(), result, std::not_equal_to<index_t>());
+    case node_type::less: return visit_binary(e.as<less>(), result, std::less<index_t>());
+    case node_type::less_equal: return visit_binary(e.as<less_equal>(), result, std::less_equal<index_t>());
+    case node_type::select: {
+      const select_expr* op = e.as<select_expr>();
+      std::vector<index_t> t(n), f(n);
+      if (!eval(op->condition, result) || !eval(op->true_value, t.data()) || !eval(op->false_value, f.data())) {
+        return false;
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+        result[i] = result[i] ? t[i] : f[i];
+      }
+      return true;
+    }
+    default: return false;
+    }
+  }
+};
+
+// Finds the `crop_dim`s in a loop body, and the symbols declared by the body.
+class crop_table_candidates : public recursive_visitor<crop_table_candidates> {
+public:
+  std::vector<const crop_dim*> crops;
+  std::vector<symbol_id> declared;
+
+  using recursive_visitor::visit;
+
+  // The bounds of crops in a conditional body might not be valid to evaluate when the condition is false.
+  void visit(const if_then_else* op) {}
+
+  template <typename T>
+  void visit_decl(const T* op) {
+    declared.push_back(op->sym);
+    recursive_visitor::visit(op);
+  }
+
+  void visit(const let_stmt* op) { visit_decl(op); }
+  void visit(const loop* op) { visit_decl(op); }
+  void visit(const allocate* op) { visit_decl(op); }
+  void visit(const make_buffer* op) { visit_decl(op); }
+  void visit(const clone_buffer* op) { visit_decl(op); }
+  void visit(const crop_buffer* op) { visit_decl(op); }
+  void visit(const slice_buffer* op) { visit_decl(op); }
+  void visit(const slice_dim* op) { visit_decl(op); }
+  void visit(const truncate_rank* op) { visit_decl(op); }
+  void visit(const crop_dim* op) {
+    crops.push_back(op);
+    visit_decl(op);
+  }
+
+  // Returns the crops in the body of `op` that could use a crop table.
+  static std::vector<const crop_dim*> find(const loop* op) {
+    crop_table_candidates candidates;
+    candidates.visit(op->body);
+    std::vector<const crop_dim*> result;
+    for (const crop_dim* c : candidates.crops) {
+      // Crops that don't depend on the loop are cheap to evaluate without a table, and crops that depend on symbols
+      // declared in the loop body can't be evaluated before running it.
+      if (!depends_on(c->bounds, op->sym)) continue;
+      if (depends_on(c->bounds.min, candidates.declared) || depends_on(c->bounds.max, candidates.declared)) continue;
+      result.push_back(c);
+    }
+    return result;
+  }
+};
+
+// The bounds of a `crop_dim` for each iteration of a loop, see `eval_context::crop_table_max_iterations`.
+struct crop_table {
+  const crop_dim* op;
+  symbol_id loop_sym;
+  index_t loop_min;
+  index_t loop_step;
+  // These are empty if the corresponding bound is undefined.
+  std::vector<index_t> min;
+  std::vector<index_t> max;
+};
+
+// The evaluator dispatches on the node type with a switch (see `dispatch`), rather than using the two virtual calls per
+// node of `accept`/`node_visitor::visit`.
+class evaluator {
 public:
   index_t result = 0;
   eval_context& context;
+  // The crop tables of the loops being evaluated.
+  std::vector<const crop_table*> crop_tables;
+  // The candidates for crop tables in the body of each loop this evaluator has run, so loops that run many times only
+  // find them once.
+  std::map<const loop*, std::vector<const crop_dim*>> crop_candidates;
 
   evaluator(eval_context& context) : context(context) {}
 
-  // Skip the visitor pattern (two virtual function calls) for some frequently used node types.
-  void visit(const expr& op) {
-    switch (op.type()) {
-    case node_type::variable: visit(reinterpret_cast<const variable*>(op.get())); return;
-    case node_type::constant: visit(reinterpret_cast<const constant*>(op.get())); return;
-    default: op.accept(this);
-    }
+  // Adds `n` to `counter` of the context's stats. This compiles to nothing unless SLINKY_EVAL_STATS is defined.
+  void count(std::atomic<index_t> eval_stats::*counter, index_t n = 1) {
+#ifdef SLINKY_EVAL_STATS
+    if (context.stats) (context.stats->*counter).fetch_add(n, std::memory_order_relaxed);
+#endif
+  }
+  void count_node(const base_node* n) {
+#ifdef SLINKY_EVAL_STATS
+    if (context.stats) context.stats->nodes[static_cast<int>(n->type)].fetch_add(1, std::memory_order_relaxed);
+#endif
   }
 
+  void count_pattern(eval_pattern p) {
+#ifdef SLINKY_EVAL_STATS
+    if (context.stats) context.stats->patterns[static_cast<int>(p)].fetch_add(1, std::memory_order_relaxed);
+#endif
+  }
+
+  void visit(const expr& op) {
+    count_node(op.get());
+    dispatch(*this, op.get());
+  }
   void visit(const stmt& op) {
-    switch (op.type()) {
-    // case node_type::call_stmt: visit(reinterpret_cast<const call_stmt*>(op.get())); return;
-    // case node_type::crop_dim: visit(reinterpret_cast<const crop_dim*>(op.get())); return;
-    // case node_type::slice_dim: visit(reinterpret_cast<const slice_dim*>(op.get())); return;
-    // case node_type::block: visit(reinterpret_cast<const block*>(op.get())); return;
-    default: op.accept(this);
-    }
+    count_node(op.get());
+    dispatch(*this, op.get());
   }
 
   // Assume `e` is defined, evaluate it and return the result.
@@ -156,20 +308,14 @@ public:
     }
   }
 
-  void visit(const variable* op) override {
-    auto value = context.lookup(op->sym);
-    assert(value);
-    result = *value;
-  }
+  void visit(const variable* op) { result = context.get(op->sym); }
 
-  void visit(const wildcard* op) override {
+  void visit(const wildcard* op) {
     // Maybe evaluating this should just be an error.
-    auto value = context.lookup(op->sym);
-    assert(value);
-    result = *value;
+    result = context.get(op->sym);
   }
 
-  void visit(const constant* op) override { result = op->value; }
+  void visit(const constant* op) { result = op->value; }
 
   template <typename T>
   void visit_let(const T* op) {
@@ -177,25 +323,133 @@ public:
     visit(op->body);
   }
 
-  void visit(const let* op) override { visit_let(op); }
-  void visit(const let_stmt* op) override { visit_let(op); }
-
-  void visit(const add* op) override { result = eval_expr(op->a) + eval_expr(op->b); }
-  void visit(const sub* op) override { result = eval_expr(op->a) - eval_expr(op->b); }
-  void visit(const mul* op) override { result = eval_expr(op->a) * eval_expr(op->b); }
-  void visit(const div* op) override { result = euclidean_div(eval_expr(op->a), eval_expr(op->b)); }
-  void visit(const mod* op) override { result = euclidean_mod(eval_expr(op->a), eval_expr(op->b)); }
-  void visit(const class min* op) override { result = std::min(eval_expr(op->a), eval_expr(op->b)); }
-  void visit(const class max* op) override { result = std::max(eval_expr(op->a), eval_expr(op->b)); }
-  void visit(const equal* op) override { result = eval_expr(op->a) == eval_expr(op->b); }
-  void visit(const not_equal* op) override { result = eval_expr(op->a) != eval_expr(op->b); }
-  void visit(const less* op) override { result = eval_expr(op->a) < eval_expr(op->b); }
-  void visit(const less_equal* op) override { result = eval_expr(op->a) <= eval_expr(op->b); }
-  void visit(const logical_and* op) override { result = eval_expr(op->a) != 0 && eval_expr(op->b) != 0; }
-  void visit(const logical_or* op) override { result = eval_expr(op->a) != 0 || eval_expr(op->b) != 0; }
-  void visit(const logical_not* op) override { result = eval_expr(op->a) == 0; }
-
-  void visit(const select_expr* op) override {
+  void visit(const let* op) { visit_let(op); }
+  void visit(const let_stmt* op) { visit_let(op); }
+
+  // The superinstructions (see `eval_pattern`). These return false without evaluating anything if `op` does not have
+  // the shape of the pattern. They count the nodes they evaluate below `op`, so the node counts in `eval_stats` do not
+  // depend on which patterns match.
+  bool eval_buffer_dim(const call* op, index_t& value) {
+    switch (op->intrinsic) {
+    case intrinsic::buffer_min:
+    case intrinsic::buffer_max:
+    case intrinsic::buffer_extent:
+    case intrinsic::buffer_stride:
+    case intrinsic::buffer_fold_factor: break;
+    default: return false;
+    }
+    assert(op->args.size() == 2);
+    const variable* buf = op->args[0].as<variable>();
+    const constant* d = op->args[1].as<constant>();
+    if (!buf || !d) return false;
+    const raw_buffer* buffer = context.lookup_buffer(buf->sym);
+    assert(buffer);
+    assert(d->value < static_cast<index_t>(buffer->rank));
+    value = dim_metadata(op->intrinsic, buffer->dim(d->value));
+    count_node(buf);
+    count_node(d);
+    count_pattern(eval_pattern::buffer_dim);
+    return true;
+  }
+
+  bool eval_add_constant(const add* op, index_t& value) {
+    const constant* c = op->b.as<constant>();
+    if (!c) return false;
+    if (const variable* v = op->a.as<variable>()) {
+      value = context.get(v->sym) + c->value;
+    } else if (const call* fn = op->a.as<call>(); fn && eval_buffer_dim(fn, value)) {
+      value += c->value;
+    } else {
+      return false;
+    }
+    count_node(op->a.get());
+    count_node(c);
+    count_pattern(eval_pattern::add_constant);
+    return true;
+  }
+
+  bool eval_leaf(const expr& e, index_t& value) {
+    switch (e.type()) {
+    case node_type::variable: value = context.get(e.as<variable>()->sym); break;
+    case node_type::constant: value = e.as<constant>()->value; break;
+    case node_type::call:
+      if (!eval_buffer_dim(e.as<call>(), value)) return false;
+      break;
+    case node_type::add:
+      if (!eval_add_constant(e.as<add>(), value)) return false;
+      break;
+    default: return false;
+    }
+    count_node(e.get());
+    return true;
+  }
+
+  template <typename T, typename Fn>
+  bool eval_min_max(const T* op, index_t& value, Fn fn) {
+    index_t a, b;
+    if (!eval_leaf(op->a, a)) return false;
+    if (!eval_leaf(op->b, b)) {
+      // We already evaluated `a`, finish evaluating `op` without the superinstruction.
+      value = fn(a, eval_expr(op->b));
+      return true;
+    }
+    value = fn(a, b);
+    count_pattern(eval_pattern::min_max);
+    return true;
+  }
+
+  // Evaluates `Outer(Inner(x, y), z)`.
+  template <typename Outer, typename Inner, typename OuterFn, typename InnerFn>
+  bool eval_clamp(const Outer* op, index_t& value, OuterFn outer_fn, InnerFn inner_fn) {
+    const Inner* inner = op->a.template as<Inner>();
+    if (!inner) return false;
+    index_t x, y, z;
+    if (!eval_leaf(inner->a, x)) return false;
+    count_node(inner);
+    if (!eval_leaf(inner->b, y)) {
+      value = outer_fn(inner_fn(x, eval_expr(inner->b)), eval_expr(op->b));
+      return true;
+    }
+    if (!eval_leaf(op->b, z)) {
+      value = outer_fn(inner_fn(x, y), eval_expr(op->b));
+      return true;
+    }
+    value = outer_fn(inner_fn(x, y), z);
+    count_pattern(eval_pattern::clamp);
+    return true;
+  }
+
+  void visit(const add* op) {
+    if (eval_add_constant(op, result)) return;
+    result = eval_expr(op->a) + eval_expr(op->b);
+  }
+  void visit(const sub* op) { result = eval_expr(op->a) - eval_expr(op->b); }
+  void visit(const mul* op) { result = eval_expr(op->a) * eval_expr(op->b); }
+  void visit(const div* op) { result = euclidean_div(eval_expr(op->a), eval_expr(op->b)); }
+  void visit(const mod* op) { result = euclidean_mod(eval_expr(op->a), eval_expr(op->b)); }
+  void visit(const class min* op) {
+    auto min_fn = [](index_t a, index_t b) { return std::min(a, b); };
+    auto max_fn = [](index_t a, index_t b) { return std::max(a, b); };
+    if (eval_clamp<class min, class max>(op, result, min_fn, max_fn)) return;
+    if (eval_min_max(op, result, min_fn)) return;
+    result = std::min(eval_expr(op->a), eval_expr(op->b));
+  }
+  void visit(const class max* op) {
+    auto min_fn = [](index_t a, index_t b) { return std::min(a, b); };
+    auto max_fn = [](index_t a, index_t b) { return std::max(a, b); };
+    if (eval_clamp<class max, class min>(op, result, max_fn, min_fn)) return;
+    if (eval_min_max(op, result, max_fn)) return;
+    result = std::max(eval_expr(op->a), eval_expr(op->b));
+  }
+  void visit(const equal* op) { result = eval_expr(op->a) == eval_expr(op->b); }
+  void visit(const not_equal* op) { result = eval_expr(op->a) != eval_expr(op->b); }
+  void visit(const less* op) { result = eval_expr(op->a) < eval_expr(op->b); }
+  void visit(const less_equal* op) { result = eval_expr(op->a) <= eval_expr(op->b); }
+  void visit(const logical_and* op) { result = eval_expr(op->a) != 0 && eval_expr(op->b) != 0; }
+  void visit(const logical_or* op) { result = eval_expr(op->a) != 0 || eval_expr(op->b) != 0; }
+  void visit(const logical_not* op) { result = eval_expr(op->a) == 0; }
+
+  void visit(const select_expr* op) {
     if (eval_expr(op->condition)) {
       result = eval_expr(op->true_value);
     } else {
@@ -216,14 +470,8 @@ public:
     }
   }
 
-  index_t eval_dim_metadata(const call* op) {
-    assert(op->args.size() == 2);
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(eval_expr(op->args[0]));
-    assert(buffer);
-    index_t d = eval_expr(op->args[1]);
-    assert(d < static_cast<index_t>(buffer->rank));
-    const slinky::dim& dim = buffer->dim(d);
-    switch (op->intrinsic) {
+  static index_t dim_metadata(intrinsic fn, const slinky::dim& dim) {
+    switch (fn) {
     case intrinsic::buffer_min: return dim.min();
     case intrinsic::buffer_max: return dim.max();
     case intrinsic::buffer_extent: return dim.extent();
@@ -233,6 +481,15 @@ public:
     }
   }
 
+  index_t eval_dim_metadata(const call* op) {
+    assert(op->args.size() == 2);
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(eval_expr(op->args[0]));
+    assert(buffer);
+    index_t d = eval_expr(op->args[1]);
+    assert(d < static_cast<index_t>(buffer->rank));
+    return dim_metadata(op->intrinsic, buffer->dim(d));
+  }
+
   void* eval_buffer_at(const call* op) {
     assert(op->args.size() >= 1);
     raw_buffer* buf = reinterpret_cast<raw_buffer*>(eval_expr(op->args[0]));
@@ -246,7 +503,8 @@ public:
     return result;
   }
 
-  void visit(const call* op) override {
+  void visit(const call* op) {
+    if (eval_buffer_dim(op, result)) return;
     switch (op->intrinsic) {
     case intrinsic::positive_infinity: std::cerr << "Cannot evaluate positive_infinity" << std::endl; std::abort();
     case intrinsic::negative_infinity: std::cerr << "Cannot evaluate negative_infinity" << std::endl; std::abort();
@@ -273,15 +531,63 @@ public:
     }
   }
 
-  void visit(const block* op) override {
-    if (result == 0 && op->a.defined()) visit(op->a);
-    if (result == 0 && op->b.defined()) visit(op->b);
+  void visit(const block* op) {
+    for (const stmt& i : op->stmts) {
+      if (result != 0) break;
+      visit(i);
+    }
+  }
+
+  std::vector<crop_table> make_crop_tables(const loop* op, index_t min, index_t max, index_t step) {
+    std::vector<crop_table> tables;
+    if (context.crop_table_max_iterations <= 0 || step <= 0 || max < min) return tables;
+    const index_t n = (max - min) / step + 1;
+    if (n > context.crop_table_max_iterations) return tables;
+
+    auto candidates = crop_candidates.find(op);
+    if (candidates == crop_candidates.end()) {
+      candidates = crop_candidates.emplace(op, crop_table_candidates::find(op)).first;
+    }
+    if (candidates->second.empty()) return tables;
+
+    std::vector<index_t> values(n);
+    for (index_t i = 0; i < n; ++i) {
+      values[i] = min + i * step;
+    }
+    column_evaluator columns(context, op->sym, values);
+    for (const crop_dim* c : candidates->second) {
+      crop_table t{c, op->sym, min, step, {}, {}};
+      if (c->bounds.min.defined()) {
+        t.min.resize(n);
+        if (!columns.eval(c->bounds.min, t.min.data())) continue;
+      }
+      if (c->bounds.max.defined()) {
+        t.max.resize(n);
+        if (!columns.eval(c->bounds.max, t.max.data())) continue;
+      }
+      tables.push_back(std::move(t));
+    }
+    return tables;
+  }
+
+  const crop_table* find_crop_table(const crop_dim* op) const {
+    for (auto i = crop_tables.rbegin(); i != crop_tables.rend(); ++i) {
+      if ((*i)->op == op) return *i;
+    }
+    return nullptr;
   }
 
-  void visit(const loop* op) override {
+  void visit(const loop* op) {
     index_t min = eval_expr(op->bounds.min);
     index_t max = eval_expr(op->bounds.max);
     index_t step = eval_expr(op->step, 1);
+
+    const std::vector<crop_table> tables = make_crop_tables(op, min, max, step);
+    const std::size_t outer_crop_tables = crop_tables.size();
+    for (const crop_table& t : tables) {
+      crop_tables.push_back(&t);
+    }
+
     if (op->mode == loop_mode::parallel) {
       assert(context.enqueue_many);
       assert(context.wait_for);
@@ -306,14 +612,25 @@ public:
       // It is safe to capture op even though it's a pointer, because we only access it after we know that we're still
       // in this scope.
       // TODO: Can we do this without capturing context by value?
-      auto worker = [state, context = this->context, op]() mutable {
+      // The workers share the crop tables, which outlive any iteration of the loop.
+      auto worker = [state, context = this->context, crop_tables = this->crop_tables,
+                        crop_candidates = this->crop_candidates, op]() mutable {
         while (state->result == 0) {
           index_t i = state->i.fetch_add(state->step);
           if (!(state->min <= i && i <= state->max)) break;
 
+#ifdef SLINKY_EVAL_STATS
+          if (context.stats) context.stats->loop_iterations.fetch_add(1, std::memory_order_relaxed);
+#endif
           context[op->sym] = i;
           // Evaluate the parallel loop body with our copy of the context.
-          index_t result = evaluate(op->body, context);
+          evaluator eval(context);
+          eval.crop_tables = crop_tables;
+          // Each worker keeps the crop table candidates it finds for the iterations it runs.
+          eval.crop_candidates = std::move(crop_candidates);
+          eval.visit(op->body);
+          crop_candidates = std::move(eval.crop_candidates);
+          index_t result = eval.result;
           if (result != 0) {
             state->result = result;
           }
@@ -335,13 +652,15 @@ public:
       std::optional<index_t> old_value = context[op->sym];
       for (index_t i = min; result == 0 && min <= i && i <= max; i += step) {
         context[op->sym] = i;
+        count(&eval_stats::loop_iterations);
         visit(op->body);
       }
       context[op->sym] = old_value;
     }
+    crop_tables.resize(outer_crop_tables);
   }
 
-  void visit(const if_then_else* op) override {
+  void visit(const if_then_else* op) {
     if (eval_expr(op->condition)) {
       if (op->true_body.defined()) {
         visit(op->true_body);
@@ -353,8 +672,9 @@ public:
     }
   }
 
-  void visit(const call_stmt* op) override {
-    result = op->target(context);
+  void visit(const call_stmt* op) {
+    count(&eval_stats::call_stmts);
+    result = context.call ? context.call(op, context) : op->target(context);
     if (result) {
       if (context.call_failed) {
         context.call_failed(op);
@@ -365,14 +685,15 @@ public:
     }
   }
 
-  void visit(const copy_stmt* op) override {
+  void visit(const copy_stmt* op) {
     const raw_buffer* src = reinterpret_cast<raw_buffer*>(context.lookup(op->src, 0));
     const raw_buffer* dst = reinterpret_cast<raw_buffer*>(context.lookup(op->dst, 0));
+    count(&eval_stats::copy_stmts);
 
     copy_stmt_impl(context, *src, *dst, *op);
   }
 
-  void visit(const allocate* op) override {
+  void visit(const allocate* op) {
     std::size_t rank = op->dims.size();
     // Allocate a buffer with space for its dims on the stack.
     char* storage = reinterpret_cast<char*>(alloca(sizeof(raw_buffer) + sizeof(dim) * rank));
@@ -388,6 +709,11 @@ public:
       dim.set_fold_factor(eval_expr(op->dims[i].fold_factor, dim::unfolded));
     }
 
+    if constexpr (eval_stats_enabled) {
+      count(&eval_stats::allocations);
+      count(&eval_stats::allocated_bytes, buffer->size_bytes());
+    }
+
     if (op->storage == memory_type::stack) {
       buffer->base = alloca(buffer->size_bytes());
     } else {
@@ -414,7 +740,7 @@ public:
     }
   }
 
-  void visit(const make_buffer* op) override {
+  void visit(const make_buffer* op) {
     std::size_t rank = op->dims.size();
     // Allocate a buffer with space for its dims on the stack.
     char* storage = reinterpret_cast<char*>(alloca(sizeof(raw_buffer) + sizeof(dim) * rank));
@@ -435,8 +761,8 @@ public:
     visit(op->body);
   }
 
-  void visit(const clone_buffer* op) override {
-    raw_buffer* src = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const clone_buffer* op) {
+    raw_buffer* src = reinterpret_cast<raw_buffer*>(context.get(op->src));
     char* storage = reinterpret_cast<char*>(alloca(sizeof(raw_buffer) + sizeof(dim) * src->rank));
 
     raw_buffer* buffer = reinterpret_cast<raw_buffer*>(&storage[0]);
@@ -450,8 +776,8 @@ public:
     visit(op->body);
   }
 
-  void visit(const crop_buffer* op) override {
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const crop_buffer* op) {
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(context.get(op->sym));
     assert(buffer);
 
     struct interval {
@@ -493,15 +819,22 @@ public:
     }
   }
 
-  void visit(const crop_dim* op) override {
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const crop_dim* op) {
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(context.get(op->sym));
     assert(buffer);
     slinky::dim& dim = buffer->dims[op->dim];
     index_t old_min = dim.min();
     index_t old_max = dim.max();
 
-    index_t min = std::max(old_min, eval_expr(op->bounds.min, old_min));
-    index_t max = std::min(old_max, eval_expr(op->bounds.max, old_max));
+    index_t min, max;
+    if (const crop_table* t = crop_tables.empty() ? nullptr : find_crop_table(op)) {
+      const index_t i = (context.get(t->loop_sym) - t->loop_min) / t->loop_step;
+      min = t->min.empty() ? old_min : std::max(old_min, t->min[i]);
+      max = t->max.empty() ? old_max : std::min(old_max, t->max[i]);
+    } else {
+      min = std::max(old_min, eval_expr(op->bounds.min, old_min));
+      max = std::min(old_max, eval_expr(op->bounds.max, old_max));
+    }
 
     void* old_base = buffer->base;
     if (max >= min) {
@@ -518,8 +851,8 @@ public:
     dim.set_bounds(old_min, old_max);
   }
 
-  void visit(const slice_buffer* op) override {
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const slice_buffer* op) {
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(context.get(op->sym));
     assert(buffer);
 
     // TODO: If we really care about stack usage here, we could find the number of dimensions we actually need first.
@@ -547,8 +880,8 @@ public:
     buffer->dims = dims;
   }
 
-  void visit(const slice_dim* op) override {
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const slice_dim* op) {
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(context.get(op->sym));
     assert(buffer);
 
     // The rank of the result is equal to the current rank, less any sliced dimensions.
@@ -576,8 +909,8 @@ public:
     buffer->dims = old_dims;
   }
 
-  void visit(const truncate_rank* op) override {
-    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(*context.lookup(op->sym));
+  void visit(const truncate_rank* op) {
+    raw_buffer* buffer = reinterpret_cast<raw_buffer*>(context.get(op->sym));
     assert(buffer);
 
     std::size_t old_rank = buffer->rank;
@@ -588,7 +921,7 @@ public:
     buffer->rank = old_rank;
   }
 
-  void visit(const check* op) override {
+  void visit(const check* op) {
     result = eval_expr(op->condition, 0) != 0 ? 0 : 1;
     if (result) {
       if (context.check_failed) {
@@ -607,13 +940,13 @@ public:
 
 index_t evaluate(const expr& e, eval_context& context) {
   evaluator eval(context);
-  e.accept(&eval);
+  eval.visit(e);
   return eval.result;
 }
 
 index_t evaluate(const stmt& s, eval_context& context) {
   evaluator eval(context);
-  s.accept(&eval);
+  eval.visit(s);
   return eval.result;
 }
 
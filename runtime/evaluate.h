@@ -1,10 +1,52 @@
 #ifndef SLINKY_RUNTIME_EVALUATE_H
 #define SLINKY_RUNTIME_EVALUATE_H
 
+#include <atomic>
+
 #include "runtime/expr.h"
 
 namespace slinky {
 
+// Counters of the work done by the evaluator. These are only available if slinky is built with SLINKY_EVAL_STATS
+// defined (bazel --config=eval_stats); otherwise the instrumentation is compiled out of the evaluator entirely, and
+// `eval_context` has no `stats` member.
+#ifdef SLINKY_EVAL_STATS
+constexpr bool eval_stats_enabled = true;
+#else
+constexpr bool eval_stats_enabled = false;
+#endif
+
+// Shapes of expressions that the evaluator evaluates as one "superinstruction", without dispatching on each node. A leaf
+// is a variable, a constant, a `buffer_dim`, or an `add_constant`.
+enum class eval_pattern {
+  // A buffer_min/max/extent/stride/fold_factor of a variable buffer and a constant dimension.
+  buffer_dim,
+  // x + c, where x is a variable or a `buffer_dim`, and c is a constant.
+  add_constant,
+  // min(x, y) or max(x, y) of leaves.
+  min_max,
+  // min(max(x, y), z) or max(min(x, y), z) of leaves.
+  clamp,
+};
+
+struct eval_stats {
+  // The number of nodes of each type evaluated, indexed by `node_type`. This includes the nodes evaluated as part of a
+  // superinstruction.
+  std::atomic<index_t> nodes[static_cast<int>(node_type::check) + 1] = {};
+  // The number of times each superinstruction was evaluated, indexed by `eval_pattern`.
+  std::atomic<index_t> patterns[static_cast<int>(eval_pattern::clamp) + 1] = {};
+
+  std::atomic<index_t> loop_iterations{0};
+  std::atomic<index_t> call_stmts{0};
+  std::atomic<index_t> copy_stmts{0};
+  // Allocations and bytes allocated by `allocate` nodes, on the heap or the stack.
+  std::atomic<index_t> allocations{0};
+  std::atomic<index_t> allocated_bytes{0};
+
+  index_t node_count(node_type t) const { return nodes[static_cast<int>(t)]; }
+  index_t pattern_count(eval_pattern p) const { return patterns[static_cast<int>(p)]; }
+};
+
 // TODO: Probably shouldn't inherit here.
 class eval_context : public symbol_map<index_t> {
 public:
@@ -21,6 +63,16 @@ public:
   std::function<void(const expr&)> check_failed;
   std::function<void(const call_stmt*)> call_failed;
 
+  // If defined, this is called to evaluate `call_stmt`s, instead of calling `call_stmt::target` directly. It should
+  // call the target and return its result. This can be used to instrument calls, e.g. see `perf_profiler`.
+  std::function<index_t(const call_stmt*, eval_context&)> call;
+
+  // If defined, `pipeline::evaluate` calls this with its arguments before evaluating the pipeline. This can be used to
+  // record evaluations to reproduce them later, see `capture_to_files`.
+  using capture_fn =
+      std::function<void(span<const index_t> args, span<const raw_buffer*> inputs, span<const raw_buffer*> outputs)>;
+  capture_fn capture;
+
   // Functions implementing parallelism:
   // - `enqueue_many` should enqueue the task N times for asynchronous execution, where N is the maximum number of
   // instances that could be expected to run simultaneously.
@@ -32,9 +84,26 @@ public:
   std::function<void(task)> enqueue_one;
   std::function<void(std::function<bool()>)> wait_for;
 
-  const raw_buffer* lookup_buffer(symbol_id id) const { return reinterpret_cast<const raw_buffer*>(*lookup(id)); }
+#ifdef SLINKY_EVAL_STATS
+  // If not null, the evaluator accumulates counts of the work it does here. The counters are atomic, so the same
+  // `eval_stats` can be shared by parallel loop bodies.
+  eval_stats* stats = nullptr;
+#endif
+
+  // If positive, loops with at most this many iterations evaluate the bounds of the `crop_dim`s in their body that only
+  // depend on the loop variable and values from outside the loop for all iterations up front, and look them up while
+  // running the loop. Crops under an `if_then_else` are not evaluated this way. The workers of parallel loops share
+  // these tables.
+  index_t crop_table_max_iterations = 0;
+
+  const raw_buffer* lookup_buffer(symbol_id id) const { return reinterpret_cast<const raw_buffer*>(get(id)); }
 };
 
+// Evaluation only reads the expression or statement (it does not even modify reference counts), so the same node can be
+// evaluated concurrently by multiple threads with different contexts. The one exception is the cache of the symbols a
+// node depends on (`base_node::symbols`), which evaluation may fill via `depends_on` (for crop tables, and to report
+// failed checks). The cache is published with a compare-and-swap, so concurrent evaluations that fill it at the same
+// time each see a complete summary, and all but one of them discard theirs.
 index_t evaluate(const expr& e, eval_context& context);
 index_t evaluate(const stmt& s, eval_context& context);
 index_t evaluate(const expr& e);
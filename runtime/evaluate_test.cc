@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
 
 #include <cassert>
+#include <type_traits>
+#include <utility>
 
+#include "runtime/buffer.h"
+#include "runtime/depends_on.h"
 #include "runtime/evaluate.h"
 #include "runtime/expr.h"
 #include "runtime/thread_pool.h"
@@ -36,6 +40,33 @@ TEST(evaluate, arithmetic) {
   ASSERT_EQ(evaluate((x + 2) / 3, context), 2);
 }
 
+TEST(evaluate, context) {
+  node_context ctx;
+  var x(ctx, "x");
+  var y(ctx, "y");
+
+  eval_context context;
+  ASSERT_FALSE(context.contains(x));
+  ASSERT_FALSE(context.lookup(y));
+
+  context[y] = -1;
+  ASSERT_FALSE(context.contains(x));
+  ASSERT_EQ(*context[y], -1);
+  ASSERT_EQ(context.lookup(x, 3), 3);
+  {
+    auto set_x = set_value_in_scope<index_t>(context, x.sym(), 7);
+    ASSERT_EQ(*context.lookup(x), 7);
+    ASSERT_EQ(evaluate(x + y, context), 6);
+  }
+  ASSERT_FALSE(context.contains(x));
+
+  std::optional<index_t> old_y = context[y];
+  context[y] = std::nullopt;
+  ASSERT_FALSE(context.contains(y));
+  context[y] = old_y;
+  ASSERT_EQ(context.get(y), -1);
+}
+
 TEST(evaluate, call) {
   node_context ctx;
   var x(ctx, "x");
@@ -83,3 +114,219 @@ TEST(evaluate, loop) {
     ASSERT_EQ(sum_x, 2 + 5 + 8 + 11);
   }
 }
+
+// Detects whether `T` has a `stats` member.
+template <typename T, typename = void>
+struct has_stats : std::false_type {};
+template <typename T>
+struct has_stats<T, std::void_t<decltype(std::declval<T>().stats)>> : std::true_type {};
+
+// Without SLINKY_EVAL_STATS, the instrumentation must not cost anything, not even a member of the context.
+static_assert(has_stats<eval_context>::value == eval_stats_enabled, "");
+
+#ifdef SLINKY_EVAL_STATS
+TEST(evaluate, stats) {
+  node_context ctx;
+  var x(ctx, "x");
+  var b(ctx, "b");
+
+  thread_pool t;
+
+  for (loop_mode type : {loop_mode::serial, loop_mode::parallel}) {
+    eval_stats stats;
+    eval_context eval_ctx;
+    eval_ctx.enqueue_many = [&](const thread_pool::task& f) { t.enqueue(t.thread_count(), f); };
+    eval_ctx.enqueue_one = [&](thread_pool::task f) { t.enqueue(std::move(f)); };
+    eval_ctx.wait_for = [&](std::function<bool()> f) { t.wait_for(std::move(f)); };
+    eval_ctx.stats = &stats;
+
+    stmt c = call_stmt::make([](eval_context&) -> index_t { return 0; }, {}, {b.sym()});
+    stmt a = allocate::make(b.sym(), memory_type::heap, sizeof(int), {{{0, 9}, static_cast<index_t>(sizeof(int)), expr()}}, c);
+    stmt l = loop::make(x.sym(), type, range(0, 10), 1, a);
+
+    ASSERT_EQ(evaluate(l, eval_ctx), 0);
+
+    const index_t n = 10;
+    ASSERT_EQ(stats.loop_iterations, n);
+    ASSERT_EQ(stats.call_stmts, n);
+    ASSERT_EQ(stats.copy_stmts, 0);
+    ASSERT_EQ(stats.allocations, n);
+    ASSERT_EQ(stats.allocated_bytes, n * 10 * static_cast<index_t>(sizeof(int)));
+    ASSERT_EQ(stats.node_count(node_type::loop), 1);
+    ASSERT_EQ(stats.node_count(node_type::allocate), n);
+    ASSERT_EQ(stats.node_count(node_type::call_stmt), n);
+  }
+}
+#endif
+
+TEST(evaluate, superinstructions) {
+  node_context ctx;
+  var x(ctx, "x");
+  var y(ctx, "y");
+  var b(ctx, "b");
+
+  buffer<int, 2> buf({10, 20});
+  buf.translate(3, 4);
+
+  eval_context eval_ctx;
+#ifdef SLINKY_EVAL_STATS
+  eval_stats stats;
+  eval_ctx.stats = &stats;
+#endif
+  eval_ctx[x] = 5;
+  eval_ctx[y] = 30;
+  eval_ctx[b] = reinterpret_cast<index_t>(&buf);
+
+  ASSERT_EQ(evaluate(buffer_max(b, 1), eval_ctx), 23);
+  ASSERT_EQ(evaluate(buffer_extent(b, 0) + 2, eval_ctx), 12);
+  ASSERT_EQ(evaluate(min(x + 10, buffer_max(b, 0)), eval_ctx), 12);
+  ASSERT_EQ(evaluate(max(buffer_min(b, 1), x), eval_ctx), 5);
+  ASSERT_EQ(evaluate(min(max(y, buffer_min(b, 1)), buffer_max(b, 1)), eval_ctx), 23);
+  ASSERT_EQ(evaluate(max(min(x, buffer_max(b, 0)), buffer_min(b, 0) + 3), eval_ctx), 6);
+
+  // Expressions that only partially match a pattern.
+  ASSERT_EQ(evaluate(min(x, y * 2), eval_ctx), 5);
+  ASSERT_EQ(evaluate(max(min(x, y * 2), 1), eval_ctx), 5);
+  ASSERT_EQ(evaluate(max(min(x * 3, y), 1), eval_ctx), 15);
+  ASSERT_EQ(evaluate(buffer_min(b, x - 5), eval_ctx), 3);
+  ASSERT_EQ(evaluate(x + y, eval_ctx), 35);
+
+#ifdef SLINKY_EVAL_STATS
+  ASSERT_EQ(stats.pattern_count(eval_pattern::min_max), 2);
+  ASSERT_EQ(stats.pattern_count(eval_pattern::clamp), 2);
+  ASSERT_EQ(stats.pattern_count(eval_pattern::add_constant), 3);
+  ASSERT_EQ(stats.pattern_count(eval_pattern::buffer_dim), 8);
+
+  // The nodes of a superinstruction are counted as if they were evaluated one at a time.
+  eval_stats clamp_stats;
+  eval_ctx.stats = &clamp_stats;
+  ASSERT_EQ(evaluate(max(min(x, buffer_max(b, 0)), buffer_min(b, 0) + 3), eval_ctx), 6);
+  ASSERT_EQ(clamp_stats.pattern_count(eval_pattern::clamp), 1);
+  ASSERT_EQ(clamp_stats.node_count(node_type::max), 1);
+  ASSERT_EQ(clamp_stats.node_count(node_type::min), 1);
+  ASSERT_EQ(clamp_stats.node_count(node_type::add), 1);
+  ASSERT_EQ(clamp_stats.node_count(node_type::call), 2);
+  ASSERT_EQ(clamp_stats.node_count(node_type::variable), 3);
+  ASSERT_EQ(clamp_stats.node_count(node_type::constant), 3);
+#endif
+}
+
+TEST(evaluate, clone_buffer) {
+  node_context ctx;
+  var b(ctx, "b");
+  var c(ctx, "c");
+
+  buffer<int, 2> buf({10, 20});
+
+  eval_context context;
+  context[b] = reinterpret_cast<index_t>(&buf);
+
+  // The clone must copy the source buffer, not look up the (not yet declared) clone.
+  index_t c_min = -1, c_max = -1;
+  const raw_buffer* c_buf = nullptr;
+  stmt record = call_stmt::make(
+      [&](eval_context& ctx) -> index_t {
+        c_buf = ctx.lookup_buffer(c.sym());
+        c_min = c_buf->dim(1).min();
+        c_max = c_buf->dim(1).max();
+        return 0;
+      },
+      {}, {c.sym()});
+  stmt body = clone_buffer::make(c.sym(), b.sym(), crop_dim::make(c.sym(), 1, {2, 5}, record));
+  ASSERT_EQ(evaluate(body, context), 0);
+
+  ASSERT_NE(c_buf, &buf);
+  ASSERT_EQ(c_min, 2);
+  ASSERT_EQ(c_max, 5);
+  // Cropping the clone does not affect the source.
+  ASSERT_EQ(buf.dim(1).min(), 0);
+  ASSERT_EQ(buf.dim(1).max(), 19);
+}
+
+TEST(evaluate, crop_tables) {
+  node_context ctx;
+  var y(ctx, "y");
+  var n(ctx, "n");
+  var b(ctx, "b");
+  var c(ctx, "c");
+  var d(ctx, "d");
+
+  thread_pool t;
+
+  const int H = 20;
+  for (loop_mode type : {loop_mode::serial, loop_mode::parallel}) {
+    for (index_t max_iterations : {0, 10, 100}) {
+      buffer<int, 2> buf({10, 100});
+
+      eval_context eval_ctx;
+      eval_ctx.enqueue_many = [&](const thread_pool::task& f) { t.enqueue(t.thread_count(), f); };
+      eval_ctx.enqueue_one = [&](thread_pool::task f) { t.enqueue(std::move(f)); };
+      eval_ctx.wait_for = [&](std::function<bool()> f) { t.wait_for(std::move(f)); };
+      eval_ctx.crop_table_max_iterations = max_iterations;
+      eval_ctx[n] = 3;
+      eval_ctx[b] = reinterpret_cast<index_t>(&buf);
+
+      // Record the bounds of the crops in each iteration.
+      std::vector<index_t> mins(H), maxs(H), inner_mins(H);
+      stmt record = call_stmt::make(
+          [&](eval_context& ctx) -> index_t {
+            index_t i = *ctx[y];
+            mins[i] = ctx.lookup_buffer(b.sym())->dim(1).min();
+            maxs[i] = ctx.lookup_buffer(b.sym())->dim(1).max();
+            inner_mins[i] = ctx.lookup_buffer(c.sym())->dim(1).min();
+            return 0;
+          },
+          {}, {b.sym()});
+
+      // The inner crop depends on a buffer cropped in the loop, so it can't use a table.
+      stmt body = clone_buffer::make(c.sym(), b.sym(), crop_dim::make(c.sym(), 1, {buffer_min(b, 1) + 1, expr()}, record));
+      body = crop_dim::make(b.sym(), 1, {(y + 1) / n * 3 - min(y, 4), select(y < 5, y * 2, y % n + 50)}, body);
+      stmt l = loop::make(y.sym(), type, range(0, H), 1, body);
+      ASSERT_EQ(evaluate(l, eval_ctx), 0);
+
+      for (index_t i = 0; i < H; ++i) {
+        index_t min_i = std::max<index_t>(0, (i + 1) / 3 * 3 - std::min<index_t>(i, 4));
+        index_t max_i = i < 5 ? i * 2 : i % 3 + 50;
+        ASSERT_EQ(mins[i], min_i);
+        ASSERT_EQ(maxs[i], max_i);
+        ASSERT_EQ(inner_mins[i], min_i + 1);
+      }
+      // The crops are restored.
+      ASSERT_EQ(buf.dim(1).min(), 0);
+      ASSERT_EQ(buf.dim(1).max(), 99);
+
+      // The bounds of crops under a false condition are not evaluated, `d` is not defined here.
+      stmt guarded = if_then_else::make(n == 0, crop_dim::make(b.sym(), 1, {y + buffer_min(d, 0), expr()}, record));
+      ASSERT_EQ(evaluate(loop::make(y.sym(), type, range(0, H), 1, guarded), eval_ctx), 0);
+    }
+  }
+}
+
+TEST(depends_on, basic) {
+  node_context ctx;
+  var x(ctx, "x");
+  var y(ctx, "y");
+  var z(ctx, "z");
+  var b(ctx, "b");
+
+  expr e = x + buffer_min(b, 0) * y;
+  ASSERT_TRUE(depends_on(e, x.sym()));
+  ASSERT_TRUE(depends_on(e, y.sym()));
+  ASSERT_TRUE(depends_on(e, b.sym()));
+  ASSERT_FALSE(depends_on(e, z.sym()));
+  ASSERT_TRUE(depends_on_variable(e, x.sym()));
+  ASSERT_FALSE(depends_on_variable(e, b.sym()));
+  ASSERT_TRUE(depends_on_buffer(e, b.sym()));
+  ASSERT_FALSE(depends_on_buffer(e, x.sym()));
+  // The second query hits the cached summary, and must give the same answers.
+  ASSERT_TRUE(depends_on_variable(e, y.sym()));
+  ASSERT_FALSE(depends_on_buffer(e, y.sym()));
+
+  stmt s = block::make({check::make(e < 0), call_stmt::make(nullptr, {z.sym()}, {})});
+  ASSERT_TRUE(depends_on(s, x.sym()));
+  ASSERT_TRUE(depends_on(s, z.sym()));
+  symbol_id none[] = {ctx.insert("w")};
+  ASSERT_FALSE(depends_on(s, none));
+  symbol_id some[] = {none[0], y.sym()};
+  ASSERT_TRUE(depends_on(s, some));
+}
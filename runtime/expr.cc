@@ -295,7 +295,7 @@ expr select_expr::make(expr condition, expr true_value, expr false_value) {
   return n;
 }
 
-expr call::make(slinky::intrinsic i, std::vector<expr> args) {
+expr call::make(slinky::intrinsic i, small_vector<expr, 4> args) {
   auto n = new call();
   n->intrinsic = i;
   n->args = std::move(args);
@@ -311,7 +311,7 @@ stmt call_stmt::make(call_stmt::callable target, symbol_list inputs, symbol_list
 }
 
 stmt copy_stmt::make(
-    symbol_id src, std::vector<expr> src_x, symbol_id dst, std::vector<symbol_id> dst_x, std::vector<char> padding) {
+    symbol_id src, small_vector<expr, 4> src_x, symbol_id dst, std::vector<symbol_id> dst_x, std::vector<char> padding) {
   auto n = new copy_stmt();
   n->src = src;
   n->src_x = std::move(src_x);
@@ -321,10 +321,26 @@ stmt copy_stmt::make(
   return n;
 }
 
-stmt block::make(stmt a, stmt b) {
+stmt block::make(std::vector<stmt> stmts) {
+  // Remove undefined stmts and flatten nested blocks.
+  std::vector<stmt> flat;
+  flat.reserve(stmts.size());
+  for (stmt& i : stmts) {
+    if (!i.defined()) {
+      continue;
+    } else if (const block* b = i.as<block>()) {
+      flat.insert(flat.end(), b->stmts.begin(), b->stmts.end());
+    } else {
+      flat.push_back(std::move(i));
+    }
+  }
+  if (flat.empty()) {
+    return stmt();
+  } else if (flat.size() == 1) {
+    return std::move(flat.front());
+  }
   auto n = new block();
-  n->a = std::move(a);
-  n->b = std::move(b);
+  n->stmts = std::move(flat);
   return n;
 }
 
@@ -346,7 +362,8 @@ stmt if_then_else::make(expr condition, stmt true_body, stmt false_body) {
   return n;
 }
 
-stmt allocate::make(symbol_id sym, memory_type storage, std::size_t elem_size, std::vector<dim_expr> dims, stmt body) {
+stmt allocate::make(
+    symbol_id sym, memory_type storage, std::size_t elem_size, small_vector<dim_expr, 4> dims, stmt body) {
   auto n = new allocate();
   n->sym = sym;
   n->storage = storage;
@@ -356,7 +373,7 @@ stmt allocate::make(symbol_id sym, memory_type storage, std::size_t elem_size, s
   return n;
 }
 
-stmt make_buffer::make(symbol_id sym, expr base, expr elem_size, std::vector<dim_expr> dims, stmt body) {
+stmt make_buffer::make(symbol_id sym, expr base, expr elem_size, small_vector<dim_expr, 4> dims, stmt body) {
   auto n = new make_buffer();
   n->sym = sym;
   n->base = std::move(base);
@@ -374,7 +391,7 @@ stmt clone_buffer::make(symbol_id sym, symbol_id src, stmt body) {
   return n;
 }
 
-stmt crop_buffer::make(symbol_id sym, std::vector<interval_expr> bounds, stmt body) {
+stmt crop_buffer::make(symbol_id sym, box_expr bounds, stmt body) {
   auto n = new crop_buffer();
   n->sym = sym;
   n->bounds = std::move(bounds);
@@ -391,7 +408,7 @@ stmt crop_dim::make(symbol_id sym, int dim, interval_expr bounds, stmt body) {
   return n;
 }
 
-stmt slice_buffer::make(symbol_id sym, std::vector<expr> at, stmt body) {
+stmt slice_buffer::make(symbol_id sym, small_vector<expr, 4> at, stmt body) {
   auto n = new slice_buffer();
   n->sym = sym;
   n->at = std::move(at);
@@ -442,6 +459,7 @@ expr abs(expr x) { return call::make(intrinsic::abs, {std::move(x)}); }
 expr buffer_rank(expr buf) { return call::make(intrinsic::buffer_rank, {std::move(buf)}); }
 expr buffer_base(expr buf) { return call::make(intrinsic::buffer_base, {std::move(buf)}); }
 expr buffer_elem_size(expr buf) { return call::make(intrinsic::buffer_elem_size, {std::move(buf)}); }
+expr buffer_size_bytes(expr buf) { return call::make(intrinsic::buffer_size_bytes, {std::move(buf)}); }
 expr buffer_min(expr buf, expr dim) { return call::make(intrinsic::buffer_min, {std::move(buf), std::move(dim)}); }
 expr buffer_max(expr buf, expr dim) { return call::make(intrinsic::buffer_max, {std::move(buf), std::move(dim)}); }
 expr buffer_extent(expr buf, expr dim) {
@@ -455,13 +473,13 @@ expr buffer_fold_factor(expr buf, expr dim) {
 }
 
 expr buffer_at(expr buf, span<const expr> at) {
-  std::vector<expr> args = {buf};
+  small_vector<expr, 4> args = {buf};
   args.insert(args.end(), at.begin(), at.end());
   return call::make(intrinsic::buffer_at, std::move(args));
 }
 
 expr buffer_at(expr buf, span<const var> at) {
-  std::vector<expr> args = {buf};
+  small_vector<expr, 4> args = {buf};
   args.insert(args.end(), at.begin(), at.end());
   return call::make(intrinsic::buffer_at, std::move(args));
 }
@@ -470,8 +488,8 @@ interval_expr buffer_bounds(const expr& buf, const expr& dim) { return {buffer_m
 dim_expr buffer_dim(const expr& buf, const expr& dim) {
   return {buffer_bounds(buf, dim), buffer_stride(buf, dim), buffer_fold_factor(buf, dim)};
 }
-std::vector<dim_expr> buffer_dims(const expr& buf, int rank) {
-  std::vector<dim_expr> result;
+small_vector<dim_expr, 4> buffer_dims(const expr& buf, int rank) {
+  small_vector<dim_expr, 4> result;
   result.reserve(rank);
   for (int d = 0; d < rank; ++d) {
     result.push_back(buffer_dim(buf, d));
@@ -4,6 +4,8 @@
 #include "runtime/buffer.h"
 #include "runtime/util.h"
 
+#include <atomic>
+#include <cassert>
 #include <cstdlib>
 #include <functional>
 #include <initializer_list>
@@ -104,6 +106,14 @@ enum class intrinsic {
 
 class node_visitor;
 
+// The symbols referenced by a node and its children, as sorted lists. Symbols used as buffers (the first argument of a
+// buffer intrinsic, or the buffers of a `call_stmt` or `copy_stmt`) are tracked separately from symbols used as values.
+// See `depends_on`, which computes these lazily.
+struct symbol_summary {
+  std::vector<symbol_id> vars;
+  std::vector<symbol_id> bufs;
+};
+
 // The next few classes are the base of the expression (`expr`) and statement (`stmt`) mechanism.
 // `base_expr_node` is the base of `expr`s, and always produce an `index_t`-sized result when evaluated.
 // `base_stmt_node` is the base of `stmt`s, and do not produce any result.
@@ -111,11 +121,16 @@ class node_visitor;
 class base_node : public ref_counted {
 public:
   base_node(node_type type) : type(type) {}
+  ~base_node() { delete symbols.load(std::memory_order_relaxed); }
 
   virtual void accept(node_visitor* v) const = 0;
 
   node_type type;
 
+  // Cache of the symbols this node depends on, computed on demand by `depends_on`. This is the only state of a node
+  // that changes after it is made. It is published with a compare-and-swap, so it may be computed concurrently.
+  mutable std::atomic<const symbol_summary*> symbols{nullptr};
+
   template <typename T>
   const T* as() const {
     if (type == T::static_type) {
@@ -296,7 +311,9 @@ inline interval_expr operator*(const expr& a, const interval_expr& b) { return b
 inline interval_expr operator+(const expr& a, const interval_expr& b) { return b + a; }
 
 // A box is a multidimensional interval.
-using box_expr = std::vector<interval_expr>;
+// Most buffers have a small rank, so lists with an item per dimension (such as the bounds of a buffer) are stored in
+// small_vectors with room for a few items inline.
+using box_expr = small_vector<interval_expr, 4>;
 box_expr operator|(box_expr a, const box_expr& b);
 box_expr operator&(box_expr a, const box_expr& b);
 
@@ -441,11 +458,11 @@ public:
 class call : public expr_node<call> {
 public:
   slinky::intrinsic intrinsic;
-  std::vector<expr> args;
+  small_vector<expr, 4> args;
 
   void accept(node_visitor* v) const;
 
-  static expr make(slinky::intrinsic i, std::vector<expr> args);
+  static expr make(slinky::intrinsic i, small_vector<expr, 4> args);
 
   static constexpr node_type static_type = node_type::call;
 };
@@ -475,14 +492,15 @@ public:
 class copy_stmt : public stmt_node<copy_stmt> {
 public:
   symbol_id src;
-  std::vector<expr> src_x;
+  small_vector<expr, 4> src_x;
   symbol_id dst;
   std::vector<symbol_id> dst_x;
   std::vector<char> padding;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(symbol_id src, std::vector<expr> src_x, symbol_id dst, std::vector<symbol_id> dst_x, std::vector<char> padding);
+  static stmt make(symbol_id src, small_vector<expr, 4> src_x, symbol_id dst, std::vector<symbol_id> dst_x,
+      std::vector<char> padding);
 
   static constexpr node_type static_type = node_type::copy_stmt;
 };
@@ -501,31 +519,21 @@ public:
   static constexpr node_type static_type = node_type::let_stmt;
 };
 
-// A block is a set of two other `stmt`s. Recursively using blocks allows an arbitrarily large set of `stmt`s to be
-// defined in sequence.
+// A block is a sequence of `stmt`s, which are run in order.
 class block : public stmt_node<block> {
 public:
-  stmt a, b;
+  std::vector<stmt> stmts;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(stmt a, stmt b);
-  // Recursively create blocks to contain all of the `stmts`. This may not produce a block at all if `stmts` contains
-  // only one item.
+  // Make a block containing `stmts`. Undefined stmts are removed, and nested blocks are flattened into the new block.
+  // This may not produce a block at all if `stmts` contains only one (or no) defined stmt.
+  static stmt make(std::vector<stmt> stmts);
   static stmt make(span<stmt> stmts) { return make(stmts.begin(), stmts.end()); }
   static stmt make(std::initializer_list<stmt> stmts) { return make(stmts.begin(), stmts.end()); }
   template <typename It>
   static stmt make(It begin, It end) {
-    stmt result;
-    for (It i = begin; i != end; ++i) {
-      if (!i->defined()) continue;
-      if (result.defined()) {
-        result = block::make(result, *i);
-      } else {
-        result = *i;
-      }
-    }
-    return result;
+    return make(std::vector<stmt>(begin, end));
   }
 
   static constexpr node_type static_type = node_type::block;
@@ -585,12 +593,13 @@ public:
   memory_type storage;
   symbol_id sym;
   std::size_t elem_size;
-  std::vector<dim_expr> dims;
+  small_vector<dim_expr, 4> dims;
   stmt body;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(symbol_id sym, memory_type storage, std::size_t elem_size, std::vector<dim_expr> dims, stmt body);
+  static stmt make(
+      symbol_id sym, memory_type storage, std::size_t elem_size, small_vector<dim_expr, 4> dims, stmt body);
 
   static constexpr node_type static_type = node_type::allocate;
 };
@@ -602,12 +611,12 @@ public:
   symbol_id sym;
   expr base;
   expr elem_size;
-  std::vector<dim_expr> dims;
+  small_vector<dim_expr, 4> dims;
   stmt body;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(symbol_id sym, expr base, expr elem_size, std::vector<dim_expr> dims, stmt body);
+  static stmt make(symbol_id sym, expr base, expr elem_size, small_vector<dim_expr, 4> dims, stmt body);
 
   static constexpr node_type static_type = node_type::make_buffer;
 };
@@ -634,12 +643,12 @@ public:
 class crop_buffer : public stmt_node<crop_buffer> {
 public:
   symbol_id sym;
-  std::vector<interval_expr> bounds;
+  box_expr bounds;
   stmt body;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(symbol_id sym, std::vector<interval_expr> bounds, stmt body);
+  static stmt make(symbol_id sym, box_expr bounds, stmt body);
 
   static constexpr node_type static_type = node_type::crop_buffer;
 };
@@ -666,12 +675,12 @@ public:
 class slice_buffer : public stmt_node<slice_buffer> {
 public:
   symbol_id sym;
-  std::vector<expr> at;
+  small_vector<expr, 4> at;
   stmt body;
 
   void accept(node_visitor* v) const;
 
-  static stmt make(symbol_id sym, std::vector<expr> at, stmt body);
+  static stmt make(symbol_id sym, small_vector<expr, 4> at, stmt body);
 
   static constexpr node_type static_type = node_type::slice_buffer;
 };
@@ -806,8 +815,9 @@ public:
     if (op->body.defined()) op->body.accept(this);
   }
   virtual void visit(const block* op) override {
-    if (op->a.defined()) op->a.accept(this);
-    if (op->b.defined()) op->b.accept(this);
+    for (const stmt& i : op->stmts) {
+      i.accept(this);
+    }
   }
   virtual void visit(const loop* op) override {
     op->bounds.min.accept(this);
@@ -912,6 +922,178 @@ inline void slice_dim::accept(node_visitor* v) const { v->visit(this); }
 inline void truncate_rank::accept(node_visitor* v) const { v->visit(this); }
 inline void check::accept(node_visitor* v) const { v->visit(this); }
 
+// Calls `v.visit(op)`, where `op` is `n` cast to its concrete node type. Unlike `accept`, this dispatches with a switch
+// on the node type rather than two virtual calls, so `V` does not need to be a `node_visitor`, and `V::visit` can be
+// inlined.
+template <typename V>
+decltype(auto) dispatch(V& v, const base_node* n) {
+  switch (n->type) {
+  case node_type::variable: return v.visit(static_cast<const variable*>(n));
+  case node_type::wildcard: return v.visit(static_cast<const wildcard*>(n));
+  case node_type::constant: return v.visit(static_cast<const constant*>(n));
+  case node_type::let: return v.visit(static_cast<const let*>(n));
+  case node_type::add: return v.visit(static_cast<const add*>(n));
+  case node_type::sub: return v.visit(static_cast<const sub*>(n));
+  case node_type::mul: return v.visit(static_cast<const mul*>(n));
+  case node_type::div: return v.visit(static_cast<const div*>(n));
+  case node_type::mod: return v.visit(static_cast<const mod*>(n));
+  case node_type::min: return v.visit(static_cast<const class min*>(n));
+  case node_type::max: return v.visit(static_cast<const class max*>(n));
+  case node_type::equal: return v.visit(static_cast<const equal*>(n));
+  case node_type::not_equal: return v.visit(static_cast<const not_equal*>(n));
+  case node_type::less: return v.visit(static_cast<const less*>(n));
+  case node_type::less_equal: return v.visit(static_cast<const less_equal*>(n));
+  case node_type::logical_and: return v.visit(static_cast<const logical_and*>(n));
+  case node_type::logical_or: return v.visit(static_cast<const logical_or*>(n));
+  case node_type::logical_not: return v.visit(static_cast<const logical_not*>(n));
+  case node_type::select: return v.visit(static_cast<const select_expr*>(n));
+  case node_type::call: return v.visit(static_cast<const call*>(n));
+  case node_type::call_stmt: return v.visit(static_cast<const call_stmt*>(n));
+  case node_type::copy_stmt: return v.visit(static_cast<const copy_stmt*>(n));
+  case node_type::let_stmt: return v.visit(static_cast<const let_stmt*>(n));
+  case node_type::block: return v.visit(static_cast<const block*>(n));
+  case node_type::loop: return v.visit(static_cast<const loop*>(n));
+  case node_type::if_then_else: return v.visit(static_cast<const if_then_else*>(n));
+  case node_type::allocate: return v.visit(static_cast<const allocate*>(n));
+  case node_type::make_buffer: return v.visit(static_cast<const make_buffer*>(n));
+  case node_type::clone_buffer: return v.visit(static_cast<const clone_buffer*>(n));
+  case node_type::crop_buffer: return v.visit(static_cast<const crop_buffer*>(n));
+  case node_type::crop_dim: return v.visit(static_cast<const crop_dim*>(n));
+  case node_type::slice_buffer: return v.visit(static_cast<const slice_buffer*>(n));
+  case node_type::slice_dim: return v.visit(static_cast<const slice_dim*>(n));
+  case node_type::truncate_rank: return v.visit(static_cast<const truncate_rank*>(n));
+  case node_type::check: return v.visit(static_cast<const check*>(n));
+  default: std::abort();
+  }
+}
+
+// A recursive visitor like `recursive_node_visitor`, that uses `dispatch` to traverse the nodes instead of virtual
+// calls. `T` should derive from `recursive_visitor<T>`, and can hide any of the `visit` methods with its own. `T` should
+// also have `using recursive_visitor<T>::visit;`, so the overloads it does not define are still found.
+template <typename T>
+class recursive_visitor {
+  T& self() { return *static_cast<T*>(this); }
+
+public:
+  void visit(const expr& e) {
+    if (e.defined()) dispatch(self(), e.get());
+  }
+  void visit(const stmt& s) {
+    if (s.defined()) dispatch(self(), s.get());
+  }
+  void visit(const interval_expr& i) {
+    self().visit(i.min);
+    self().visit(i.max);
+  }
+  void visit(const dim_expr& d) {
+    self().visit(d.bounds);
+    self().visit(d.stride);
+    self().visit(d.fold_factor);
+  }
+
+  void visit(const variable*) {}
+  void visit(const wildcard*) {}
+  void visit(const constant*) {}
+  void visit(const let* op) {
+    self().visit(op->value);
+    self().visit(op->body);
+  }
+
+  template <typename Op>
+  void visit_binary(const Op* op) {
+    self().visit(op->a);
+    self().visit(op->b);
+  }
+
+  void visit(const add* op) { self().visit_binary(op); }
+  void visit(const sub* op) { self().visit_binary(op); }
+  void visit(const mul* op) { self().visit_binary(op); }
+  void visit(const div* op) { self().visit_binary(op); }
+  void visit(const mod* op) { self().visit_binary(op); }
+  void visit(const class min* op) { self().visit_binary(op); }
+  void visit(const class max* op) { self().visit_binary(op); }
+  void visit(const equal* op) { self().visit_binary(op); }
+  void visit(const not_equal* op) { self().visit_binary(op); }
+  void visit(const less* op) { self().visit_binary(op); }
+  void visit(const less_equal* op) { self().visit_binary(op); }
+  void visit(const logical_and* op) { self().visit_binary(op); }
+  void visit(const logical_or* op) { self().visit_binary(op); }
+  void visit(const logical_not* op) { self().visit(op->a); }
+  void visit(const select_expr* op) {
+    self().visit(op->condition);
+    self().visit(op->true_value);
+    self().visit(op->false_value);
+  }
+  void visit(const call* op) {
+    for (const expr& i : op->args) {
+      self().visit(i);
+    }
+  }
+
+  void visit(const let_stmt* op) {
+    self().visit(op->value);
+    self().visit(op->body);
+  }
+  void visit(const block* op) {
+    for (const stmt& i : op->stmts) {
+      self().visit(i);
+    }
+  }
+  void visit(const loop* op) {
+    self().visit(op->bounds);
+    self().visit(op->step);
+    self().visit(op->body);
+  }
+  void visit(const if_then_else* op) {
+    self().visit(op->condition);
+    self().visit(op->true_body);
+    self().visit(op->false_body);
+  }
+  void visit(const call_stmt* op) {}
+  void visit(const copy_stmt* op) {
+    for (const expr& i : op->src_x) {
+      self().visit(i);
+    }
+  }
+  void visit(const allocate* op) {
+    for (const dim_expr& i : op->dims) {
+      self().visit(i);
+    }
+    self().visit(op->body);
+  }
+  void visit(const make_buffer* op) {
+    self().visit(op->base);
+    self().visit(op->elem_size);
+    for (const dim_expr& i : op->dims) {
+      self().visit(i);
+    }
+    self().visit(op->body);
+  }
+  void visit(const clone_buffer* op) { self().visit(op->body); }
+  void visit(const crop_buffer* op) {
+    for (const interval_expr& i : op->bounds) {
+      self().visit(i);
+    }
+    self().visit(op->body);
+  }
+  void visit(const crop_dim* op) {
+    self().visit(op->bounds);
+    self().visit(op->body);
+  }
+  void visit(const slice_buffer* op) {
+    for (const expr& i : op->at) {
+      self().visit(i);
+    }
+    self().visit(op->body);
+  }
+  void visit(const slice_dim* op) {
+    self().visit(op->at);
+    self().visit(op->body);
+  }
+  void visit(const truncate_rank* op) { self().visit(op->body); }
+  void visit(const check* op) { self().visit(op->condition); }
+};
+
 // If `x` is a constant, returns the value of the constant, otherwise `nullptr`.
 inline const index_t* as_constant(const expr& x) {
   const constant* cx = x.as<constant>();
@@ -1008,6 +1190,7 @@ expr abs(expr x);
 expr buffer_rank(expr buf);
 expr buffer_base(expr buf);
 expr buffer_elem_size(expr buf);
+expr buffer_size_bytes(expr buf);
 expr buffer_min(expr buf, expr dim);
 expr buffer_max(expr buf, expr dim);
 expr buffer_extent(expr buf, expr dim);
@@ -1018,7 +1201,7 @@ expr buffer_at(expr buf, span<const var> at);
 
 interval_expr buffer_bounds(const expr& buf, const expr& dim);
 dim_expr buffer_dim(const expr& buf, const expr& dim);
-std::vector<dim_expr> buffer_dims(const expr& buf, int rank);
+small_vector<dim_expr, 4> buffer_dims(const expr& buf, int rank);
 
 box_expr dims_bounds(span<const dim_expr> dims);
 
@@ -1080,6 +1263,96 @@ public:
   void clear() { values.clear(); }
 };
 
+// symbol_map<index_t> is the representation of the evaluation context, which is accessed frequently and copied into
+// each worker of a parallel loop. Rather than storing `std::optional<index_t>` (which is twice the size of index_t),
+// this stores the values densely, and tracks which values are defined in a separate bitset.
+template <>
+class symbol_map<index_t> {
+  std::vector<index_t> values;
+  std::vector<bool> defined;
+
+  void grow(std::size_t size) {
+    if (size >= values.size()) {
+      std::size_t new_size = std::max(values.size() * 2, size + 1);
+      values.resize(new_size);
+      defined.resize(new_size);
+    }
+  }
+
+  void set(symbol_id sym, const std::optional<index_t>& value) {
+    if (value) {
+      grow(sym);
+      values[sym] = *value;
+      defined[sym] = true;
+    } else if (sym < values.size()) {
+      defined[sym] = false;
+    }
+  }
+
+public:
+  // The mutable result of operator[]. This behaves like a reference to a `std::optional<index_t>`.
+  class reference {
+    symbol_map* map_;
+    symbol_id sym_;
+
+  public:
+    reference(symbol_map& map, symbol_id sym) : map_(&map), sym_(sym) {}
+
+    reference& operator=(index_t value) {
+      map_->set(sym_, value);
+      return *this;
+    }
+    reference& operator=(const std::optional<index_t>& value) {
+      map_->set(sym_, value);
+      return *this;
+    }
+    reference& operator=(const reference& value) { return operator=(value.operator std::optional<index_t>()); }
+
+    operator std::optional<index_t>() const { return map_->lookup(sym_); }
+    explicit operator bool() const { return map_->contains(sym_); }
+    index_t operator*() const { return map_->get(sym_); }
+  };
+
+  symbol_map() {}
+  symbol_map(std::initializer_list<std::pair<symbol_id, index_t>> init) {
+    for (const std::pair<symbol_id, index_t>& i : init) {
+      set(i.first, i.second);
+    }
+  }
+
+  // Returns the value of `sym`, which must be defined.
+  index_t get(symbol_id sym) const {
+    assert(contains(sym));
+    return values[sym];
+  }
+  index_t get(const var& v) const { return get(v.sym()); }
+
+  std::optional<index_t> lookup(symbol_id sym) const {
+    if (contains(sym)) {
+      return values[sym];
+    }
+    return std::nullopt;
+  }
+  std::optional<index_t> lookup(const var& v) const { return lookup(v.sym()); }
+
+  const index_t& lookup(symbol_id sym, const index_t& def) const { return contains(sym) ? values[sym] : def; }
+  const index_t& lookup(const var& v, const index_t& def) const { return lookup(v.sym(), def); }
+
+  std::optional<index_t> operator[](symbol_id sym) const { return lookup(sym); }
+  std::optional<index_t> operator[](const var& v) const { return lookup(v.sym()); }
+  reference operator[](symbol_id sym) { return reference(*this, sym); }
+  reference operator[](const var& v) { return reference(*this, v.sym()); }
+
+  bool contains(symbol_id sym) const { return sym < defined.size() && defined[sym]; }
+  bool contains(const var& v) const { return contains(v.sym()); }
+
+  std::size_t size() const { return values.size(); }
+  void clear() {
+    values.clear();
+    defined.clear();
+  }
+};
+
 // Set a value in an eval_context upon construction, and restore the old value upon destruction.
 template <typename T>
 class scoped_value_in_symbol_map {
@@ -1089,30 +1362,31 @@ class scoped_value_in_symbol_map {
 
 public:
   scoped_value_in_symbol_map(symbol_map<T>& context, symbol_id sym, T value) : context_(&context), sym_(sym) {
-    std::optional<T>& ctx_value = context[sym];
+    auto&& ctx_value = context[sym];
     old_value_ = std::move(ctx_value);
     ctx_value = std::move(value);
   }
   scoped_value_in_symbol_map(symbol_map<T>& context, symbol_id sym, std::optional<T> value)
       : context_(&context), sym_(sym) {
-    std::optional<T>& ctx_value = context[sym];
+    auto&& ctx_value = context[sym];
     old_value_ = std::move(ctx_value);
     ctx_value = std::move(value);
   }
 
   scoped_value_in_symbol_map(scoped_value_in_symbol_map&& other)
-      : context_(other.context), sym_(other.sym), old_value_(std::move(other.old_value_)) {
+      : context_(other.context_), sym_(other.sym_), old_value_(std::move(other.old_value_)) {
     // Don't let other.~scoped_value() unset this value.
-    other.context = nullptr;
+    other.context_ = nullptr;
   }
   scoped_value_in_symbol_map(const scoped_value_in_symbol_map&) = delete;
   scoped_value_in_symbol_map& operator=(const scoped_value_in_symbol_map&) = delete;
   scoped_value_in_symbol_map& operator=(scoped_value_in_symbol_map&& other) {
-    context_ = other.context;
-    sym_ = other.sym;
+    context_ = other.context_;
+    sym_ = other.sym_;
     old_value_ = std::move(other.old_value_);
     // Don't let other.~scoped_value_in_symbol_map() unset this value.
-    other.context = nullptr;
+    other.context_ = nullptr;
+    return *this;
   }
 
   const std::optional<T>& old_value() const { return old_value_; }
@@ -0,0 +1,253 @@
+#include "runtime/perf_counters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace slinky {
+
+namespace {
+
+constexpr int event_count = perf_profiler::event_count;
+
+#ifdef __linux__
+struct event_config {
+  std::uint32_t type;
+  std::uint64_t config;
+};
+
+// These are in the order of `perf_profiler::event`.
+const event_config event_configs[event_count] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    // On most CPUs, this is the number of misses in the last level cache.
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+int open_counter(const event_config& e) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = e.type;
+  attr.config = e.config;
+  // Counting user space only makes it more likely that we are permitted to open the counter.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // Count the calling thread, on any CPU.
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// The counters of one thread. These are opened the first time a thread uses them, and closed when the thread exits.
+class thread_counters {
+  int fds[event_count];
+
+public:
+  thread_counters() {
+    for (int i = 0; i < event_count; ++i) {
+#ifdef __linux__
+      fds[i] = open_counter(event_configs[i]);
+#else
+      fds[i] = -1;
+#endif
+    }
+  }
+  ~thread_counters() {
+    for (int fd : fds) {
+#ifdef __linux__
+      if (fd >= 0) close(fd);
+#endif
+    }
+  }
+
+  bool available(int i) const { return fds[i] >= 0; }
+
+  // Reads the current value of each counter, or 0 if the counter is not available.
+  void read(index_t* values) const {
+    for (int i = 0; i < event_count; ++i) {
+      std::uint64_t value = 0;
+#ifdef __linux__
+      if (fds[i] >= 0 && ::read(fds[i], &value, sizeof(value)) != sizeof(value)) {
+        value = 0;
+      }
+#endif
+      values[i] = value;
+    }
+  }
+};
+
+thread_counters& this_thread_counters() {
+  static thread_local thread_counters counters;
+  return counters;
+}
+
+// The number of bytes in the elements of the buffers `syms`. The buffers are cropped to the region the call accesses.
+index_t bytes_accessed(const eval_context& ctx, const call_stmt::symbol_list& syms) {
+  index_t result = 0;
+  for (symbol_id i : syms) {
+    const raw_buffer* buf = reinterpret_cast<const raw_buffer*>(ctx.lookup(i, 0));
+    if (!buf) continue;
+    index_t size = buf->elem_size;
+    for (std::size_t d = 0; d < buf->rank; ++d) {
+      size *= std::max<index_t>(0, buf->dim(d).extent());
+    }
+    result += size;
+  }
+  return result;
+}
+
+}  // namespace
+
+perf_profiler::counters& perf_profiler::counters::operator+=(const counters& r) {
+  calls += r.calls;
+  nanoseconds += r.nanoseconds;
+  bytes_read += r.bytes_read;
+  bytes_written += r.bytes_written;
+  for (int i = 0; i < event_count; ++i) {
+    events[i] += r.events[i];
+  }
+  return *this;
+}
+
+perf_profiler::perf_profiler(const node_context& symbols) : symbols_(symbols) {}
+
+bool perf_profiler::available(event e) { return this_thread_counters().available(static_cast<int>(e)); }
+
+void perf_profiler::accumulate(const call_stmt* op, const counters& c) {
+  // Calls without outputs are attributed to -1.
+  symbol_id sym = op->outputs.empty() ? -1 : op->outputs.front();
+  std::unique_lock l(mutex_);
+  results_[sym] += c;
+}
+
+void perf_profiler::attach(eval_context& ctx) {
+  ctx.call = [this](const call_stmt* op, eval_context& ctx) -> index_t {
+    const thread_counters& thread = this_thread_counters();
+    index_t before[event_count];
+    index_t after[event_count];
+
+    auto t0 = std::chrono::steady_clock::now();
+    thread.read(before);
+    index_t result = op->target(ctx);
+    thread.read(after);
+    auto t1 = std::chrono::steady_clock::now();
+
+    counters c;
+    c.calls = 1;
+    c.bytes_read = bytes_accessed(ctx, op->inputs);
+    c.bytes_written = bytes_accessed(ctx, op->outputs);
+    c.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    for (int i = 0; i < event_count; ++i) {
+      c.events[i] = after[i] - before[i];
+    }
+    accumulate(op, c);
+    return result;
+  };
+}
+
+std::map<std::string, perf_profiler::counters> perf_profiler::results() const {
+  std::unique_lock l(mutex_);
+  std::map<std::string, counters> named;
+  for (const auto& i : results_) {
+    named[i.first >= 0 ? symbols_.name(i.first) : "<no output>"] += i.second;
+  }
+  return named;
+}
+
+void perf_profiler::reset() {
+  std::unique_lock l(mutex_);
+  results_.clear();
+}
+
+void perf_profiler::print_roofline(std::ostream& os, double peak_bandwidth, double threshold) const {
+  const bool has_instructions = available(event::instructions);
+  os << "peak bandwidth=" << peak_bandwidth / 1e9 << "GB/s" << std::endl;
+  for (const auto& i : results()) {
+    const counters& c = i.second;
+    const index_t bytes = c.bytes_read + c.bytes_written;
+    const double bandwidth = c.nanoseconds > 0 ? bytes * 1e9 / c.nanoseconds : 0.0;
+    os << i.first << ": bytes read=" << c.bytes_read << ", bytes written=" << c.bytes_written
+       << ", bandwidth=" << bandwidth / 1e9 << "GB/s (" << 100.0 * bandwidth / peak_bandwidth << "% of peak)";
+    if (has_instructions && bytes > 0) {
+      os << ", instructions/byte=" << static_cast<double>(c[event::instructions]) / bytes;
+    }
+    os << ", " << (bandwidth >= threshold * peak_bandwidth ? "memory bound" : "compute bound") << std::endl;
+  }
+}
+
+double measure_copy_bandwidth(std::size_t size) {
+  std::unique_ptr<char[]> src(new char[size]);
+  std::unique_ptr<char[]> dst(new char[size]);
+  memset(src.get(), 1, size);
+  memset(dst.get(), 0, size);
+
+  // Take the best of a few trials.
+  double best = 0.0;
+  for (int trial = 0; trial < 5; ++trial) {
+    auto t0 = std::chrono::steady_clock::now();
+    // Copy in chunks, to avoid slow `memcpy` implementations for large copies on some CPUs (see apps/performance.cc).
+    constexpr std::size_t chunk_size = 2048;
+    for (std::size_t i = 0; i < size; i += chunk_size) {
+      memcpy(dst.get() + i, src.get() + i, std::min(chunk_size, size - i));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / 1e9;
+    if (seconds > 0) {
+      best = std::max(best, 2.0 * size / seconds);
+    }
+  }
+  return best;
+}
+
+std::ostream& operator<<(std::ostream& os, perf_profiler::event e) {
+  switch (e) {
+  case perf_profiler::event::cycles: return os << "cycles";
+  case perf_profiler::event::instructions: return os << "instructions";
+  case perf_profiler::event::llc_misses: return os << "llc_misses";
+  case perf_profiler::event::dtlb_misses: return os << "dtlb_misses";
+  default: return os << "<invalid event>";
+  }
+}
+
+std::ostream& operator<<(std::ostream& os, const perf_profiler& p) {
+  using event = perf_profiler::event;
+  const bool has_cycles = perf_profiler::available(event::cycles);
+  const bool has_instructions = perf_profiler::available(event::instructions);
+  for (const auto& i : p.results()) {
+    const perf_profiler::counters& c = i.second;
+    os << i.first << ": calls=" << c.calls << ", time=" << c.nanoseconds / 1e6 << "ms";
+    for (int e = 0; e < perf_profiler::event_count; ++e) {
+      if (perf_profiler::available(static_cast<event>(e))) {
+        os << ", " << static_cast<event>(e) << "=" << c.events[e];
+      }
+    }
+    if (has_cycles && has_instructions && c[event::cycles] > 0) {
+      os << ", ipc=" << static_cast<double>(c[event::instructions]) / c[event::cycles];
+    }
+    if (has_instructions && c[event::instructions] > 0) {
+      for (event e : {event::llc_misses, event::dtlb_misses}) {
+        if (perf_profiler::available(e)) {
+          os << ", " << e << "_pki=" << c[e] * 1000.0 / c[event::instructions];
+        }
+      }
+    }
+    os << std::endl;
+  }
+  if (!has_cycles) {
+    os << "(hardware performance counters are not available)" << std::endl;
+  }
+  return os;
+}
+
+}  // namespace slinky
@@ -0,0 +1,87 @@
+#ifndef SLINKY_RUNTIME_PERF_COUNTERS_H
+#define SLINKY_RUNTIME_PERF_COUNTERS_H
+
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+
+namespace slinky {
+
+// Profiles the `call_stmt`s evaluated with an `eval_context`, using hardware performance counters (via Linux
+// `perf_event_open`) of the thread running each call. The counts are attributed to the name of the first output buffer
+// of the call, which is the name of the func that produced it.
+//
+// Hardware counters are often not permitted (e.g. in containers, or if `/proc/sys/kernel/perf_event_paranoid` is too
+// high), and some events are not supported on all CPUs. Counters that can't be opened are reported as zero, and
+// `available` can be used to find out which events were counted. The number of calls and the elapsed time are always
+// counted.
+//
+// The profiler also records the bytes read and written by each call, computed from the (cropped) input and output
+// buffers passed to the call. Combined with the elapsed time, this gives the bandwidth achieved by each func, see
+// `print_roofline`.
+class perf_profiler {
+public:
+  enum class event {
+    cycles,
+    instructions,
+    llc_misses,
+    dtlb_misses,
+  };
+  static constexpr int event_count = 4;
+
+  struct counters {
+    index_t calls = 0;
+    index_t nanoseconds = 0;
+    index_t bytes_read = 0;
+    index_t bytes_written = 0;
+    index_t events[event_count] = {};
+
+    index_t operator[](event e) const { return events[static_cast<int>(e)]; }
+    counters& operator+=(const counters& r);
+  };
+
+private:
+  const node_context& symbols_;
+
+  mutable std::mutex mutex_;
+  std::map<symbol_id, counters> results_;
+
+  void accumulate(const call_stmt* op, const counters& c);
+
+public:
+  perf_profiler(const node_context& symbols);
+
+  // Profile the calls evaluated by `ctx`, by overriding `eval_context::call`. The profiler must outlive any
+  // evaluations using `ctx`.
+  void attach(eval_context& ctx);
+
+  // Returns true if `e` can be counted on the calling thread.
+  static bool available(event e);
+
+  // The counts accumulated so far, by func name.
+  std::map<std::string, counters> results() const;
+  void reset();
+
+  // Prints the bandwidth achieved by each func, and classifies it as memory bound if the bandwidth is at least
+  // `threshold` of `peak_bandwidth` (in bytes per second, e.g. from `measure_copy_bandwidth`), or compute bound
+  // otherwise. Compute bound funcs are the ones that would benefit from optimizing their implementation. Note that
+  // intermediate buffers are often small enough to stay in cache, so the bandwidth of funcs reading or writing them may
+  // exceed `peak_bandwidth`.
+  void print_roofline(std::ostream& os, double peak_bandwidth, double threshold = 0.5) const;
+};
+
+// Measures the bandwidth (bytes read plus bytes written per second) of copying a buffer of `size` bytes, which should
+// be larger than the last level cache.
+double measure_copy_bandwidth(std::size_t size = 64 << 20);
+
+std::ostream& operator<<(std::ostream& os, perf_profiler::event e);
+// Prints a table of the results, with derived metrics (instructions per cycle, misses per thousand instructions).
+std::ostream& operator<<(std::ostream& os, const perf_profiler& p);
+
+}  // namespace slinky
+
+#endif  // SLINKY_RUNTIME_PERF_COUNTERS_H
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <sstream>
+
+#include "runtime/buffer.h"
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+#include "runtime/perf_counters.h"
+#include "runtime/thread_pool.h"
+
+using namespace slinky;
+
+TEST(perf_profiler, calls) {
+  node_context ctx;
+  var x(ctx, "x");
+  var a(ctx, "a");
+  var b(ctx, "b");
+
+  thread_pool t;
+
+  for (loop_mode type : {loop_mode::serial, loop_mode::parallel}) {
+    perf_profiler profiler(ctx);
+
+    eval_context eval_ctx;
+    eval_ctx.enqueue_many = [&](const thread_pool::task& f) { t.enqueue(t.thread_count(), f); };
+    eval_ctx.enqueue_one = [&](thread_pool::task f) { t.enqueue(std::move(f)); };
+    eval_ctx.wait_for = [&](std::function<bool()> f) { t.wait_for(std::move(f)); };
+    profiler.attach(eval_ctx);
+
+    std::atomic<index_t> sum_x = 0;
+    auto work = [&](eval_context& ctx) -> index_t {
+      volatile index_t sum = 0;
+      for (index_t i = 0; i < 1000; ++i) {
+        sum += i;
+      }
+      sum_x += *ctx[x];
+      return 0;
+    };
+    stmt body = block::make({call_stmt::make(work, {}, {a.sym()}), call_stmt::make(work, {a.sym()}, {b.sym()})});
+    stmt l = loop::make(x.sym(), type, range(0, 10), 1, body);
+
+    ASSERT_EQ(evaluate(l, eval_ctx), 0);
+    // The profiler should still call the targets.
+    ASSERT_EQ(sum_x, 2 * 45);
+
+    auto results = profiler.results();
+    ASSERT_EQ(results.size(), 2);
+    for (const char* name : {"a", "b"}) {
+      const perf_profiler::counters& c = results[name];
+      ASSERT_EQ(c.calls, 10);
+      ASSERT_GT(c.nanoseconds, 0);
+      if (perf_profiler::available(perf_profiler::event::instructions)) {
+        ASSERT_GT(c[perf_profiler::event::instructions], 10 * 1000);
+      } else {
+        ASSERT_EQ(c[perf_profiler::event::instructions], 0);
+      }
+    }
+
+    std::stringstream report;
+    report << profiler;
+    ASSERT_NE(report.str().find("a: calls=10"), std::string::npos);
+
+    profiler.reset();
+    ASSERT_TRUE(profiler.results().empty());
+  }
+}
+
+TEST(perf_profiler, failure) {
+  node_context ctx;
+  var a(ctx, "a");
+
+  perf_profiler profiler(ctx);
+  eval_context eval_ctx;
+  profiler.attach(eval_ctx);
+  eval_ctx.call_failed = [](const call_stmt*) {};
+
+  stmt c = call_stmt::make([](eval_context&) -> index_t { return 3; }, {}, {a.sym()});
+  ASSERT_EQ(evaluate(c, eval_ctx), 3);
+  ASSERT_EQ(profiler.results()["a"].calls, 1);
+}
+
+TEST(perf_profiler, roofline) {
+  node_context ctx;
+  var a(ctx, "a");
+  var b(ctx, "b");
+
+  perf_profiler profiler(ctx);
+  eval_context eval_ctx;
+  profiler.attach(eval_ctx);
+
+  buffer<int, 2> a_buf({10, 20});
+  buffer<int, 2> b_buf({10, 20});
+  a_buf.allocate();
+  b_buf.allocate();
+  // Crop a to the region read by the call, which should be what is counted.
+  a_buf.dim(1).set_bounds(0, 4);
+  eval_ctx[a] = reinterpret_cast<index_t>(&a_buf);
+  eval_ctx[b] = reinterpret_cast<index_t>(&b_buf);
+
+  stmt c = call_stmt::make([](eval_context&) -> index_t { return 0; }, {a.sym()}, {b.sym()});
+  ASSERT_EQ(evaluate(c, eval_ctx), 0);
+  ASSERT_EQ(evaluate(c, eval_ctx), 0);
+
+  perf_profiler::counters result = profiler.results()["b"];
+  ASSERT_EQ(result.calls, 2);
+  ASSERT_EQ(result.bytes_read, 2 * 10 * 5 * sizeof(int));
+  ASSERT_EQ(result.bytes_written, 2 * 10 * 20 * sizeof(int));
+
+  std::stringstream report;
+  profiler.print_roofline(report, 1e9);
+  ASSERT_NE(report.str().find("b: bytes read=400, bytes written=1600"), std::string::npos);
+}
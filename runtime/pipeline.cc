@@ -1,7 +1,10 @@
 #include "runtime/pipeline.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 
+#include "runtime/buffer.h"
 #include "runtime/evaluate.h"
 #include "runtime/expr.h"
 
@@ -14,19 +17,44 @@ pipeline::pipeline(std::vector<var> args, std::vector<var> inputs, std::vector<v
 pipeline::pipeline(std::vector<var> inputs, std::vector<var> outputs, stmt body)
     : pipeline({}, std::move(inputs), std::move(outputs), std::move(body)) {}
 
+namespace {
+
+// Makes a copy of the metadata of `buf` (but not the data it points to) in `storage`, which must have room for a
+// raw_buffer followed by `buf->rank` dims.
+raw_buffer* clone_metadata(const raw_buffer* buf, void* storage) {
+  raw_buffer* result = reinterpret_cast<raw_buffer*>(storage);
+  result->allocation = nullptr;
+  result->base = buf->base;
+  result->elem_size = buf->elem_size;
+  result->rank = buf->rank;
+  result->dims = reinterpret_cast<dim*>(result + 1);
+  memcpy(result->dims, buf->dims, sizeof(dim) * buf->rank);
+  return result;
+}
+
+}  // namespace
+
 index_t pipeline::evaluate(scalars args, buffers inputs, buffers outputs, eval_context& ctx) const {
   assert(args.size() == args_.size());
   assert(inputs.size() == inputs_.size());
   assert(outputs.size() == outputs_.size());
 
+  if (ctx.capture) {
+    ctx.capture(args, inputs, outputs);
+  }
+
   for (std::size_t i = 0; i < args.size(); ++i) {
     ctx[args_[i]] = args[i];
   }
+  // The evaluator crops and slices buffers in place. The caller's buffers may be shared with other concurrent
+  // evaluations of this pipeline, so we give the evaluator copies of the buffer metadata to modify instead.
   for (std::size_t i = 0; i < inputs.size(); ++i) {
-    ctx[inputs_[i]] = reinterpret_cast<index_t>(inputs[i]);
+    void* storage = alloca(sizeof(raw_buffer) + sizeof(dim) * inputs[i]->rank);
+    ctx[inputs_[i]] = reinterpret_cast<index_t>(clone_metadata(inputs[i], storage));
   }
   for (std::size_t i = 0; i < outputs.size(); ++i) {
-    ctx[outputs_[i]] = reinterpret_cast<index_t>(outputs[i]);
+    void* storage = alloca(sizeof(raw_buffer) + sizeof(dim) * outputs[i]->rank);
+    ctx[outputs_[i]] = reinterpret_cast<index_t>(clone_metadata(outputs[i], storage));
   }
 
   return slinky::evaluate(body_, ctx);
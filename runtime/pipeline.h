@@ -24,6 +24,9 @@ public:
   using scalars = span<const index_t>;
   using buffers = span<const raw_buffer*>;
 
+  // Evaluating a pipeline does not modify the pipeline, its body, or the buffers passed in (other than the contents of
+  // the output buffers). This means the same pipeline can be evaluated concurrently from multiple threads, as long as
+  // each evaluation uses its own `eval_context` and writes to its own output buffers. Input buffers may be shared.
   index_t evaluate(scalars args, buffers inputs, buffers outputs, eval_context& ctx) const;
   index_t evaluate(buffers inputs, buffers outputs, eval_context& ctx) const;
   index_t evaluate(scalars args, buffers inputs, buffers outputs) const;
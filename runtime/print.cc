@@ -1,5 +1,6 @@
 #include "runtime/print.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -54,8 +55,10 @@ public:
   int depth = -1;
   std::ostream& os;
   const node_context* context;
+  const stmt_annotator* annotate;
 
-  printer(std::ostream& os, const node_context* context) : os(os), context(context) {}
+  printer(std::ostream& os, const node_context* context, const stmt_annotator* annotate = nullptr)
+      : os(os), context(context), annotate(annotate) {}
 
   template <typename T>
   printer& operator<<(const T& op) {
@@ -87,8 +90,8 @@ public:
     return *this << "{" << d.bounds << ", " << d.stride << ", " << d.fold_factor << "}";
   }
 
-  template <typename T>
-  void print_vector(const std::vector<T>& v, const std::string& sep = ", ") {
+  template <typename Vector>
+  void print_vector(const Vector& v, const std::string& sep = ", ") {
     for (std::size_t i = 0; i < v.size(); ++i) {
       *this << v[i];
       if (i + 1 < v.size()) {
@@ -113,11 +116,16 @@ public:
     print_vector(v);
     return *this;
   }
+  template <typename T, std::size_t N>
+  printer& operator<<(const small_vector<T, N>& v) {
+    print_vector(v);
+    return *this;
+  }
 
   printer& operator<<(const stmt& s) {
     if (s.defined()) {
       ++depth;
-      s.accept(this);
+      print_stmt(s);
       --depth;
     }
     return *this;
@@ -125,6 +133,19 @@ public:
 
   std::string indent(int extra = 0) const { return std::string(depth + extra, ' '); }
 
+  void print_stmt(const stmt& s) {
+    if (annotate) {
+      std::string comment = (*annotate)(s.get());
+      std::size_t begin = 0;
+      while (begin < comment.size()) {
+        std::size_t end = std::min(comment.find('\n', begin), comment.size());
+        os << indent() << "// " << comment.substr(begin, end - begin) << "\n";
+        begin = end + 1;
+      }
+    }
+    s.accept(this);
+  }
+
   void visit(const variable* v) override { *this << v->sym; }
   void visit(const wildcard* w) override { *this << w->sym; }
   void visit(const constant* c) override { *this << c->value; }
@@ -165,11 +186,8 @@ public:
   void visit(const call* op) override { *this << op->intrinsic << "(" << op->args << ")"; }
 
   void visit(const block* b) override {
-    if (b->a.defined()) {
-      b->a.accept(this);
-    }
-    if (b->b.defined()) {
-      b->b.accept(this);
+    for (const stmt& i : b->stmts) {
+      print_stmt(i);
     }
   }
 
@@ -283,6 +301,11 @@ void print(std::ostream& os, const stmt& s, const node_context* ctx) {
   p << s;
 }
 
+void print(std::ostream& os, const stmt& s, const node_context* ctx, const stmt_annotator& annotate) {
+  printer p(os, ctx, &annotate);
+  p << s;
+}
+
 std::ostream& operator<<(std::ostream& os, const expr& e) {
   print(os, e);
   return os;
@@ -3,6 +3,8 @@
 
 #include "runtime/expr.h"
 
+#include <functional>
+#include <string>
 #include <tuple>
 
 namespace slinky {
@@ -10,6 +12,11 @@ namespace slinky {
 void print(std::ostream& os, const expr& e, const node_context* ctx = nullptr);
 void print(std::ostream& os, const stmt& s, const node_context* ctx = nullptr);
 
+// Returns a comment to print before a stmt, or an empty string if there is nothing to print. The comment may have
+// multiple lines.
+using stmt_annotator = std::function<std::string(const base_stmt_node*)>;
+void print(std::ostream& os, const stmt& s, const node_context* ctx, const stmt_annotator& annotate);
+
 std::ostream& operator<<(std::ostream& os, const expr& e);
 std::ostream& operator<<(std::ostream& os, const stmt& s);
 
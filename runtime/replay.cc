@@ -0,0 +1,177 @@
+#include "runtime/replay.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace slinky {
+
+namespace {
+
+const char magic[8] = {'s', 'l', 'i', 'n', 'k', 'y', 'r', 'c'};
+const std::uint32_t version = 1;
+
+template <typename T>
+void write(std::ostream& os, const T& value) {
+  os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read(std::istream& is, T& value) {
+  return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+// Makes a buffer with the same bounds as `buf`, with dense strides.
+raw_buffer_ptr make_dense(const raw_buffer& buf) {
+  raw_buffer_ptr result = raw_buffer::make(buf.rank, buf.elem_size);
+  index_t stride = buf.elem_size;
+  for (std::size_t d = 0; d < buf.rank; ++d) {
+    result->dim(d).set_bounds(buf.dim(d).min(), buf.dim(d).max());
+    result->dim(d).set_stride(stride);
+    stride *= std::max<index_t>(0, buf.dim(d).extent());
+  }
+  return result;
+}
+
+raw_buffer_ptr copy_metadata(const raw_buffer& buf) {
+  raw_buffer_ptr result = raw_buffer::make(buf.rank, buf.elem_size);
+  for (std::size_t d = 0; d < buf.rank; ++d) {
+    result->dim(d) = buf.dim(d);
+  }
+  return result;
+}
+
+void write_metadata(std::ostream& os, const raw_buffer& buf) {
+  write<std::uint64_t>(os, buf.elem_size);
+  write<std::uint64_t>(os, buf.rank);
+  for (std::size_t d = 0; d < buf.rank; ++d) {
+    const dim& dim = buf.dim(d);
+    write<index_t>(os, dim.min());
+    write<index_t>(os, dim.max());
+    write<index_t>(os, dim.stride());
+    write<index_t>(os, dim.fold_factor());
+  }
+}
+
+raw_buffer_ptr read_metadata(std::istream& is) {
+  std::uint64_t elem_size, rank;
+  if (!read(is, elem_size) || !read(is, rank)) return {nullptr, nullptr};
+  raw_buffer_ptr buf = raw_buffer::make(rank, elem_size);
+  for (std::size_t d = 0; d < rank; ++d) {
+    index_t min, max, stride, fold_factor;
+    if (!read(is, min) || !read(is, max) || !read(is, stride) || !read(is, fold_factor)) return {nullptr, nullptr};
+    buf->dim(d).set_bounds(min, max);
+    buf->dim(d).set_stride(stride);
+    buf->dim(d).set_fold_factor(fold_factor);
+  }
+  return buf;
+}
+
+}  // namespace
+
+evaluate_recording::evaluate_recording(pipeline::scalars args, pipeline::buffers inputs, pipeline::buffers outputs)
+    : args(args.begin(), args.end()) {
+  for (const raw_buffer* i : inputs) {
+    this->inputs.push_back(raw_buffer::make(*i));
+  }
+  for (const raw_buffer* i : outputs) {
+    this->outputs.push_back(copy_metadata(*i));
+  }
+}
+
+void evaluate_recording::save(std::ostream& os) const {
+  os.write(magic, sizeof(magic));
+  write(os, version);
+
+  write<std::uint64_t>(os, args.size());
+  for (index_t i : args) {
+    write(os, i);
+  }
+
+  write<std::uint64_t>(os, inputs.size());
+  for (const raw_buffer_ptr& i : inputs) {
+    write_metadata(os, *i);
+    // Write the contents densely, in case the buffer has padding or is strided.
+    raw_buffer_ptr dense = make_dense(*i);
+    dense->allocate();
+    copy(*i, *dense);
+    write<std::uint64_t>(os, dense->size_bytes());
+    os.write(dense->allocation, dense->size_bytes());
+  }
+
+  write<std::uint64_t>(os, outputs.size());
+  for (const raw_buffer_ptr& i : outputs) {
+    write_metadata(os, *i);
+  }
+}
+
+bool evaluate_recording::load(std::istream& is) {
+  char file_magic[sizeof(magic)];
+  std::uint32_t file_version;
+  if (!is.read(file_magic, sizeof(file_magic)) || memcmp(file_magic, magic, sizeof(magic)) != 0) return false;
+  if (!read(is, file_version) || file_version != version) return false;
+
+  std::uint64_t count;
+  if (!read(is, count)) return false;
+  args.resize(count);
+  for (index_t& i : args) {
+    if (!read(is, i)) return false;
+  }
+
+  if (!read(is, count)) return false;
+  inputs.clear();
+  for (std::uint64_t i = 0; i < count; ++i) {
+    raw_buffer_ptr buf = read_metadata(is);
+    if (!buf) return false;
+    raw_buffer_ptr dense = make_dense(*buf);
+    std::uint64_t size;
+    if (!read(is, size) || size != dense->size_bytes()) return false;
+    dense->allocate();
+    if (!is.read(dense->allocation, size)) return false;
+    buf->allocate();
+    copy(*dense, *buf);
+    inputs.push_back(std::move(buf));
+  }
+
+  if (!read(is, count)) return false;
+  outputs.clear();
+  for (std::uint64_t i = 0; i < count; ++i) {
+    raw_buffer_ptr buf = read_metadata(is);
+    if (!buf) return false;
+    outputs.push_back(std::move(buf));
+  }
+  return true;
+}
+
+index_t evaluate_recording::evaluate(const pipeline& p, eval_context& ctx) {
+  std::vector<const raw_buffer*> input_ptrs;
+  for (const raw_buffer_ptr& i : inputs) {
+    input_ptrs.push_back(i.get());
+  }
+  std::vector<const raw_buffer*> output_ptrs;
+  for (raw_buffer_ptr& i : outputs) {
+    if (!i->base) i->allocate();
+    output_ptrs.push_back(i.get());
+  }
+  return p.evaluate(args, input_ptrs, output_ptrs, ctx);
+}
+
+eval_context::capture_fn capture_to_files(std::string prefix) {
+  auto count = std::make_shared<std::atomic<int>>(0);
+  return [prefix = std::move(prefix), count](
+             pipeline::scalars args, pipeline::buffers inputs, pipeline::buffers outputs) {
+    std::string filename = prefix + std::to_string((*count)++) + ".slinky_rec";
+    std::ofstream file(filename, std::ios::binary);
+    evaluate_recording(args, inputs, outputs).save(file);
+    if (!file) {
+      std::cerr << "Failed to write recording " << filename << std::endl;
+    }
+  };
+}
+
+}  // namespace slinky
@@ -0,0 +1,43 @@
+#ifndef SLINKY_RUNTIME_REPLAY_H
+#define SLINKY_RUNTIME_REPLAY_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "runtime/buffer.h"
+#include "runtime/evaluate.h"
+#include "runtime/pipeline.h"
+
+namespace slinky {
+
+// A recording of a call to `pipeline::evaluate`, to reproduce it offline: the scalar arguments, the input buffers
+// (metadata and contents), and the output buffers (metadata only). The buffers keep their strides and fold factors.
+// The pipeline itself is not recorded, so replaying requires building the same pipeline.
+class evaluate_recording {
+public:
+  std::vector<index_t> args;
+  std::vector<raw_buffer_ptr> inputs;
+  std::vector<raw_buffer_ptr> outputs;
+
+  evaluate_recording() = default;
+  // Makes a copy of the arguments, including the contents of the input buffers.
+  evaluate_recording(pipeline::scalars args, pipeline::buffers inputs, pipeline::buffers outputs);
+
+  // The recording is saved in a binary format that is only meant to be read by the same build of slinky on the same
+  // platform.
+  void save(std::ostream& os) const;
+  // Returns false if `is` does not contain a recording.
+  bool load(std::istream& is);
+
+  // Evaluates `p` with the recorded arguments. The outputs are allocated if necessary.
+  index_t evaluate(const pipeline& p, eval_context& ctx);
+};
+
+// Returns a function for `eval_context::capture` that saves each evaluation to a new file `prefix` + N + ".slinky_rec",
+// where N counts the evaluations captured by this function.
+eval_context::capture_fn capture_to_files(std::string prefix);
+
+}  // namespace slinky
+
+#endif  // SLINKY_RUNTIME_REPLAY_H
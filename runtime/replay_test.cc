@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "runtime/buffer.h"
+#include "runtime/evaluate.h"
+#include "runtime/expr.h"
+#include "runtime/pipeline.h"
+#include "runtime/replay.h"
+
+using namespace slinky;
+
+namespace {
+
+void assert_same_dims(const raw_buffer& a, const raw_buffer& b) {
+  ASSERT_EQ(a.rank, b.rank);
+  ASSERT_EQ(a.elem_size, b.elem_size);
+  for (std::size_t d = 0; d < a.rank; ++d) {
+    ASSERT_EQ(a.dim(d).min(), b.dim(d).min());
+    ASSERT_EQ(a.dim(d).extent(), b.dim(d).extent());
+    ASSERT_EQ(a.dim(d).stride(), b.dim(d).stride());
+    ASSERT_EQ(a.dim(d).fold_factor(), b.dim(d).fold_factor());
+  }
+}
+
+}  // namespace
+
+TEST(replay, save_load) {
+  // An input with padding between rows, and translated mins.
+  buffer<int, 2> in({10, 20});
+  in.dim(1).set_stride(12 * sizeof(int));
+  in.translate(3, -2);
+  in.allocate();
+  for_each_index(in, [&](auto i) { in(i) = i[0] * 100 + i[1]; });
+
+  buffer<short, 1> out({7});
+
+  const index_t args[] = {4, -5};
+  const raw_buffer* inputs[] = {&in};
+  const raw_buffer* outputs[] = {&out};
+  evaluate_recording rec(args, inputs, outputs);
+
+  std::stringstream s;
+  rec.save(s);
+
+  evaluate_recording loaded;
+  ASSERT_TRUE(loaded.load(s));
+  ASSERT_EQ(loaded.args, std::vector<index_t>({4, -5}));
+  ASSERT_EQ(loaded.inputs.size(), 1);
+  ASSERT_EQ(loaded.outputs.size(), 1);
+
+  assert_same_dims(*loaded.inputs[0], in);
+  const buffer<int>& loaded_in = loaded.inputs[0]->cast<int>();
+  for_each_index(in, [&](auto i) { ASSERT_EQ(loaded_in(i), in(i)); });
+
+  assert_same_dims(*loaded.outputs[0], out);
+  ASSERT_EQ(loaded.outputs[0]->base, nullptr);
+}
+
+TEST(replay, load_invalid) {
+  std::stringstream s("not a recording");
+  evaluate_recording rec;
+  ASSERT_FALSE(rec.load(s));
+
+  // A truncated recording.
+  buffer<int, 1> in({100});
+  in.allocate();
+  const raw_buffer* inputs[] = {&in};
+  std::stringstream saved;
+  evaluate_recording(pipeline::scalars{}, inputs, pipeline::buffers{}).save(saved);
+  std::string truncated = saved.str();
+  truncated.resize(truncated.size() - 10);
+  std::stringstream t(truncated);
+  ASSERT_FALSE(rec.load(t));
+}
+
+TEST(replay, capture) {
+  node_context ctx;
+  var n(ctx, "n");
+  var in(ctx, "in");
+  var out(ctx, "out");
+
+  // A pipeline that adds `n` to each element of `in`.
+  auto add_n = [&](eval_context& ctx) -> index_t {
+    const buffer<int>& in_buf = ctx.lookup_buffer(in.sym())->cast<int>();
+    const buffer<int>& out_buf = ctx.lookup_buffer(out.sym())->cast<int>();
+    for_each_index(out_buf, [&](auto i) { out_buf(i) = in_buf(i) + *ctx[n.sym()]; });
+    return 0;
+  };
+  pipeline p({n}, {in}, {out}, call_stmt::make(add_n, {in.sym()}, {out.sym()}));
+
+  buffer<int, 1> in_buf({8});
+  in_buf.allocate();
+  for_each_index(in_buf, [&](auto i) { in_buf(i) = i[0]; });
+  buffer<int, 1> out_buf({8});
+  out_buf.allocate();
+
+  const std::string prefix = testing::TempDir() + "replay_test_";
+  eval_context eval_ctx;
+  eval_ctx.capture = capture_to_files(prefix);
+
+  const index_t args[] = {3};
+  const raw_buffer* inputs[] = {&in_buf};
+  const raw_buffer* outputs[] = {&out_buf};
+  ASSERT_EQ(p.evaluate(args, inputs, outputs, eval_ctx), 0);
+
+  // Changing the inputs after the evaluation should not affect the recording.
+  for_each_index(in_buf, [&](auto i) { in_buf(i) = 0; });
+
+  const std::string filename = prefix + "0.slinky_rec";
+  std::ifstream file(filename, std::ios::binary);
+  evaluate_recording rec;
+  ASSERT_TRUE(rec.load(file));
+  std::remove(filename.c_str());
+
+  eval_context replay_ctx;
+  ASSERT_EQ(rec.evaluate(p, replay_ctx), 0);
+  const buffer<int>& replayed = rec.outputs[0]->cast<int>();
+  for_each_index(out_buf, [&](auto i) {
+    ASSERT_EQ(replayed(i), i[0] + 3);
+    ASSERT_EQ(replayed(i), out_buf(i));
+  });
+}
@@ -1,12 +1,19 @@
 #ifndef SLINKY_RUNTIME_UTIL_H
 #define SLINKY_RUNTIME_UTIL_H
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <limits>
+#include <memory>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace slinky {
@@ -32,6 +39,72 @@ T euclidean_mod(T a, T b) {
   return r + (sign_mask & std::abs(b));
 }
 
+// Computes `euclidean_div` and `euclidean_mod` of many numerators by the same divisor, using a multiply and shifts
+// instead of a hardware divide. The constants are computed once, when the divisor is known, as in libdivide (see
+// "Division by Invariant Integers using Multiplication", Granlund and Montgomery). Division by zero is zero.
+template <typename T>
+class invariant_divisor {
+  static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(std::uint64_t));
+  using wide_t = std::conditional_t<std::is_signed_v<T>, std::int64_t, std::uint64_t>;
+
+  T b_;
+  std::uint64_t multiplier_;
+  int shift1_, shift2_;
+  // All ones if the divisor is non-zero.
+  std::uint64_t nonzero_;
+  // All ones if the divisor is negative.
+  std::uint64_t negative_;
+
+  // Computes n / |b| for any 64-bit unsigned n.
+  std::uint64_t unsigned_div(std::uint64_t n) const {
+    std::uint64_t t = static_cast<std::uint64_t>((static_cast<unsigned __int128>(n) * multiplier_) >> 64);
+    return (t + ((n - t) >> shift1_)) >> shift2_;
+  }
+
+public:
+  invariant_divisor(T b = 1) : b_(b) {
+    std::uint64_t d = static_cast<std::uint64_t>(static_cast<wide_t>(b));
+    negative_ = 0;
+    if constexpr (std::is_signed_v<T>) {
+      if (b < 0) {
+        d = -d;
+        negative_ = ~std::uint64_t(0);
+      }
+    }
+    nonzero_ = d != 0 ? ~std::uint64_t(0) : 0;
+    d = std::max<std::uint64_t>(d, 1);
+
+    // l = ceil(log2(d))
+    const int l = d > 1 ? 64 - __builtin_clzll(d - 1) : 0;
+    const unsigned __int128 p = (static_cast<unsigned __int128>(1) << l) - d;
+    multiplier_ = static_cast<std::uint64_t>((p << 64) / d + 1);
+    shift1_ = std::min(l, 1);
+    shift2_ = std::max(l - 1, 0);
+  }
+
+  T divisor() const { return b_; }
+
+  T div(T a) const {
+    std::uint64_t q;
+    if constexpr (std::is_signed_v<T>) {
+      // Round down by dividing the one's complement of negative numerators.
+      std::uint64_t s = static_cast<std::uint64_t>(static_cast<std::int64_t>(a) >> 63);
+      q = unsigned_div(static_cast<std::uint64_t>(static_cast<std::int64_t>(a)) ^ s) ^ s;
+      q = (q ^ negative_) - negative_;
+    } else {
+      q = unsigned_div(a);
+    }
+    return static_cast<T>(q & nonzero_);
+  }
+
+  T mod(T a) const {
+    std::uint64_t r = static_cast<std::uint64_t>(static_cast<wide_t>(a)) -
+                      static_cast<std::uint64_t>(static_cast<wide_t>(div(a))) *
+                          static_cast<std::uint64_t>(static_cast<wide_t>(b_));
+    return static_cast<T>(r & nonzero_);
+  }
+};
+
 // Compute a / b, rounding down.
 template <typename T>
 inline T floor_div(T a, T b) {
@@ -119,6 +192,202 @@ inline T saturate_mod(T a, T b) {
   return euclidean_mod(a, b);
 }
 
+// A vector-like container that stores up to N items inline, and only allocates memory on the heap when it has more
+// than N items. This is intended for small collections that are usually not empty (such as the dimensions of a buffer),
+// where a std::vector would require an allocation.
+template <typename T, std::size_t N>
+class small_vector {
+  T* data_;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = N;
+  alignas(T) char storage_[sizeof(T) * N];
+
+  T* inline_data() { return reinterpret_cast<T*>(&storage_[0]); }
+  bool is_inline() const { return data_ == reinterpret_cast<const T*>(&storage_[0]); }
+
+  void deallocate() {
+    if (!is_inline()) {
+      std::allocator<T>().deallocate(data_, capacity_);
+      data_ = inline_data();
+      capacity_ = N;
+    }
+  }
+
+  // Take the elements of `other`, which must be empty.
+  void take(small_vector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+    assert(empty());
+    if (other.is_inline()) {
+      std::uninitialized_move(other.begin(), other.end(), data_);
+      size_ = other.size_;
+      other.clear();
+    } else {
+      deallocate();
+      data_ = other.data_;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.data_ = other.inline_data();
+      other.size_ = 0;
+      other.capacity_ = N;
+    }
+  }
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  small_vector() : data_(inline_data()) {}
+  explicit small_vector(std::size_t size) : small_vector() { resize(size); }
+  small_vector(std::size_t size, const T& value) : small_vector() { resize(size, value); }
+  template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+  small_vector(It begin, It end) : small_vector() {
+    for (; begin != end; ++begin) {
+      emplace_back(*begin);
+    }
+  }
+  small_vector(std::initializer_list<T> init) : small_vector(init.begin(), init.end()) {}
+  small_vector(const std::vector<T>& v) : small_vector(v.begin(), v.end()) {}
+  small_vector(const small_vector& other) : small_vector(other.begin(), other.end()) {}
+  small_vector(small_vector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) : small_vector() {
+    take(std::move(other));
+  }
+  ~small_vector() {
+    clear();
+    deallocate();
+  }
+
+  small_vector& operator=(const small_vector& other) {
+    if (this != &other) {
+      clear();
+      reserve(other.size());
+      std::uninitialized_copy(other.begin(), other.end(), data_);
+      size_ = other.size();
+    }
+    return *this;
+  }
+  small_vector& operator=(small_vector&& other) noexcept(std::is_nothrow_move_constructible<T>::value) {
+    if (this != &other) {
+      clear();
+      take(std::move(other));
+    }
+    return *this;
+  }
+  small_vector& operator=(std::initializer_list<T> init) {
+    clear();
+    reserve(init.size());
+    std::uninitialized_copy(init.begin(), init.end(), data_);
+    size_ = init.size();
+    return *this;
+  }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  std::size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  T& operator[](std::size_t i) {
+    assert(i < size_);
+    return data_[i];
+  }
+  const T& operator[](std::size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+  T& front() { return (*this)[0]; }
+  const T& front() const { return (*this)[0]; }
+  T& back() { return (*this)[size_ - 1]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  void reserve(std::size_t capacity) {
+    if (capacity <= capacity_) return;
+    capacity = std::max(capacity, capacity_ * 2);
+    T* new_data = std::allocator<T>().allocate(capacity);
+    std::uninitialized_move(begin(), end(), new_data);
+    std::destroy(begin(), end());
+    deallocate();
+    data_ = new_data;
+    capacity_ = capacity;
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity_) {
+      // `args` might refer to an element of this vector, so construct the new value before growing.
+      T value(std::forward<Args>(args)...);
+      reserve(size_ + 1);
+      new (data_ + size_) T(std::move(value));
+    } else {
+      new (data_ + size_) T(std::forward<Args>(args)...);
+    }
+    return data_[size_++];
+  }
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+  void pop_back() {
+    assert(size_ > 0);
+    data_[--size_].~T();
+  }
+
+  void resize(std::size_t size) {
+    reserve(size);
+    while (size_ < size) emplace_back();
+    while (size_ > size) pop_back();
+  }
+  void resize(std::size_t size, const T& value) {
+    reserve(size);
+    while (size_ < size) emplace_back(value);
+    while (size_ > size) pop_back();
+  }
+  void clear() {
+    std::destroy(begin(), end());
+    size_ = 0;
+  }
+
+  iterator insert(const_iterator pos, T value) {
+    std::size_t at = pos - begin();
+    emplace_back(std::move(value));
+    std::rotate(begin() + at, end() - 1, end());
+    return begin() + at;
+  }
+  template <typename It>
+  iterator insert(const_iterator pos, It first, It last) {
+    std::size_t at = pos - begin();
+    std::size_t old_size = size_;
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+    std::rotate(begin() + at, begin() + old_size, end());
+    return begin() + at;
+  }
+  iterator erase(const_iterator first, const_iterator last) {
+    iterator f = begin() + (first - begin());
+    iterator l = begin() + (last - begin());
+    iterator new_end = std::move(l, end(), f);
+    std::destroy(new_end, end());
+    size_ -= l - f;
+    return f;
+  }
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+};
+
 // Don't want to depend on C++20, so just provide our own span-like helper. Differences:
 // - const-only
 // - No fixed size extents
@@ -139,6 +408,8 @@ public:
   template <std::size_t N>
   span(const std::array<value_type, N>& x) : data_(std::data(x)), size_(N) {}
   span(const std::vector<value_type>& c) : data_(std::data(c)), size_(std::size(c)) {}
+  template <std::size_t N>
+  span(const small_vector<value_type, N>& c) : data_(c.data()), size_(c.size()) {}
 
   const value_type* data() const { return data_; }
   std::size_t size() const { return size_; }
@@ -153,8 +424,18 @@ public:
 };
 
 // Base class for reference counted objects.
+//
+// By default, the reference count is atomic, so objects can be shared by multiple threads. Building pipelines copies
+// nodes (and updates reference counts) very frequently, so if SLINKY_NON_ATOMIC_REF_COUNT is defined, the reference
+// count is a plain integer instead. This is only safe if objects are not copied or destroyed concurrently by multiple
+// threads. Evaluating a pipeline does not update reference counts, so pipelines built in this mode can still be
+// evaluated concurrently.
 class ref_counted {
+#ifdef SLINKY_NON_ATOMIC_REF_COUNT
+  mutable int ref_count_{0};
+#else
   mutable std::atomic<int> ref_count_{0};
+#endif
 
 public:
   int ref_count() const { return ref_count_; }